@@ -0,0 +1,487 @@
+/*
+ * commonapilogbench: 日志热路径的微基准.
+ *
+ *   commonapilogbench [-n iterations] [filter]
+ *
+ * 每个用例输出一行 JSON, 便于在版本之间比较:
+ *   {"name":"writer/file/devnull","iterations":200000,"ns_per_message":85.2,"allocs_per_message":0.000}
+ * 不能在当前环境运行的用例 (例如内核不支持 io_uring) 输出 "skipped" 和原因.
+ * filter 只运行名字包含它的用例. 分配次数是整个进程的, 包括异步写线程的分配.
+ */
+
+#include "MessageFormat.hpp"
+#include "JsonMessageFormat.hpp"
+#include "Rfc5424MessageFormat.hpp"
+#include "MessageRouter.hpp"
+#include "FileLogger.hpp"
+#include "FifoLogger.hpp"
+#include "MmapFileLogger.hpp"
+#include "RotatingFileLogger.hpp"
+#include "UringLogger.hpp"
+#include "StagingLogger.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <syslog.h>
+#include <unistd.h>
+
+using namespace commonapistdoutlogger;
+
+namespace
+{
+    std::atomic<uint64_t> allocations(0U);
+}
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1U, std::memory_order_relaxed);
+    if(void* p = std::malloc(size ? size : 1U))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    allocations.fetch_add(1U, std::memory_order_relaxed);
+    void* p = nullptr;
+    if(::posix_memalign(&p, std::max(sizeof(void*), static_cast<size_t>(alignment)), size ? size : 1U) != 0)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+    constexpr const char* PRIORITY_PREFIX("<$r> ");
+    constexpr const char* CLASSIC_PREFIX("%b %d %H:%M:%S.$3 $h $i[$p]: $L: ");
+
+    constexpr const char* IDENT("bench");
+    constexpr pid_t PID(4242);
+    constexpr char MESSAGE[] = "connection 17 established to 192.0.2.10:443 after 3 retries";
+    constexpr size_t MESSAGE_SIZE(sizeof(MESSAGE) - 1U);
+    constexpr char QUOTED_MESSAGE[] = "request \"GET /index.html\" from 192.0.2.10\tstatus 200";
+    constexpr size_t QUOTED_MESSAGE_SIZE(sizeof(QUOTED_MESSAGE) - 1U);
+    constexpr char MULTILINE_MESSAGE[] = "request failed:\n  at handler (server.cpp:120)\n  at main (main.cpp:42)";
+    constexpr size_t MULTILINE_MESSAGE_SIZE(sizeof(MULTILINE_MESSAGE) - 1U);
+    constexpr unsigned ALL_SANITIZE_MODES(MessageSanitizer::ESCAPE_CONTROL | MessageSanitizer::REPLACE_INVALID_UTF8 | MessageSanitizer::SPLIT_LINES);
+
+    size_t iterations(200000U);
+    const char* filter(nullptr);
+
+    struct Case
+    {
+        // 每次调用处理一条消息
+        std::function<void()> run;
+        // 计时结束前调用, 例如等待异步写线程写完
+        std::function<void()> finish;
+    };
+
+    void report(const char* name, double nsPerMessage, double allocsPerMessage)
+    {
+        std::printf("{\"name\":\"%s\",\"iterations\":%zu,\"ns_per_message\":%.1f,\"allocs_per_message\":%.3f}\n",
+                    name, iterations, nsPerMessage, allocsPerMessage);
+        std::fflush(stdout);
+    }
+
+    void reportSkipped(const char* name, const char* reason)
+    {
+        std::printf("{\"name\":\"%s\",\"skipped\":\"%s\"}\n", name, reason);
+        std::fflush(stdout);
+    }
+
+    bool isSelected(const std::string& name)
+    {
+        return (filter == nullptr) || (name.find(filter) != std::string::npos);
+    }
+
+    // 先预热 (填满线程私有缓存, 时间缓存, 队列槽位的 string 容量), 再计时
+    void measure(const std::string& name, const std::function<Case()>& create)
+    {
+        if(!isSelected(name))
+        {
+            return;
+        }
+
+        try
+        {
+            Case c = create();
+            for(size_t i = 0; i < iterations / 10U; i++)
+            {
+                c.run();
+            }
+            if(c.finish)
+            {
+                c.finish();
+            }
+
+            const uint64_t allocationsBefore = allocations.load();
+            const auto start = std::chrono::steady_clock::now();
+            for(size_t i = 0; i < iterations; i++)
+            {
+                c.run();
+            }
+            if(c.finish)
+            {
+                c.finish();
+            }
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+            const uint64_t allocated = allocations.load() - allocationsBefore;
+
+            report(name.c_str(), static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / iterations,
+                   static_cast<double>(allocated) / iterations);
+        }catch(const std::exception& e)
+        {
+            reportSkipped(name.c_str(), e.what());
+        }
+    }
+
+    FileDescriptor openFile(const std::string& path)
+    {
+        FileDescriptor fd(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644), true);
+        if(fd < 0)
+        {
+            throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+        }
+        return fd;
+    }
+
+    std::string getTmpfsDirectory()
+    {
+        if(::access("/dev/shm", W_OK) == 0)
+        {
+            return "/dev/shm";
+        }
+
+        const char* dir = ::getenv("TMPDIR");
+        return (dir != nullptr) ? dir : "/tmp";
+    }
+
+    // pipe 的读端由一个线程持续读空, 写端不会因为 pipe 满而阻塞太久
+    class DrainedPipe
+    {
+    public:
+        DrainedPipe()
+        {
+            int fds[2];
+            if(::pipe2(fds, O_CLOEXEC) != 0)
+            {
+                throw std::runtime_error(std::string("pipe: ") + std::strerror(errno));
+            }
+            readFd = fds[0];
+            writeFd = fds[1];
+            reader = std::thread([this]()
+            {
+                char buffer[65536];
+                while(::read(readFd, buffer, sizeof(buffer)) > 0)
+                {
+                }
+            });
+        }
+
+        ~DrainedPipe()
+        {
+            if(writeFd >= 0)
+            {
+                ::close(writeFd);
+            }
+            reader.join();
+            ::close(readFd);
+        }
+
+        // writer 接管写端, 它析构时读线程读到 EOF 退出
+        FileDescriptor takeWriteFd()
+        {
+            const int fd = writeFd;
+            writeFd = -1;
+            return FileDescriptor(fd, true);
+        }
+
+        DrainedPipe(const DrainedPipe&) = delete;
+        DrainedPipe& operator=(const DrainedPipe&) = delete;
+    private:
+        int readFd;
+        int writeFd;
+        std::thread reader;
+    };
+
+    // create 每个用例调用一次, 返回被测的 formatter
+    void benchFormatter(const char* name, const std::function<std::shared_ptr<MessageFormatter>()>& create)
+    {
+        measure(std::string("formatter/createMessage/") + name, [create]()
+        {
+            auto formatter = create();
+            return Case{[formatter]()
+            {
+                const std::string message = formatter->createMessage(IDENT, PID, LOG_USER, LOG_INFO, MESSAGE, MESSAGE_SIZE);
+                (void)message;
+            }, {}};
+        });
+
+        measure(std::string("formatter/createFragments/") + name, [create]()
+        {
+            auto formatter = create();
+            auto buffer = std::make_shared<std::string>();
+            return Case{[formatter, buffer]()
+            {
+                MessageFragments fragments;
+                formatter->createFragments(*buffer, fragments, IDENT, PID, LOG_USER, LOG_INFO, MESSAGE, MESSAGE_SIZE);
+            }, {}};
+        });
+    }
+
+    void benchFormatter(const char* name, const char* prefix)
+    {
+        benchFormatter(name, [prefix]() { return std::make_shared<MessageFormatter>(prefix); });
+    }
+
+    // 消息体不需要转义时直接引用, 需要时转义进 buffer
+    void benchJsonFormatter(const char* name, const char* message, size_t size)
+    {
+        measure(std::string("formatter/createFragments/") + name, [message, size]()
+        {
+            auto formatter = std::make_shared<JsonMessageFormatter>();
+            auto buffer = std::make_shared<std::string>();
+            return Case{[formatter, buffer, message, size]()
+            {
+                MessageFragments fragments;
+                formatter->createFragments(*buffer, fragments, IDENT, PID, LOG_USER, LOG_INFO, message, size);
+            }, {}};
+        });
+    }
+
+    // 两个 sink 都是 /dev/null 上的同步 FileLogger, 测量的是过滤, (清理,) 格式化和一次 writev
+    void benchRouter(const char* name, int priority, unsigned sanitize = 0U, const char* message = MESSAGE, size_t size = MESSAGE_SIZE)
+    {
+        measure(std::string("router/write/") + name, [priority, sanitize, message, size]()
+        {
+            WriterConfiguration writer;
+            Configuration configuration;
+            configuration.includeLevels = {LOG_EMERG, LOG_ALERT, LOG_CRIT, LOG_ERR, LOG_WARNING, LOG_NOTICE, LOG_INFO};
+            configuration.sanitize = sanitize;
+
+            auto router = std::make_shared<MessageRouter>(std::make_unique<Rfc5424MessageFormatter>(), IDENT, LOG_USER, PID,
+                                                          std::move(configuration),
+                                                          std::make_unique<FileLogger>(openFile("/dev/null"), "bench-out", writer),
+                                                          std::make_unique<FileLogger>(openFile("/dev/null"), "bench-err", writer));
+            return Case{[router, priority, message, size]() { router->write(priority, message, size); }, {}};
+        });
+    }
+
+    // 一条已经格式化好的记录, 和 MessageRouter 交给 writer 的一样分成前缀, 消息体, 换行三段
+    Case writerCase(std::shared_ptr<LogWriter> writer, bool async)
+    {
+        static const std::string prefix("<14>1 2024-01-01T00:00:00.000000+00:00 host.example bench 4242 - - ");
+        static const struct iovec iov[] =
+        {
+            {const_cast<char*>(prefix.data()), prefix.size()},
+            {const_cast<char*>(MESSAGE), MESSAGE_SIZE},
+            {const_cast<char*>("\n"), 1U}
+        };
+
+        if(async)
+        {
+            return Case{[writer]() { writer->writeAsync(iov, 3); }, [writer]() { writer->waitAllWriteAsyncsCompleted(); }};
+        }
+        return Case{[writer]() { writer->write(iov, 3); }, {}};
+    }
+
+    WriterConfiguration asyncConfiguration()
+    {
+        WriterConfiguration configuration;
+        configuration.asyncQueueSize = 4096U;
+        return configuration;
+    }
+
+    // 每种 writer 在它实际会被选用的目标上测量: pipe 用 FifoLogger, mmap/切分只用于普通文件
+    void benchWriters()
+    {
+        const std::string tmpfsFile = getTmpfsDirectory() + "/commonapilogbench." + std::to_string(::getpid());
+
+        for(const bool async : {false, true})
+        {
+            const std::string mode = async ? "async" : "sync";
+            const WriterConfiguration configuration = async ? asyncConfiguration() : WriterConfiguration();
+
+            measure("writer/file/devnull/" + mode, [&]()
+            {
+                return writerCase(std::make_shared<FileLogger>(openFile("/dev/null"), "bench", configuration), async);
+            });
+
+            measure("writer/file/tmpfs/" + mode, [&]()
+            {
+                return writerCase(std::make_shared<FileLogger>(openFile(tmpfsFile), "bench", configuration), async);
+            });
+
+            measure("writer/fifo/pipe/" + mode, [&]()
+            {
+                auto pipe = std::make_shared<DrainedPipe>();
+                std::shared_ptr<FifoLogger> logger(new FifoLogger(pipe->takeWriteFd(), "bench", configuration),
+                                                   [pipe](FifoLogger* p) { delete p; });
+                return writerCase(logger, async);
+            });
+
+            measure("writer/rotating/tmpfs/" + mode, [&]()
+            {
+                FileDescriptor fd = openFile(tmpfsFile);
+                return writerCase(std::make_shared<RotatingFileLogger>(fd, "bench", configuration), async);
+            });
+        }
+
+        measure("writer/mmap/tmpfs/sync", [&]()
+        {
+            return writerCase(std::make_shared<MmapFileLogger>(openFile(tmpfsFile)), false);
+        });
+
+        measure("writer/fifo-vmsplice/pipe/async", [&]()
+        {
+            WriterConfiguration configuration = asyncConfiguration();
+            configuration.vmsplice = true;
+            auto pipe = std::make_shared<DrainedPipe>();
+            FileDescriptor fd = pipe->takeWriteFd();
+            ::fcntl(fd, F_SETPIPE_SZ, 1 << 20);    /* 插件里由 createLogWriter 按 pipeSize 设置 */
+            std::shared_ptr<FifoLogger> logger(new FifoLogger(std::move(fd), "bench", configuration),
+                                               [pipe](FifoLogger* p) { delete p; });
+            return writerCase(logger, true);
+        });
+
+        measure("writer/gzip/tmpfs/async", [&]()
+        {
+            WriterConfiguration configuration = asyncConfiguration();
+            configuration.compress = true;
+            return writerCase(std::make_shared<FileLogger>(openFile(tmpfsFile), "bench", configuration), true);
+        });
+
+        measure("writer/staging/tmpfs/async", [&]()
+        {
+            auto logger = std::make_unique<FileLogger>(openFile(tmpfsFile), "bench", WriterConfiguration());
+            return writerCase(std::make_shared<StagingLogger>(std::move(logger), "bench", 4096U, std::chrono::milliseconds(10)), true);
+        });
+
+        measure("writer/uring/devnull/async", [&]()
+        {
+            FileDescriptor fd = openFile("/dev/null");
+            return writerCase(std::make_shared<UringLogger>(fd, "bench", asyncConfiguration()), true);
+        });
+
+        measure("writer/uring/tmpfs/async", [&]()
+        {
+            FileDescriptor fd = openFile(tmpfsFile);
+            return writerCase(std::make_shared<UringLogger>(fd, "bench", asyncConfiguration()), true);
+        });
+
+        measure("writer/uring/pipe/async", [&]()
+        {
+            auto pipe = std::make_shared<DrainedPipe>();
+            FileDescriptor fd = pipe->takeWriteFd();
+            std::shared_ptr<UringLogger> logger(new UringLogger(fd, "bench", asyncConfiguration()),
+                                                [pipe](UringLogger* p) { delete p; });
+            return writerCase(logger, true);
+        });
+
+        ::unlink(tmpfsFile.c_str());
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int opt;
+    while((opt = ::getopt(argc, argv, "n:")) != -1)
+    {
+        if(opt != 'n')
+        {
+            std::fprintf(stderr, "usage: %s [-n iterations] [filter]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        iterations = std::strtoul(optarg, nullptr, 10);
+    }
+
+    if(optind < argc)
+    {
+        filter = argv[optind];
+    }
+
+    if(iterations == 0U)
+    {
+        std::fprintf(stderr, "iterations must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    benchFormatter("rfc5424", RFC5424_PREFIX);
+    benchFormatter("rfc5424-specialised", []() { return std::make_shared<Rfc5424MessageFormatter>(); });
+    benchFormatter("priority", PRIORITY_PREFIX);
+    benchFormatter("classic", CLASSIC_PREFIX);
+    benchJsonFormatter("json", MESSAGE, MESSAGE_SIZE);
+    benchJsonFormatter("json-escaped", QUOTED_MESSAGE, QUOTED_MESSAGE_SIZE);
+
+    benchRouter("dropped", LOG_DEBUG);
+    benchRouter("stdout", LOG_INFO);
+    benchRouter("stderr", LOG_ERR);
+    benchRouter("sanitized-clean", LOG_INFO, ALL_SANITIZE_MODES);
+    benchRouter("sanitized-multiline", LOG_INFO, ALL_SANITIZE_MODES, MULTILINE_MESSAGE, MULTILINE_MESSAGE_SIZE);
+
+    benchWriters();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,22 @@
+#ifndef COMMON_API_BENCH_STUB_LOGGER_HPP_
+#define COMMON_API_BENCH_STUB_LOGGER_HPP_
+
+#include <cstddef>
+
+// commonApi 日志接口中 MessageRouter 用到的部分, 只用于在没有安装 commonApi 的机器上编译 bench
+namespace commonApi
+{
+    namespace logger
+    {
+        class Logger
+        {
+        public:
+            virtual ~Logger() = default;
+            virtual void write(int priority, const char* message, size_t size) = 0;
+            virtual void writeAsync(int priority, const char* message, size_t size) = 0;
+            virtual void waitAllWriteAndCompleted() = 0;
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef COMMON_API_BENCH_STUB_PLUGIN_SERVICES_HPP_
+#define COMMON_API_BENCH_STUB_PLUGIN_SERVICES_HPP_
+
+// bench 不创建插件, 只需要 SignalRegistration 用到的部分
+namespace commonApi
+{
+    class SignalMonitorService;
+
+    class PluginServices
+    {
+    public:
+        virtual ~PluginServices() = default;
+        virtual SignalMonitorService& getSignalMonitor() = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef COMMON_API_BENCH_STUB_SIGNAL_MONITOR_SERVICE_HPP_
+#define COMMON_API_BENCH_STUB_SIGNAL_MONITOR_SERVICE_HPP_
+
+#include <functional>
+
+// SignalRegistration 用到的部分
+namespace commonApi
+{
+    class SignalMonitorService
+    {
+    public:
+        virtual ~SignalMonitorService() = default;
+        virtual void add(int signal, std::function<void()> handler) = 0;
+        virtual void del(int signal) = 0;
+    };
+}
+
+#endif
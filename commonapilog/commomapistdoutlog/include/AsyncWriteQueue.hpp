@@ -0,0 +1,92 @@
+#ifndef COMMON_API_ASYNC_WRITE_QUEUE_HPP_
+#define COMMON_API_ASYNC_WRITE_QUEUE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/uio.h>
+
+namespace commonapistdoutlogger
+{
+    /*
+     * 有界的多生产者/单消费者环形缓冲区 + 一个专门的写线程.
+     * 应用线程只把格式化好的日志拷贝进槽位 (槽位的 string 容量会被复用), 写线程负责把记录交给 sink 写到 fd.
+     * 写线程每次最多取出 IOV_MAX 条, 总长度不超过 maxBatchBytes 的记录交给 sink, 由 sink 用一次 writev 写出.
+     * 写线程屏蔽了所有信号, sink 写 pipe 时不会收到 SIGPIPE, 只会得到 EPIPE.
+     */
+    class AsyncWriteQueue
+    {
+    public:
+        using Records = std::vector<std::string>;
+        using Sink = std::function<void(const Records& records)>;
+        using Idle = std::function<void()>;
+        using Notice = std::function<std::string(const std::string& message)>;
+
+        // maxBatchBytes 为 0 表示只受 IOV_MAX 限制; 上一批因为达到上限而截断 (负载高) 时, 写线程先等待 linger 再取下一批.
+        // notice 在写线程上把丢弃提示格式化成一条完整的记录 (LogWriter::formatNotice).
+        // idle 不为空时, 队列空闲一段时间后在写线程上调用它, 例如把 sink 内部缓存的数据写出去
+        AsyncWriteQueue(size_t capacity, const std::string& name, size_t maxBatchBytes, std::chrono::microseconds linger, Sink sink, Notice notice,
+                        Idle idle = Idle());
+
+        // 写完所有已入队的记录后退出写线程
+        ~AsyncWriteQueue();
+
+        // 不阻塞: 队列满时丢弃并计数, 丢弃的条数在下一次写出时以一条提示记录报告
+        bool push(const struct iovec* iov, int count);
+
+        // 阻塞直到这条记录被写线程处理完, 保证和异步记录之间的顺序
+        void write(const struct iovec* iov, int count);
+
+        // 阻塞直到调用之前入队的所有记录都被写线程处理完
+        void waitAllCompleted();
+
+        AsyncWriteQueue(const AsyncWriteQueue&) = delete;
+        AsyncWriteQueue(AsyncWriteQueue&&) = delete;
+        AsyncWriteQueue& operator=(const AsyncWriteQueue&) = delete;
+        AsyncWriteQueue& operator=(AsyncWriteQueue&&) = delete;
+    private:
+        struct Cell
+        {
+            std::atomic<uint64_t> sequence;
+            std::string data;
+        };
+
+        const std::string name;
+        const uint64_t mask;
+        const size_t maxBatchBytes;
+        const std::chrono::microseconds linger;
+        std::unique_ptr<Cell[]> cells;
+        std::atomic<uint64_t> enqueuePosition;
+        uint64_t dequeuePosition;                 /* 只由写线程访问 */
+        std::atomic<uint64_t> completedPosition;  /* 已经交给 sink 的记录数 */
+        std::atomic<size_t> droppedRecords;
+
+        std::mutex lock;
+        std::condition_variable consumerWakeup;
+        std::condition_variable producerWakeup;
+        std::atomic<bool> consumerSleeping;
+        std::atomic<size_t> waitingProducers;
+        bool stopping;
+
+        Sink sink;
+        Notice notice;
+        Idle idle;
+        std::thread writer;
+
+        bool tryPush(const struct iovec* iov, int count, uint64_t& ticket);
+        bool pop(std::string& record, size_t maxSize);
+        void wakeConsumer();
+        void waitCompleted(uint64_t ticket);
+        void run();
+        void addDroppedRecordsNotice(Records& records);
+    };
+}
+
+#endif
@@ -103,7 +103,7 @@ namespace commonapistdoutlogger
 
         std::vector<T> getDefaultSet() const
         {
-            std::vector<int> defaultValues;
+            std::vector<T> defaultValues;
             for(const auto& it : values)
             {
                 defaultValues.push_back(it.second);
@@ -128,7 +128,7 @@ namespace commonapistdoutlogger
 
             valuesParsed = true;
 
-            for(size_t i = 0; i < tokens.size(); i++)
+            for(size_t i = 1; i < tokens.size(); i++)
             {
                 auto val = getValue(tokens[i]);
                 if(val)
@@ -228,6 +228,44 @@ namespace commonapistdoutlogger
         std::function<std::optional<T>(const std::string&)> extraEvaluator;
     };
 
+    // '=' 后面的整个字符串, 例如文件路径; 不做任何转换
+    class Text : public Parser::Attribute
+    {
+    public:
+        explicit Text(const std::string& name):Parser::Attribute(name) {}
+
+        bool parse(const std::string& input, std::ostream& errors) override
+        {
+            auto tokens = extractNameAndTokens(input, "");
+            if(tokens.empty() || !isEquals(tokens[0], getName()))
+            {
+                return false;
+            }
+
+            if(value)
+            {
+                errors << "duplicate definition for attribute " << getName() << std::endl;
+                return false;
+            }
+
+            if(2U != tokens.size())
+            {
+                errors << "definition for " << getName() << " must specify a value: error in " << input << std::endl;
+            }else
+            {
+                value = tokens[1];
+            }
+            return true;
+        }
+
+        const std::optional<std::string>& get() const noexcept
+        {
+            return value;
+        }
+    private:
+        std::optional<std::string> value;
+    };
+
     template<typename T>
     class OneOf : public ValueSet<T>
     {
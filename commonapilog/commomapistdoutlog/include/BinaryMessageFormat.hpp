@@ -0,0 +1,25 @@
+#ifndef COMMON_API_BINARY_MESSAGE_FORMAT_HPP_
+#define COMMON_API_BINARY_MESSAGE_FORMAT_HPP_
+
+#include "MessageFormat.hpp"
+#include "BinaryRecord.hpp"
+
+
+namespace commonapistdoutlogger
+{
+    /*
+     * 不渲染前缀, 只输出 BinaryRecordHeader 和原始消息体, 格式化推迟到用 commonapilogdecode 读取的时候.
+     * prefixFormat 仍然在构造时校验, 并写进 CONTEXT 记录供解码使用; CONTEXT 由 MessageRouter 按 sink 通过 createContext 输出.
+     */
+    class BinaryMessageFormatter : public MessageFormatter
+    {
+    public:
+        explicit BinaryMessageFormatter(const std::string& prefixFormat);
+
+        void createFragments(std::string& buffer, MessageFragments& fragments, const std::string& ident, pid_t pid, int facility, int priority, const char* message, size_t size) override;
+
+        bool createContext(std::string& buffer, const std::string& ident, pid_t pid, const struct timespec& t) const override;
+    };
+}
+
+#endif
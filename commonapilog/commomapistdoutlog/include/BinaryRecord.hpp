@@ -0,0 +1,39 @@
+#ifndef COMMON_API_BINARY_RECORD_HPP_
+#define COMMON_API_BINARY_RECORD_HPP_
+
+#include <cstdint>
+
+namespace commonapistdoutlogger
+{
+    /*
+     * messageFormat=binary 时输出的记录: 固定长度的头加 length 字节的内容, 字段按本机字节序.
+     * MESSAGE 的内容是原始的消息体; CONTEXT 的内容是 ident, hostname, fqdn, prefixFormat 四个字符串, 各以 '\0' 结尾,
+     * 它描述同一个 (pid, identId) 的 MESSAGE 应该怎样渲染, 在每个 sink 每秒的第一条记录前重复一次, 切分后的文件也能解码;
+     * 并发写入时同一秒的少数 MESSAGE 可能排在 CONTEXT 之前, 解码器暂存它们直到 CONTEXT 出现.
+     */
+    constexpr uint32_t BINARY_RECORD_MAGIC = 0x524c4143U;    /* "CALR" */
+
+    // length 的上限, 更长的消息体写出时被截断; 解码时超过上限的头视为损坏
+    constexpr uint32_t BINARY_RECORD_MAX_LENGTH = 16U << 20;
+
+    enum BinaryRecordType : uint16_t
+    {
+        BINARY_RECORD_MESSAGE = 0,
+        BINARY_RECORD_CONTEXT = 1
+    };
+
+    struct BinaryRecordHeader
+    {
+        uint32_t magic;
+        uint16_t type;
+        uint16_t priority;      /* 已经补上默认 facility */
+        uint32_t length;        /* 头后面的字节数 */
+        uint32_t pid;
+        uint64_t identId;       /* 同一个 pid 内区分不同的 ident 和前缀格式 */
+        uint64_t realtime;      /* CLOCK_REALTIME, 纳秒 */
+    };
+
+    static_assert(sizeof(BinaryRecordHeader) == 32U, "BinaryRecordHeader must not contain padding");
+}
+
+#endif
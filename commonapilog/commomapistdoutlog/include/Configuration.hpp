@@ -1,6 +1,9 @@
 #ifndef COMMON_API_CONFIGURATION_HPP_
 #define COMMON_API_CONFIGURATION_HPP_
 
+#include <chrono>
+#include <cstdint>
+#include <string>
 #include <vector>
 #include <sstream>
 #include <syslog.h>
@@ -14,6 +17,101 @@ namespace commonapistdoutlogger
    SyslogLevels getSyslogLevels();
    SyslogFacilities getSyslogFacilities();
 
+   // 普通文件按大小或时间切分, 0 表示不按这一项切分或不限制
+   struct RotationConfiguration
+   {
+      uint64_t maxBytes;               /* 活动文件超过这个大小时切分 */
+      std::chrono::seconds interval;   /* 按墙上时钟的整数倍切分, 例如 3600 表示每个整点 */
+      size_t keepSegments;             /* 最多保留的归档段数 */
+      uint64_t keepBytes;              /* 归档段的总大小上限 */
+
+      RotationConfiguration(): maxBytes(0U), interval(0), keepSegments(0U), keepBytes(0U)
+      {
+      }
+
+      bool enabled() const
+      {
+         return (maxBytes > 0U) || (interval.count() > 0);
+      }
+   };
+
+   // COMMON_API_STDOUT_LOGGER_SINKS 中的一个额外输出: 文件或 fifo, 有自己的 level/facility 过滤
+   struct SinkConfiguration
+   {
+      std::string path;
+      SyslogLevels includeLevels;
+      SyslogFacilities includeFacilities;
+   };
+
+   using SinkConfigurations = std::vector<SinkConfiguration>;
+
+   // 按 priority|facility 槽位分别限速, 超限的消息在格式化之前丢弃
+   struct RateLimitConfiguration
+   {
+      uint32_t rate;          /* 每个槽位每秒允许的条数, 0 表示不限速 */
+      uint32_t burst;         /* 允许的突发条数, 0 表示等于 rate */
+      int reportInterval;     /* 秒, 输出 "suppressed N messages" 汇总的周期 */
+      SyslogLevels levels;    /* 受限速的级别 */
+
+      RateLimitConfiguration(): rate(0U), burst(0U), reportInterval(10), levels(getSyslogLevels())
+      {
+      }
+
+      bool enabled() const
+      {
+         return rate > 0U;
+      }
+
+      uint32_t getBurst() const
+      {
+         return (burst > 0U) ? burst : rate;
+      }
+   };
+
+   // 日志的输出格式
+   enum class MessageFormat
+   {
+      TEXT,       /* 按 prefixFormat 渲染的文本行 */
+      BINARY,     /* BinaryRecordHeader + 消息体, 由 commonapilogdecode 离线渲染 */
+      JSON        /* 每行一个 JSON 对象 */
+   };
+
+   // fifo 的读端跟不上, 用户态溢出缓冲区也满了以后怎么处理新的记录
+   enum class OverflowPolicy
+   {
+      BLOCK,         /* 等待缓冲区腾出空间, 最多 overflowDeadline, 之后丢弃这一条 */
+      DROP_NEWEST,   /* 丢弃新的记录 */
+      DROP_OLDEST,   /* 丢弃缓冲区里最早的完整记录 */
+      DROP_BELOW     /* 缓冲区超过一半时丢弃级别低于 overflowLevel 的记录, 其它的和 BLOCK 一样 */
+   };
+
+   // FileLogger/FifoLogger 的写出方式
+   struct WriterConfiguration
+   {
+      size_t asyncQueueSize; /* 异步队列的槽位数, 0 表示在调用线程上直接写 */
+      size_t batchBytes;     /* 写线程一次 writev 的字节上限, 0 表示只受 IOV_MAX 限制; fifo 总是不超过 PIPE_BUF */
+      std::chrono::microseconds batchLinger; /* 负载高时写线程等待攒批的时间 */
+      bool sigpipeIgnored;   /* 进程已经忽略 SIGPIPE, 同步写 pipe 时不再需要每次屏蔽 SIGPIPE */
+      bool mmapFile;         /* 只有 logger 在写的普通文件 (sink) 用 MmapFileLogger 写入 */
+      bool uring;            /* 有异步队列且内核支持时用 io_uring 提交写入 */
+      bool compress;         /* logger 独占并且不切分的普通文件 (sink) 写成 gzip 流 (FileLogger) */
+      size_t stagingBytes;   /* writeAsync 每线程暂存区的大小, 0 表示不使用暂存区; pipe/socket 不超过 PIPE_BUF */
+      std::chrono::milliseconds stagingInterval; /* 暂存区最长停留时间 */
+      RotationConfiguration rotation;
+      size_t overflowBytes;  /* 大于 0 时 fifo 用非阻塞写, 写不进 pipe 的部分放进这么大的用户态缓冲区, 可写时由后台线程写出 */
+      OverflowPolicy overflowPolicy;
+      std::chrono::milliseconds overflowDeadline; /* BLOCK 和 DROP_BELOW 等待缓冲区腾出空间的最长时间 */
+      int overflowLevel;
+      bool vmsplice;         /* 有异步队列时 pipe 用 vmsplice 交出整页记录, 不再拷贝进 pipe 缓冲区 */
+      size_t pipeSize;       /* 大于 0 时在选择 writer 之前用 F_SETPIPE_SZ 调整 pipe 的容量 */
+
+      WriterConfiguration(): asyncQueueSize(0U), batchBytes(0U), batchLinger(0), sigpipeIgnored(false), mmapFile(false), uring(true), compress(false),
+                             stagingBytes(0U), stagingInterval(10), overflowBytes(0U), overflowPolicy(OverflowPolicy::BLOCK), overflowDeadline(100),
+                             overflowLevel(LOG_WARNING), vmsplice(false), pipeSize(0U)
+      {
+      }
+   };
+
    struct Configuration
    {
       SyslogLevels includeLevels;
@@ -21,19 +119,50 @@ namespace commonapistdoutlogger
 
       int minErrLevel;
 
-      Configuration(): includeLevels(getSyslogLevels()), includeFacilities(getSyslogFacilities()), minErrLevel(LOG_ERR)
+      int hostnameRefreshInterval; /* 秒, 0 表示只在启动时读取一次主机名 */
+
+      MessageFormat messageFormat;
+
+      RateLimitConfiguration rateLimit;
+
+      int repeatInterval;    /* 秒, 大于 0 时折叠同一线程连续的相同消息, 并至少每隔这么久报告一次重复条数 */
+
+      int statsInterval;     /* 秒, 大于 0 时每隔这么久以 syslog facility 输出一次计数器 */
+
+      unsigned sanitize;     /* MessageSanitizer::Mode 的组合, 0 表示消息体原样输出 */
+
+      SinkConfigurations sinks;
+
+      WriterConfiguration writer;
+
+      Configuration(): includeLevels(getSyslogLevels()), includeFacilities(getSyslogFacilities()), minErrLevel(LOG_ERR),
+                       hostnameRefreshInterval(0), messageFormat(MessageFormat::TEXT), repeatInterval(0), statsInterval(0), sanitize(0U)
       {
       }
 
       Configuration(const SyslogLevels& levels, const SyslogFacilities& facilities, int minErrLevel):
-                   includeLevels(levels), includeFacilities(facilities), minErrLevel(minErrLevel)
+                   includeLevels(levels), includeFacilities(facilities), minErrLevel(minErrLevel),
+                   hostnameRefreshInterval(0), messageFormat(MessageFormat::TEXT), repeatInterval(0), statsInterval(0), sanitize(0U)
       {
 
       }
 
    };
 
-   Configuration getConfiguration(std::ostream& errors);                            
+   Configuration getConfiguration(std::ostream& errors);
+
+   // 解析 COMMON_API_STDOUT_LOGGER_ATTRS 格式的字符串, 不包括 sinks
+   Configuration parseConfiguration(const std::string& configStr, std::ostream& errors);
+
+   // SIGHUP 时重新读取: COMMON_API_STDOUT_LOGGER_ATTRS_FILE 指向的文件可读时用它的内容, 否则回到 COMMON_API_STDOUT_LOGGER_ATTRS
+   Configuration reloadConfiguration(std::ostream& errors);
+
+   /*
+    * 解析 COMMON_API_STDOUT_LOGGER_SINKS: 用 ';' 分隔的多个 sink, 每个 sink 的属性和 COMMON_API_STDOUT_LOGGER_ATTRS 的写法相同, 例如
+    *   path=/var/log/app.log,level=debug-err;path=/run/app.fifo,level=emerg-err,facility=user|daemon
+    * path 必须给出, level/facility/excludeFacility 缺省时不过滤.
+    */
+   SinkConfigurations getSinkConfigurations(std::ostream& errors);                            
 }
 
 #endif
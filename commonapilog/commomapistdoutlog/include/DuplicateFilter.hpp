@@ -0,0 +1,56 @@
+#ifndef COMMON_API_DUPLICATE_FILTER_HPP_
+#define COMMON_API_DUPLICATE_FILTER_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace commonapistdoutlogger
+{
+    /*
+     * 折叠同一个线程连续写出的相同消息 (priority 和消息体都相同), 重试循环里的日志只保留第一条和一条 "repeated N times".
+     * 每个线程只记录上一条消息的 64 位 hash, 比较不需要拷贝消息体, 也不和其它线程共享状态.
+     * 一段重复在遇到不同的消息时结束; 持续重复时每隔 interval 报告一次; 线程不再写日志时由 takeStale 代为报告.
+     */
+    class DuplicateFilter
+    {
+    public:
+        struct Repeats
+        {
+            int priority;       /* 被重复的消息的 priority|facility */
+            uint64_t count;     /* 没有写出的重复条数, 0 表示没有需要报告的 */
+        };
+
+        explicit DuplicateFilter(std::chrono::milliseconds interval);
+
+        ~DuplicateFilter();
+
+        // 返回 true 表示和本线程的上一条消息相同, 已经计数, 调用者应该丢弃这条消息;
+        // repeats.count 不为 0 时调用者需要先报告这段重复
+        bool isDuplicate(int priority, const char* message, size_t size, Repeats& repeats);
+
+        // 取出所有已经持续超过 interval 还没有报告的重复, 包括已经退出的线程留下的, 由定时器周期调用
+        std::vector<Repeats> takeStale(bool all = false);
+
+        DuplicateFilter(const DuplicateFilter&) = delete;
+        DuplicateFilter(DuplicateFilter&&) = delete;
+        DuplicateFilter& operator=(const DuplicateFilter&) = delete;
+        DuplicateFilter& operator=(DuplicateFilter&&) = delete;
+    private:
+        struct State;
+        struct ThreadStates;
+
+        const uint64_t id;
+        const std::chrono::milliseconds interval;
+
+        std::mutex statesLock;
+        std::vector<std::shared_ptr<State>> states;
+
+        State& getState();
+    };
+}
+
+#endif
@@ -2,21 +2,84 @@
 #define COMMON_API_FIFO_LOGGER_HPP_
 
 #include "LogWriter.hpp"
+#include "AsyncWriteQueue.hpp"
+#include "Configuration.hpp"
 #include "FileDescriptor.hpp"
+#include "PipeSplicer.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace commonapistdoutlogger
 {
+    /*
+     * overflowBytes 大于 0 时写端是非阻塞的: pipe 通过 /proc/self/fd 重新打开成私有的 O_NONBLOCK 文件描述 (不影响共享这个 pipe 的其它进程),
+     * socket 用 MSG_DONTWAIT. 写不进去的部分按记录放进有界的溢出缓冲区, 由 drainer 线程 poll 到可写后写出;
+     * 缓冲区不空时新记录排在后面, 保持顺序. 缓冲区满时按 overflowPolicy 处理, 丢弃的条数在缓冲区写空后作为一条 LOG_WARNING 记录 (和普通日志相同的格式) 写出.
+     */
     class FifoLogger : public LogWriter
     {
     public:
-        FifoLogger(FileDescriptor&& fd);
-        ~FifoLogger() = default;
+        FifoLogger(FileDescriptor&& fd, const std::string& name, const WriterConfiguration& configuration);
+
+        // 溢出缓冲区里剩下的记录最多再等 overflowDeadline
+        ~FifoLogger();
 
         void write(const std::string& message) override;
         void writeAsync(const std::string& message) override;
+        void write(const struct iovec* iov, int count) override;
+        void writeAsync(const struct iovec* iov, int count) override;
         void waitAllWriteAsyncsCompleted() override;
+        bool isAccepted(int priority) override;
+        const Statistics* getStatistics() const override;
+
+        // 写线程是否用 vmsplice 写出 (只在满足条件并且分配页成功时启用)
+        bool isVmspliceEnabled() const noexcept;
     private:
         FileDescriptor fd;
+        Statistics statistics;
+        const std::string name;
+        const bool isSocket;        /* socket 用 MSG_NOSIGNAL 发送, 不需要屏蔽 SIGPIPE */
+        const bool sigpipeIgnored;
+        std::mutex largeWriteLock;                 /* 超过 PIPE_BUF 的 writev 不是原子的, 进程内的写者在这里串行 */
+        std::vector<struct iovec> batch;           /* 只由写线程使用 */
+        std::unique_ptr<PipeSplicer> splicer;      /* 不为空时写线程用 vmsplice 写出, 只由写线程使用 */
+
+        size_t overflowLimit;                      /* 0 表示阻塞写, 不使用溢出缓冲区 */
+        const OverflowPolicy overflowPolicy;
+        const std::chrono::milliseconds overflowDeadline;
+        const int overflowLevel;
+        std::mutex overflowLock;                   /* 非阻塞模式下所有写 (包括 drainer) 都在这里串行 */
+        std::condition_variable overflowPending;   /* 唤醒 drainer */
+        std::condition_variable overflowDrained;   /* 唤醒等待空间的写者 */
+        std::deque<std::string> overflowRecords;
+        size_t overflowOffset;                     /* 第一条记录已经写出的字节数, 这条记录不能再丢弃 */
+        std::atomic<size_t> overflowBytes;         /* 缓冲区中的字节数, isAccepted 不加锁读取 */
+        uint64_t overflowDropped;                  /* 还没有报告的丢弃条数 */
+        bool overflowStalled;                      /* 上一次等待超时后 drainer 还没有写出任何数据 */
+        std::vector<struct iovec> drainBatch;      /* 只由 drainer 使用 */
+        bool stopping;
+        std::thread drainer;
+
+        std::unique_ptr<AsyncWriteQueue> queue;    /* 为空时在调用线程上直接写; 最后声明, 析构时先停掉写线程 */
+
+        void writeRecords(const AsyncWriteQueue::Records& records);
+        void writeNow(const struct iovec* iov, int count);
+        void writeNonBlocking(const struct iovec* iov, int count, bool sigpipeBlocked);
+        ssize_t tryWrite(const struct iovec* iov, int count, bool sigpipeBlocked);
+        bool makeRoom(std::unique_lock<std::mutex>& guard, size_t size);
+        void dropOverflow(uint64_t records);
+        void runDrainer();
+        bool drainOnce();
+        void consumeOverflow(size_t written);
+        bool waitWritable(std::chrono::milliseconds timeout);
+        void checkWrite(ssize_t ret, std::chrono::steady_clock::time_point start);
     };
 
 }
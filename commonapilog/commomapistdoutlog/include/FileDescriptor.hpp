@@ -1,6 +1,8 @@
 #ifndef COMMON_API_FILE_DESCRIPTOR_HPP_
 #define COMMON_API_FILE_DESCRIPTOR_HPP_
 
+#include <atomic>
+
 namespace commonapistdoutlogger
 {
 
@@ -15,15 +17,16 @@ public:
 
     ~FileDescriptor();
 
-    operator int() const noexcept {return fd;}
+    operator int() const noexcept {return fd.load(std::memory_order_relaxed);}
 
+    // 之后的读取都返回 -1 (fd 被退役), 多个线程同时调用时只会 close 一次
     void close() noexcept;
 
     FileDescriptor(const FileDescriptor&) = delete;
     FileDescriptor& operator=(const FileDescriptor&) = delete;
 
 private:
-    int fd;
+    std::atomic<int> fd;
     bool ownership;
 };
 
@@ -3,20 +3,49 @@
 
 #include "FileDescriptor.hpp"
 #include "LogWriter.hpp"
+#include "AsyncWriteQueue.hpp"
+#include "Configuration.hpp"
+#include "GzipStream.hpp"
+
+#include <chrono>
+#include <vector>
 
 namespace commonapistdoutlogger
 {
     class FileLogger : public LogWriter
     {
     public:
-        FileLogger(FileDescriptor&& fd);
-        ~FileLogger() = default;
+        // configuration.compress 时文件写成 gzip 流: 压缩只在低优先级的写线程上进行, 没有配置异步队列时使用默认大小的队列
+        FileLogger(FileDescriptor&& fd, const std::string& name, const WriterConfiguration& configuration);
+        ~FileLogger();
     
         void write(const std::string& message) override;
         void writeAsync(const std::string& message) override;
+        void write(const struct iovec* iov, int count) override;
+        void writeAsync(const struct iovec* iov, int count) override;
         void waitAllWriteAsyncsCompleted() override;
+        const Statistics* getStatistics() const override;
     private:
        FileDescriptor fd;
+       Statistics statistics;
+       std::vector<struct iovec> batch;           /* 只由写线程使用 */
+
+       /* 压缩输出, 只由写线程使用 */
+       std::unique_ptr<GzipStream> gzip;
+       std::string compressed;
+       std::chrono::steady_clock::time_point blockStart;
+       bool lowPriority;
+
+       std::unique_ptr<AsyncWriteQueue> queue;    /* 为空时在调用线程上直接写; 最后声明, 析构时先停掉写线程 */
+
+       void writeRecords(const AsyncWriteQueue::Records& records);
+       void writeNow(const struct iovec* iov, int count);
+       void checkWrite(ssize_t ret, std::chrono::steady_clock::time_point start);
+       void compressRecords(const AsyncWriteQueue::Records& records);
+       bool isBlockExpired() const;
+       void finishExpiredBlock();
+       void finishBlock();
+       void writeCompressed();
     };
 
 };
@@ -0,0 +1,42 @@
+#ifndef COMMON_API_GZIP_STREAM_HPP_
+#define COMMON_API_GZIP_STREAM_HPP_
+
+#include <cstddef>
+#include <string>
+#include <zlib.h>
+
+namespace commonapistdoutlogger
+{
+    /*
+     * 把数据压缩成一个个独立的 gzip member. 每个 member 可以单独解压,
+     * 多个 member 首尾相连仍然是合法的 gzip 文件, zcat/gzip -d 可以直接读取.
+     */
+    class GzipStream
+    {
+    public:
+        // level 为 zlib 的压缩级别, 初始化失败时抛出 std::runtime_error
+        explicit GzipStream(int level);
+        ~GzipStream();
+
+        // 压缩后的数据追加到 out
+        void append(const char* data, size_t size, std::string& out);
+
+        // 结束当前 member, 之后的数据属于一个新的 member
+        void finish(std::string& out);
+
+        // 当前 member 已经输入的字节数
+        size_t pendingInput() const { return input; }
+
+        GzipStream(const GzipStream&) = delete;
+        GzipStream(GzipStream&&) = delete;
+        GzipStream& operator=(const GzipStream&) = delete;
+        GzipStream& operator=(GzipStream&&) = delete;
+    private:
+        z_stream stream;
+        size_t input;
+
+        int deflateInto(std::string& out, int flush);
+    };
+}
+
+#endif
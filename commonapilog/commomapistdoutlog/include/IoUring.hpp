@@ -0,0 +1,80 @@
+#ifndef COMMON_API_IO_URING_HPP_
+#define COMMON_API_IO_URING_HPP_
+
+#include "FileDescriptor.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+namespace commonapistdoutlogger
+{
+    /*
+     * io_uring 的最小封装, 直接使用系统调用 (不依赖 liburing).
+     * 只能由一个线程使用: 准备 sqe, 提交并等待, 批量收割 cqe.
+     */
+    class IoUring
+    {
+    public:
+        // 内核不支持 io_uring (ENOSYS, 被 seccomp/sysctl 禁用等) 或不支持 IORING_FEAT_RW_CUR_POS (5.6 以前) 时抛出 std::runtime_error
+        explicit IoUring(unsigned entries);
+        ~IoUring();
+
+        // 注册后 sqe 用 IOSQE_FIXED_FILE 和下标引用, 失败时抛出 std::runtime_error
+        void registerFiles(const int* fds, unsigned count);
+        void registerBuffers(const struct iovec* iov, unsigned count);
+
+        // 提交队列满时返回 nullptr, 返回的 sqe 已经清零
+        struct io_uring_sqe* getSqe();
+
+        // 用一次 io_uring_enter 提交所有准备好的 sqe, 并等待至少 waitCount 个完成; 出错时返回 -1 并保留 errno
+        int submitAndWait(unsigned waitCount);
+
+        // 不进入内核, 把已经完成的 cqe 逐个交给 function(userData, res), 返回收割的数量
+        template<typename Function>
+        unsigned reap(Function function)
+        {
+            unsigned head = *cqHead;
+            const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            const unsigned count = tail - head;
+            for(; head != tail; head++)
+            {
+                const struct io_uring_cqe& cqe = cqes[head & *cqMask];
+                function(cqe.user_data, cqe.res);
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+            return count;
+        }
+
+        IoUring(const IoUring&) = delete;
+        IoUring(IoUring&&) = delete;
+        IoUring& operator=(const IoUring&) = delete;
+        IoUring& operator=(IoUring&&) = delete;
+    private:
+        FileDescriptor ringFd;
+        unsigned sqEntries;
+
+        void* sqRing;
+        size_t sqRingSize;
+        void* cqRing;
+        size_t cqRingSize;
+        struct io_uring_sqe* sqes;
+        size_t sqesSize;
+
+        unsigned* sqHead;
+        unsigned* sqTail;
+        unsigned* sqMask;
+        unsigned* sqArray;
+        unsigned* cqHead;
+        unsigned* cqTail;
+        unsigned* cqMask;
+        struct io_uring_cqe* cqes;
+
+        unsigned sqeTail;   /* 已经准备但可能还没有发布给内核的 sqe 的尾部 */
+
+        void unmap() noexcept;
+    };
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef COMMON_API_JSON_MESSAGE_FORMAT_HPP_
+#define COMMON_API_JSON_MESSAGE_FORMAT_HPP_
+
+#include "MessageFormat.hpp"
+
+#include <cstddef>
+#include <string>
+
+namespace commonapistdoutlogger
+{
+    // 返回 data 中第一个需要在 JSON 字符串里转义的字节 ('"', '\\' 和 0x00-0x1f) 或不合法 UTF-8 字节的下标, 没有时返回 size.
+    // x86-64 上按 CPU 选择 AVX2 或 SSE2 每次检查 32/16 字节 (COMMON_API_LOGGER_SIMD=sse2 强制使用 SSE2), 遇到非 ASCII 字节时逐个校验 UTF-8 序列
+    size_t findJsonEscape(const char* data, size_t size) noexcept;
+
+    // 把 data 转义后追加到 out, 不加引号; 不合法的 UTF-8 字节逐个替换成 \ufffd; 不需要转义的连续片段整段拷贝
+    void appendJsonEscaped(std::string& out, const char* data, size_t size);
+
+    /*
+     * 每条日志输出一行 JSON 对象 (NDJSON):
+     *   {"ts":"2024-01-01T00:00:00.000000+08:00","level":"info","facility":"user","ident":"app","pid":42,"host":"h.example","msg":"..."}
+     * 字段顺序固定, 下游不需要再解析 RFC5424 文本. 消息体末尾的一个换行不输出;
+     * 消息体不需要转义时 (绝大多数情况) 和文本格式一样直接引用调用者的内存, 否则转义进 buffer.
+     * 合法的 UTF-8 原样输出, 不合法的字节 (例如截断的多字节序列或 Latin-1 文本) 每个替换成 \ufffd, 输出总是合法的 JSON.
+     */
+    class JsonMessageFormatter : public MessageFormatter
+    {
+    public:
+        JsonMessageFormatter();
+
+        void createFragments(std::string& buffer, MessageFragments& fragments, const std::string& ident, pid_t pid, int facility, int priority, const char* message, size_t size) override;
+    };
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef COMMON_API_LOG_CLOCK_HPP_
+#define COMMON_API_LOG_CLOCK_HPP_
+
+#include <time.h>
+
+namespace commonapistdoutlogger
+{
+    /*
+     * 日志时间戳的时钟, 由 COMMON_API_LOGGER_CLOCK 选择, 进程内所有 formatter 共用:
+     *   realtime (默认): clock_gettime(CLOCK_REALTIME), 纳秒精度
+     *   coarse:          CLOCK_REALTIME_COARSE, 只读内核上一次 tick 的时间, 精度是一个 tick (通常 1-4 ms)
+     *   tsc:             rdtsc 按校准出的频率换算成墙上时间. 后台线程每秒重新对齐一次 CLOCK_REALTIME,
+     *                    NTP 调频时两者每秒可以差几百微秒: 往前差直接跳过去, 往回差在下一秒内走慢追上, 同一个线程的时间戳不倒退;
+     *                    时钟被往回调超过 100 ms 时和 CLOCK_REALTIME 一样跳变.
+     *                    CPU 没有 invariant TSC 时退回 realtime, 校准完成前 (约 10 ms) 和 fork 出的子进程里也用 realtime
+     * clocksource 不是 tsc 时 (常见于虚拟机) vDSO 会退回系统调用, coarse 和 tsc 仍然不进入内核.
+     */
+    enum class LogClockSource
+    {
+        REALTIME,
+        REALTIME_COARSE,
+        TSC
+    };
+
+    // 第一次调用时读取 COMMON_API_LOGGER_CLOCK, 之后不再变化
+    LogClockSource getLogClockSource() noexcept;
+
+    const char* getLogClockName(LogClockSource source) noexcept;
+
+    void getLogTime(struct timespec& ts) noexcept;
+}
+
+#endif
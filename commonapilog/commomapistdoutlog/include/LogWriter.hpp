@@ -1,7 +1,11 @@
 #ifndef COMMON_API_LOG_WRITER_HPP
 #define COMMON_API_LOG_WRITER_HPP
 
+#include "Statistics.hpp"
+
+#include <functional>
 #include <string>
+#include <sys/uio.h>
 
 namespace commonapistdoutlogger
 {
@@ -13,12 +17,35 @@ namespace commonapistdoutlogger
         virtual void writeAsync(const std::string& message) = 0;
         virtual void waitAllWriteAsyncsCompleted() = 0;
 
+        // 一条日志由多个片段组成 (前缀, 调用者的消息体, 换行), 默认实现拼接后调用 string 版本
+        virtual void write(const struct iovec* iov, int count);
+        virtual void writeAsync(const struct iovec* iov, int count);
+
+        // 在格式化的记录交给 write/writeAsync 之前按 priority 做准入, 拒绝时由 writer 自己计入丢弃; 默认总是接受
+        virtual bool isAccepted(int priority);
+
+        // 写出的字节数, 错误和耗时; 不统计的 writer 返回 nullptr
+        virtual const Statistics* getStatistics() const;
+
+        // 把 writer 自己产生的提示 (例如丢弃了多少条) 格式化成和普通日志一样的完整记录
+        using NoticeFormatter = std::function<std::string(int priority, const std::string& message)>;
+
+        // 由 MessageRouter 在第一次写之前设置; 包装其它 writer 的 writer 需要转发
+        virtual void setNoticeFormatter(NoticeFormatter formatter);
+
         LogWriter(const LogWriter&) = delete;
         LogWriter(LogWriter&&) = delete;
         LogWriter& operator=(const LogWriter&) = delete;
         LogWriter& operator=(LogWriter&&) = delete ;
     protected:
        LogWriter() = default;
+
+       static std::string concatenate(const struct iovec* iov, int count);
+
+       // LOG_SYSLOG | LOG_WARNING 的提示记录; 没有设置 formatter 时 (单独使用 writer) 只加上换行
+       std::string formatNotice(const std::string& message) const;
+    private:
+       NoticeFormatter noticeFormatter;
     };
 
 }
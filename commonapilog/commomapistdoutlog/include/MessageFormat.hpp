@@ -1,9 +1,16 @@
 #ifndef COMMON_API_MESSAGE_FORMAT_HPP_
 #define COMMON_API_MESSAGE_FORMAT_HPP_
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 #include <syslog.h>
 #include <string_view>
+#include <sys/uio.h>
+#include <time.h>
 
 namespace commonapistdoutlogger
 {
@@ -13,23 +20,110 @@ namespace commonapistdoutlogger
         return (priority & ~(LOG_PRIMASK | LOG_FACMASK)) == 0; //(LOG_PRIMASK | LOG_FACMASK) 组合出所有合法的 priority 位掩码。
     }
 
+    // syslog facility 的名字, 例如 "daemon"; 不是标准 facility 时返回 nullptr
+    const char* facilityToName(int facility) noexcept;
+
+    // syslog level 的名字, 例如 "err"
+    const char* levelToName(int level) noexcept;
+
+    // 一条日志的分段表示: 前缀渲染在调用者提供的 buffer 中, 消息体直接引用调用者的内存, 不做复制
+    struct MessageFragments
+    {
+        static constexpr int MAX_FRAGMENTS = 3;
+
+        struct iovec iov[MAX_FRAGMENTS];
+        int count;
+    };
+
     class MessageFormatter
     {
     public:
+        // prefixFormat 在构造时编译成 token 序列, 格式非法时抛出 std::runtime_error
         MessageFormatter(const std::string& prefixFormat);
-        
+
         virtual ~MessageFormatter();
 
         virtual std::string createMessage(const std::string& indent, pid_t pid, int facility, int priority, const char* message, size_t size);
 
+        // buffer 会被清空并用来保存前缀, 在 fragments 使用完之前调用者不能修改它
+        virtual void createFragments(std::string& buffer, MessageFragments& fragments, const std::string& ident, pid_t pid, int facility, int priority, const char* message, size_t size);
+
+        // 解码需要的上下文记录 (二进制格式的 CONTEXT) 渲染到清空后的 buffer, 每个 sink 每秒在第一条记录前输出一次;
+        // 返回 false 表示格式没有上下文记录
+        virtual bool createContext(std::string& buffer, const std::string& ident, pid_t pid, const struct timespec& t) const;
+
+        // 重新读取 $h/$H 使用的主机名, 用于 SIGHUP 或定时器 (例如 UTS namespace 变化), 可以和 createMessage 并发调用
+        void refreshHostNames();
+
+        // 用给定的时间和主机名渲染前缀, 供离线解码二进制记录使用
+        void renderPrefix(std::string& out, int priority, const std::string& ident, pid_t pid, const struct timespec& t,
+                          const std::string& hostname, const std::string& fqdn) const;
+
+        const std::string& getPrefixFormat() const { return prefixFormat; }
+
         MessageFormatter(const MessageFormatter&) = delete;
         MessageFormatter(MessageFormatter&&) = delete;
         MessageFormatter operator=(const MessageFormatter&) = delete;
         MessageFormatter operator=(MessageFormatter&&) = delete;
+    protected:
+        struct HostNames
+        {
+            std::string hostname;
+            std::string fqdn;
+        };
+
+        uint64_t getId() const { return id; }
+
+        const HostNames& getHostNames() const { return *hostNames.load(std::memory_order_acquire); }
+
+        // 用当前的主机名把 prefixFormat 渲染到 out 的末尾, 子类用来复用按秒缓存的时间渲染
+        void appendPrefix(std::string& out, int priority, const std::string& ident, pid_t pid, const struct timespec& t) const;
     private:
+        enum class Operation
+        {
+            LITERAL,        /* 原样输出 text */
+            STRFTIME,       /* text 是 strftime 格式串, 例如 "%Y-%m-%dT%H:%M:%S." */
+            FACILITY,       /* $f */
+            FACILITY_NAME,  /* $F */
+            LEVEL,          /* $l */
+            LEVEL_NAME,     /* $L */
+            PRIORITY,       /* $r */
+            HOSTNAME,       /* $h */
+            FQDN,           /* $H */
+            IDENT,          /* $i */
+            PID,            /* $p */
+            TIMEZONE,       /* $z */
+            MILLISECONDS,   /* $3 */
+            MICROSECONDS,   /* $6 */
+            NANOSECONDS     /* $9 */
+        };
+
+        struct Token
+        {
+            Operation operation;
+            std::string text;
+            size_t slot;    /* STRFTIME token 在 TimeCache 中的下标 */
+        };
+
+        using Program = std::vector<Token>;
+
+        // 按秒缓存的时间渲染结果, 每个线程一份, 定义在 MessageFormat.cpp
+        struct TimeCache;
+
+        const uint64_t id;
         const std::string prefixFormat;
+        const Program program;
+
+        // 读者无锁地读取当前发布的版本; 发布过的版本都保留到析构, 主机名很少变化
+        std::atomic<const HostNames*> hostNames;
+        std::mutex hostNamesLock;
+        std::vector<std::unique_ptr<const HostNames>> publishedHostNames;
+
+        static Program compile(const std::string& prefixFormat);
+
+        const TimeCache& getTimeCache(time_t second) const;
 
-        std::string formatPrefix(int priority, const std::string& ident, pid_t pid, const struct timeval& t, const struct tm& tm);
+        void formatPrefix(std::string& out, int priority, const std::string& ident, pid_t pid, const struct timespec& t, const TimeCache& timeCache, const HostNames& names) const;
     };
 }
 
@@ -6,13 +6,39 @@
 
 #include "Configuration.hpp"
 #include "LogWriter.hpp"
+#include "RateLimiter.hpp"
+#include "DuplicateFilter.hpp"
+#include "MessageSanitizer.hpp"
+#include "Statistics.hpp"
 
 #include <array>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <vector>
 
 namespace commonapistdoutlogger
 {
     class MessageFormatter;
+    class SignalRegistration;
+    struct MessageFragments;
 
+    // COMMON_API_STDOUT_LOGGER_SINKS 中定义的额外输出和它自己的过滤条件, 构造时展开进 messageTargets
+    struct MessageSink
+    {
+        std::unique_ptr<LogWriter> logger;
+        SyslogLevels includeLevels;
+        SyslogFacilities includeFacilities;
+    };
+
+    /*
+     * write/writeAsync 可以被任意多个线程并发调用: 过滤表只读, 格式化只使用线程私有的缓存,
+     * 每条记录作为一个整体交给 writer (异步队列, 每线程暂存区或一次 writev), 不同线程的记录不会交错.
+     * 过滤表的每个槽位 (priority|facility) 是一个 sink 的位掩码: sink 0 是 stdout, sink 1 是 stderr, 之后是 extraSinks;
+     * 一条消息只格式化一次, 同一份 iovec 依次交给所有匹配的 sink.
+     * 过滤表可以在运行时用 reloadFilters 替换: 新表在调用线程上生成, 用一次原子指针写发布, 写日志的线程不加锁.
+     */
     class MessageRouter : public commonApi::logger::Logger
     {
     public:
@@ -21,18 +47,22 @@ namespace commonapistdoutlogger
                     int facility,
                     pid_t pid,
                     Configuration&& configuration,
-                    std::unique_ptr<LogWriter> logger);
+                    std::unique_ptr<LogWriter> logger,
+                    std::vector<MessageSink> extraSinks = {});
 
+     // level <= minErrLevel 的消息写到 stderrLogger, 其它写到 stdoutLogger
      MessageRouter(std::unique_ptr<MessageFormatter> messageFormatter,
                    const std::string& ident,
                    int facility,
                    pid_t pid,
                    Configuration&& configuration,
                    std::unique_ptr<LogWriter> stdoutLogger,
-                   std::unique_ptr<LogWriter> stderrLogger);
+                   std::unique_ptr<LogWriter> stderrLogger,
+                   std::vector<MessageSink> extraSinks = {});
   
 
-    ~MessageRouter() = default;
+    // 析构前报告还没有报告过的限速丢弃和重复
+    ~MessageRouter();
 
     void write(int priority, const char* message, size_t size) override;
 
@@ -40,27 +70,88 @@ namespace commonapistdoutlogger
 
     void waitAllWriteAndCompleted() override;
 
-    enum class MessageTarget
+    void refreshHostNames();
+
+    // 用新的 level/facility/minErrLevel 重新生成 stdout/stderr 的过滤表并发布, 额外 sink 的过滤条件不变; 用于 SIGHUP
+    void reloadFilters(const Configuration& filters);
+
+    // 每个被限速的槽位输出一条 "suppressed N messages" 汇总, 由定时器周期调用
+    void reportSuppressed();
+
+    // 报告已经持续超过 repeatInterval 的重复 (包括不再写日志的线程), 由定时器周期调用
+    void reportRepeats();
+
+    // 每个 sink 一行计数和写耗时, 以及没有写出的消息的汇总; 由定时器周期调用
+    void reportStatistics();
+
+    struct RouterStatistics
     {
-        DROPPED = 0,
-        STDERR,
-        STDOUT
+        Statistics::Snapshot messages;              /* 没有交给任何 sink 的消息: FILTERED, RATE_LIMITED, REPEATED */
+        std::vector<Statistics::Snapshot> sinks;    /* 下标和 SinkMask 的位相同: ROUTED 加上 writer 自己的写出统计 */
     };
 
-    using MessageTargets = std::array<MessageTarget, 255>;
+    // 可以在任意线程调用, 不影响写日志的线程
+    RouterStatistics getStatistics() const;
+
+    // 插件为这个 router 注册的 SIGHUP 处理, 随 router 一起注销
+    void setReloadSignal(std::unique_ptr<SignalRegistration> registration);
+
+    using SinkMask = uint32_t;
+
+    static constexpr size_t MAX_SINKS = 32U;
+    static constexpr SinkMask STDOUT_SINK = 1U << 0;
+    static constexpr SinkMask STDERR_SINK = 1U << 1;
+
+    using MessageTargets = std::array<SinkMask, 255>;
     private:
-        MessageTargets messageTargets;
+        struct SinkFilter
+        {
+            SyslogLevels includeLevels;
+            SyslogFacilities includeFacilities;
+        };
+
+        // 读者无锁地读取当前发布的过滤表; 发布过的表都保留到析构, 重新配置很少发生
+        std::atomic<const MessageTargets*> messageTargets;
+        std::mutex messageTargetsLock;
+        std::vector<std::unique_ptr<const MessageTargets>> publishedTargets;
+        const bool onlyStdout;
+        std::vector<SinkFilter> extraSinkFilters;
+
         std::unique_ptr<MessageFormatter> messageFormatter;
         const std::string ident;
         const int defaultFacility;
         const pid_t pid;
         Configuration configuration;
-        std::unique_ptr<LogWriter> stdoutLogger;
-        std::unique_ptr<LogWriter> stderrLogger;
+        std::vector<std::unique_ptr<LogWriter>> sinks;
+        std::unique_ptr<RateLimiter> rateLimiter;   /* 为空表示不限速 */
+        std::unique_ptr<DuplicateFilter> duplicateFilter;   /* 为空表示不折叠重复 */
+        std::unique_ptr<MessageSanitizer> sanitizer;        /* 为空表示消息体原样输出 */
+        Statistics statistics;
+        std::unique_ptr<Statistics[]> sinkStatistics;       /* 每个 sink 一个, 只统计 ROUTED */
+        std::unique_ptr<std::atomic<time_t>[]> contextSeconds;   /* 每个 sink 最近一次输出上下文记录的秒数; 为空表示格式没有上下文记录 */
+        std::unique_ptr<SignalRegistration> reloadSignal;   /* 最后声明, 析构时最先注销 */
+
+        MessageRouter(std::unique_ptr<MessageFormatter> messageFormatter,
+                      const std::string& ident,
+                      int facility,
+                      pid_t pid,
+                      Configuration&& configuration,
+                      std::unique_ptr<LogWriter> stdoutLogger,
+                      std::unique_ptr<LogWriter> stderrLogger,
+                      std::vector<MessageSink>&& extraSinks,
+                      bool onlyStdout);
 
-        MessageTarget getMessageTarget(int priority) const noexcept;
-        bool isStderrMessage(int messagePriority) const noexcept;
-        std::string createMessage(int priority, const char* message, size_t size);
+        SinkMask getMessageTargets(int priority, const char* message, size_t size);
+        void writeToSinks(SinkMask targets, int priority, const char* message, size_t size, bool async);
+        void writeFragments(size_t sink, const MessageFragments& fragments, bool async);
+        void writeSanitized(SinkMask targets, int priority, const char* message, size_t size, bool async);
+        bool isRepeated(int priority, const char* message, size_t size);
+        void reportRepeats(bool all);
+        void writeRepeats(const DuplicateFilter::Repeats& repeats);
+        void writeNotice(int priority, const char* message, size_t size);
+        std::string formatNotice(int priority, const std::string& message);
+        void writeStatistics(const char* name, const Statistics::Snapshot& snapshot);
+        void createMessage(std::string& buffer, MessageFragments& fragments, int priority, const char* message, size_t size);
     };
     
 }
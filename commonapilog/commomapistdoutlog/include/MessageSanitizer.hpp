@@ -0,0 +1,56 @@
+#ifndef COMMON_API_MESSAGE_SANITIZER_HPP_
+#define COMMON_API_MESSAGE_SANITIZER_HPP_
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace commonapistdoutlogger
+{
+    /*
+     * 在格式化之前清理调用者的消息体, 可以组合多种方式:
+     *   ESCAPE_CONTROL:       控制字符 (制表符除外) 和 DEL 写成 rsyslog 的 "#ooo" 八进制形式, 例如换行写成 #012
+     *   REPLACE_INVALID_UTF8: 不合法的 UTF-8 字节 (截断, 过长编码, 代理区, 超过 U+10FFFF) 逐字节换成 U+FFFD
+     *   SPLIT_LINES:          多行消息按 '\n' (或 "\r\n") 拆成多条记录, 每条都有自己的前缀; 空行被丢弃
+     * 消息体末尾的一个换行不算在内, 它由 formatter 处理.
+     * needsSanitizing 用 SIMD 每次检查 16/32 字节 (COMMON_API_LOGGER_SIMD=sse2 强制使用 SSE2), 干净的消息 (绝大多数) 只付出这一次扫描, 原样交给 formatter.
+     */
+    class MessageSanitizer
+    {
+    public:
+        enum Mode : unsigned
+        {
+            ESCAPE_CONTROL = 1U << 0,
+            REPLACE_INVALID_UTF8 = 1U << 1,
+            SPLIT_LINES = 1U << 2
+        };
+
+        // 处理后的消息: 每一行是 text 中的 (offset, length), 不拆分时只有一行
+        struct Lines
+        {
+            std::string text;
+            std::vector<std::pair<size_t, size_t>> spans;
+        };
+
+        explicit MessageSanitizer(unsigned modes);
+
+        bool needsSanitizing(const char* message, size_t size) const noexcept;
+
+        // lines 的容量会被复用, 调用者可以每个线程保留一个
+        void sanitize(const char* message, size_t size, Lines& lines) const;
+
+        MessageSanitizer(const MessageSanitizer&) = delete;
+        MessageSanitizer(MessageSanitizer&&) = delete;
+        MessageSanitizer& operator=(const MessageSanitizer&) = delete;
+        MessageSanitizer& operator=(MessageSanitizer&&) = delete;
+    private:
+        const unsigned modes;
+        const unsigned controlMask;     /* 控制字符需要处理时全 1 */
+        const unsigned highMask;        /* 非 ASCII 字节需要检查时全 1 */
+
+        size_t findSpecial(const char* data, size_t size) const noexcept;
+    };
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef COMMON_API_MMAP_FILE_LOGGER_HPP_
+#define COMMON_API_MMAP_FILE_LOGGER_HPP_
+
+#include "FileDescriptor.hpp"
+#include "LogWriter.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+namespace commonapistdoutlogger
+{
+    /*
+     * 普通文件的内存映射写入: 文件按 EXTENT 用 fallocate 预分配, 按 CHUNK 映射一个滑动窗口.
+     * 写者用 fetch_add 预留文件偏移, 然后把记录直接 memcpy 到映射里, 热路径上没有系统调用.
+     * 一个 chunk 被写满后由最后一个写者解除映射; 析构时把文件截断到实际写入的长度.
+     * 预分配的部分在析构前读起来是 0; 文件被外部截断 (例如 copytruncate) 后访问映射会收到 SIGBUS, 所以只在配置了 fileWriter=mmap 时使用.
+     * 其它写者 (应用的 printf/std::cout) 的写入不经过预留的偏移, 会和映射互相覆盖, 所以只用于 logger 独占的文件.
+     */
+    class MmapFileLogger : public LogWriter
+    {
+    public:
+        // 以读写方式重新打开 fd 指向的文件 (mmap 需要), 失败或文件系统不支持 fallocate/mmap 时抛出 std::runtime_error
+        explicit MmapFileLogger(const FileDescriptor& fd);
+        ~MmapFileLogger() override;
+
+        void write(const std::string& message) override;
+        void writeAsync(const std::string& message) override;
+        void write(const struct iovec* iov, int count) override;
+        void writeAsync(const struct iovec* iov, int count) override;
+        void waitAllWriteAsyncsCompleted() override;
+        const Statistics* getStatistics() const override;
+    private:
+        static constexpr size_t WINDOW_COUNT = 8U;
+
+        struct Window
+        {
+            std::atomic<uint64_t> chunk;  /* 映射的 chunk 序号 + 1, 0 表示空闲 */
+            char* base;
+            std::atomic<size_t> filled;   /* 已经拷贝完成的字节数, 达到 CHUNK_SIZE 时解除映射 */
+        };
+
+        FileDescriptor fd;
+        const uint64_t start;             /* 打开时的文件长度, 新记录从这里开始追加 */
+        std::atomic<uint64_t> tail;       /* 下一条记录的文件偏移 */
+        Statistics statistics;            /* 每条记录算一次写出, 只有 pwrite 回退会出错 */
+        std::atomic<bool> degraded;       /* 预分配或映射失败后, 还没有映射的 chunk 都改用 pwrite */
+
+        std::mutex mapLock;
+        uint64_t allocated;               /* 已经预分配的文件长度, 受 mapLock 保护 */
+        uint64_t mappedEnd;               /* 映射过的最大 chunk 序号 + 1, 受 mapLock 保护 */
+        Window windows[WINDOW_COUNT];
+
+        char* getWindow(uint64_t chunk);
+        void copyToWindows(uint64_t offset, size_t size, const struct iovec* iov, int count);
+        void release(uint64_t chunk, size_t bytes);
+        void writeFallback(uint64_t offset, const char* data, size_t size);
+    };
+}
+
+#endif
@@ -13,6 +13,8 @@ namespace commonapistdoutlogger
         
         void write(const std::string& ) override {}
         void writeAsync(const std::string& ) override {}
+        void write(const struct iovec*, int) override {}
+        void writeAsync(const struct iovec*, int) override {}
         void waitAllWriteAsyncsCompleted() override {}
     };
 }
@@ -0,0 +1,57 @@
+#ifndef COMMON_API_PIPE_SPLICER_HPP_
+#define COMMON_API_PIPE_SPLICER_HPP_
+
+#include "Statistics.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+
+namespace commonapistdoutlogger
+{
+    /*
+     * 用 vmsplice(SPLICE_F_GIFT) 把记录交给 pipe, 内核直接引用用户页, 写端不再把每条记录拷贝进 pipe 缓冲区.
+     * 记录按顺序装进页对齐的环形缓冲区, 一条记录不跨页, 每一页在 pipe 里是一个独立的 pipe_buffer, 和别的写者交错时记录仍然完整.
+     * 超过一页的记录直接 writev.
+     * 一页要等读端把它读走才能重用: 已经交给 pipe 的总字节数减去 FIONREAD 就是读走的字节数 (其它写者的数据只会让估计偏保守).
+     * 环形缓冲区是 pipe 容量的两倍, 正常情况下最旧的一页在需要时早已被读走.
+     * 读端用 splice 把数据继续转给别的文件时可能在读走后仍然引用这些页, 所以只在 fifoWriter=vmsplice 时使用.
+     * 只由一个线程 (FifoLogger 的写线程) 使用.
+     */
+    class PipeSplicer
+    {
+    public:
+        // pipeBytes 是 pipe 当前的容量 (F_GETPIPE_SZ); 映射失败时抛出 std::runtime_error
+        explicit PipeSplicer(size_t pipeBytes);
+        ~PipeSplicer();
+
+        // 阻塞直到所有记录都交给 pipe, 返回写出的字节数; 失败时返回 -1, errno 是 vmsplice/writev 的错误.
+        // 和 writeFully 一样只在 statistics 里计入 SHORT_WRITES, 写出本身由调用者记录
+        ssize_t write(int fd, const std::vector<std::string>& records, Statistics& statistics);
+
+        PipeSplicer(const PipeSplicer&) = delete;
+        PipeSplicer(PipeSplicer&&) = delete;
+        PipeSplicer& operator=(const PipeSplicer&) = delete;
+        PipeSplicer& operator=(PipeSplicer&&) = delete;
+    private:
+        const size_t pageSize;
+        const size_t pageCount;
+        char* pages;
+        std::vector<uint64_t> pageEnds;   /* 每页最后一个字节在写出流中的位置 + 1, 读走的字节数达到它以后可以重用 */
+        size_t nextPage;
+        uint64_t queuedBytes;             /* 按顺序放进 pending 或直接写出的总字节数 */
+        uint64_t splicedBytes;            /* 已经交给 pipe 的总字节数 */
+        uint64_t consumedBytes;           /* 上一次检查时读端已经读走的字节数 */
+        std::vector<struct iovec> pending;
+
+        bool acquirePage(int fd, Statistics& statistics, size_t& page);
+        void finishPage(size_t page, size_t used);
+        bool updateConsumed(int fd);
+        ssize_t flush(int fd, Statistics& statistics);
+        ssize_t writeLarge(int fd, const std::string& record, Statistics& statistics);
+    };
+}
+
+#endif
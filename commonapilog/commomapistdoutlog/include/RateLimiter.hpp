@@ -0,0 +1,49 @@
+#ifndef COMMON_API_RATE_LIMITER_HPP_
+#define COMMON_API_RATE_LIMITER_HPP_
+
+#include "Configuration.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace commonapistdoutlogger
+{
+    /*
+     * 每个 priority|facility 槽位一个令牌桶, 用 GCRA 实现: 桶的状态只是一个 "理论到达时间" (TAT),
+     * allow 是一次 CLOCK_MONOTONIC_COARSE 读取加一次 CAS, 超限时再加一次计数.
+     * 超限的消息在格式化之前丢弃, 被丢弃的条数由 takeSuppressed 取出后汇总报告.
+     */
+    class RateLimiter
+    {
+    public:
+        static constexpr size_t SLOTS = 255U;
+
+        explicit RateLimiter(const RateLimitConfiguration& configuration);
+
+        // slot 是 priority|facility, 调用者保证在 [0, SLOTS) 内
+        bool allow(int slot) noexcept;
+
+        // 取出并清零 slot 上被丢弃的条数
+        uint64_t takeSuppressed(int slot) noexcept;
+
+        RateLimiter(const RateLimiter&) = delete;
+        RateLimiter(RateLimiter&&) = delete;
+        RateLimiter& operator=(const RateLimiter&) = delete;
+        RateLimiter& operator=(RateLimiter&&) = delete;
+    private:
+        // 每个桶独占一个 cache line, 不同级别的日志不会互相干扰
+        struct alignas(64) Bucket
+        {
+            std::atomic<uint64_t> tat{0U};          /* 纳秒 */
+            std::atomic<uint64_t> suppressed{0U};
+            bool limited = false;                   /* 这个级别不受限速时为 false */
+        };
+
+        const uint64_t emissionInterval;    /* 两条消息之间的平均间隔, 纳秒 */
+        const uint64_t tolerance;           /* 允许提前的量, 决定突发条数 */
+        std::array<Bucket, SLOTS> buckets;
+    };
+}
+
+#endif
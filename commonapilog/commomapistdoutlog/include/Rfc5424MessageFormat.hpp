@@ -0,0 +1,27 @@
+#ifndef COMMON_API_RFC5424_MESSAGE_FORMAT_HPP_
+#define COMMON_API_RFC5424_MESSAGE_FORMAT_HPP_
+
+#include "MessageFormat.hpp"
+
+namespace commonapistdoutlogger
+{
+    /* https://tools.ietf.org/html/rfc5424 */
+    //<34>1 2024-11-06T14:48:27.003Z mymachine.example.com app-name 12345 ID47 [exampleSDID@32473 iut="3" eventSource="Application"] User login successful
+    constexpr const char* RFC5424_PREFIX("<$r>1 %Y-%m-%dT%H:%M:%S.$6$z $H $i $p - - ");
+
+    /*
+     * 默认前缀 RFC5424_PREFIX 的专用版本, 输出和 MessageFormatter(RFC5424_PREFIX) 逐字节相同:
+     *   <pri>1 YYYY-MM-DDTHH:MM:SS.uuuuuu+hh:mm host ident pid - -
+     * 布局在编译期固定, 不解释 token: 先按最大长度一次性扩展 buffer, 再用两位一组的数字表直接写入,
+     * "YYYY-MM-DDTHH:MM:SS." 和时区偏移每个线程按秒缓存. 前缀等于 RFC5424_PREFIX 时自动使用.
+     */
+    class Rfc5424MessageFormatter : public MessageFormatter
+    {
+    public:
+        Rfc5424MessageFormatter();
+
+        void createFragments(std::string& buffer, MessageFragments& fragments, const std::string& ident, pid_t pid, int facility, int priority, const char* message, size_t size) override;
+    };
+}
+
+#endif
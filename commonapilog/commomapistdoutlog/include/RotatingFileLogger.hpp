@@ -0,0 +1,90 @@
+#ifndef COMMON_API_ROTATING_FILE_LOGGER_HPP_
+#define COMMON_API_ROTATING_FILE_LOGGER_HPP_
+
+#include "FileDescriptor.hpp"
+#include "LogWriter.hpp"
+#include "AsyncWriteQueue.hpp"
+#include "Configuration.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+namespace commonapistdoutlogger
+{
+    /*
+     * 按大小或时间切分的普通文件写入. 活动文件始终是 stdout 原来的路径 path, 归档为 path.1, path.2 ... (序号越大越新).
+     * 下一个段 path.next 由后台线程提前打开并预分配, 切换时依次 rename, 然后原子地替换当前段的指针,
+     * 写日志的线程从不等待 open/rename. 旧段等所有正在写它的线程离开后再关闭, 然后把本进程的 stdout/stderr dup2 到新的段.
+     * 旧段对象在 acquiring 计数回到 0 之后释放: 那时已经没有线程拿着切换之前读到的指针.
+     */
+    class RotatingFileLogger : public LogWriter
+    {
+    public:
+        // 成功时接管 fd; fd 不是普通文件或者得不到它的路径时抛出 std::runtime_error, fd 保持不变
+        RotatingFileLogger(FileDescriptor& fd, const std::string& name, const WriterConfiguration& configuration);
+        ~RotatingFileLogger();
+
+        void write(const std::string& message) override;
+        void writeAsync(const std::string& message) override;
+        void write(const struct iovec* iov, int count) override;
+        void writeAsync(const struct iovec* iov, int count) override;
+        void waitAllWriteAsyncsCompleted() override;
+        const Statistics* getStatistics() const override;
+    private:
+        struct Segment
+        {
+            FileDescriptor fd;
+            std::atomic<uint64_t> bytes;
+            std::atomic<unsigned> users;    /* 正在写这个段的线程数 */
+
+            Segment(FileDescriptor&& fd, uint64_t bytes): fd(std::move(fd)), bytes(bytes), users(0U) {}
+        };
+
+        const RotationConfiguration rotation;
+        const std::string path;
+        const std::string nextPath;
+        const mode_t mode;
+        const std::vector<int> standardFds;    /* 和 stdout 原来的文件相同的本进程 stdout/stderr, 每次切分后指向新的段 */
+
+        std::atomic<Segment*> current;
+        std::atomic<unsigned> acquiring;    /* 正在 acquire 中, 可能拿着旧 current 指针的线程数 */
+        std::atomic<bool> rotateRequested;
+        Statistics statistics;
+
+        /* 以下只由切分线程使用. 退役的段先只关闭 fd, 对象等 acquiring 回到 0 后再释放 */
+        std::unique_ptr<Segment> active;
+        std::vector<std::unique_ptr<Segment>> retired;
+        std::unique_ptr<Segment> next;
+        uint64_t sequence;    /* 最新归档段的序号 */
+
+        std::mutex lock;
+        std::condition_variable wakeup;
+        bool stopping;
+        std::thread rotator;
+
+        std::vector<struct iovec> batch;           /* 只由写线程使用 */
+        std::unique_ptr<AsyncWriteQueue> queue;    /* 最后声明, 析构时先停掉写线程 */
+
+        Segment* acquire();
+        void release(Segment* segment);
+        void addBytes(Segment* segment, ssize_t ret, std::chrono::steady_clock::time_point start);
+
+        void writeRecords(const AsyncWriteQueue::Records& records);
+        void writeNow(const struct iovec* iov, int count);
+
+        void run(const std::string& name);
+        void prepareNext();
+        void rotate();
+        void reclaimRetired();
+        void removeOldSegments();
+    };
+}
+
+#endif
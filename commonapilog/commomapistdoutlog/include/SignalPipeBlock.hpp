@@ -11,6 +11,17 @@
 
 namespace commonapistdoutlogger
 {
+    // 在 SIGPIPE 一直被屏蔽的线程 (例如写线程) 上遇到 EPIPE 后, 取走内核投递给本线程的 SIGPIPE
+    inline void discardPendingSigpipe() noexcept
+    {
+        sigset_t sigpipeSet;
+        signalEmptySet(&sigpipeSet);
+        signalAddSet(&sigpipeSet, SIGPIPE);
+
+        const struct timespec zeroTimeout = {0, 0};
+        TEMP_FAILURE_RETRY(sigtimedwait(&sigpipeSet, nullptr, &zeroTimeout));
+    }
+
     class SignalPipeBlocker
     {
     public:
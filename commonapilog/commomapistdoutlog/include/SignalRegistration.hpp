@@ -0,0 +1,28 @@
+#ifndef COMMON_API_SIGNAL_REGISTRATION_HPP_
+#define COMMON_API_SIGNAL_REGISTRATION_HPP_
+
+#include <plugin/PluginServices.hpp>
+
+#include <functional>
+#include <memory>
+
+namespace commonapistdoutlogger
+{
+    // 构造时在进程共用的 SignalMonitor 上 add 处理函数, 析构时 del; 处理函数不会比持有它的插件活得更久
+    class SignalRegistration
+    {
+    public:
+        SignalRegistration(const std::shared_ptr<commonApi::PluginServices>& services, int signal, std::function<void()> handler);
+        ~SignalRegistration();
+
+        SignalRegistration(const SignalRegistration&) = delete;
+        SignalRegistration(SignalRegistration&&) = delete;
+        SignalRegistration& operator=(const SignalRegistration&) = delete;
+        SignalRegistration& operator=(SignalRegistration&&) = delete;
+    private:
+        const std::weak_ptr<commonApi::PluginServices> services;    /* services 先释放时 SignalMonitor 已经不存在, 不需要 del */
+        const int signal;
+    };
+}
+
+#endif
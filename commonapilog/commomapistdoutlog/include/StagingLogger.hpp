@@ -0,0 +1,71 @@
+#ifndef COMMON_API_STAGING_LOGGER_HPP_
+#define COMMON_API_STAGING_LOGGER_HPP_
+
+#include "LogWriter.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace commonapistdoutlogger
+{
+    /*
+     * 包在其它 LogWriter 外面的每线程暂存区.
+     * writeAsync 只把格式化好的记录拷贝进调用线程自己的暂存区 (容量复用, 稳态下不分配内存), 攒满 capacity 后整块交给下层的 writeAsync,
+     * 多个线程不再为每条记录争用队列或 fd. 暂存区的锁只有在 flusher 线程或 waitAllWriteAsyncsCompleted 代为刷新时才会被竞争.
+     * flusher 线程每隔 interval 把不满的暂存区写出去, 并回收已经退出的线程留下的暂存区.
+     * write 先刷新本线程的暂存区, 同一个线程的同步和异步记录保持顺序; 不同线程之间的顺序和以前一样不做保证.
+     */
+    class StagingLogger : public LogWriter
+    {
+    public:
+        StagingLogger(std::unique_ptr<LogWriter> logger, const std::string& name, size_t capacity, std::chrono::milliseconds interval);
+
+        // 写出所有暂存的记录后退出 flusher 线程
+        ~StagingLogger();
+
+        void write(const std::string& message) override;
+        void writeAsync(const std::string& message) override;
+        void write(const struct iovec* iov, int count) override;
+        void writeAsync(const struct iovec* iov, int count) override;
+        void waitAllWriteAsyncsCompleted() override;
+
+        bool isAccepted(int priority) override;
+
+        // 暂存区只是合并写, 统计的是被包装的 writer 实际的写出
+        const Statistics* getStatistics() const override;
+
+        void setNoticeFormatter(NoticeFormatter formatter) override;
+    private:
+        struct Slot;
+        struct ThreadSlots;
+
+        const uint64_t id;
+        const size_t capacity;
+        const std::chrono::milliseconds interval;
+        std::unique_ptr<LogWriter> logger;
+
+        std::mutex slotsLock;
+        std::vector<std::shared_ptr<Slot>> slots;
+
+        std::mutex lock;
+        std::condition_variable flusherWakeup;
+        std::atomic<bool> pending;          /* 有暂存区从空变为非空 */
+        std::atomic<bool> flusherSleeping;
+        bool stopping;
+        std::thread flusher;
+
+        Slot& getSlot();
+        void flush(Slot& slot);
+        void flushAll();
+        void run(const std::string& name);
+    };
+}
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef COMMON_API_STATISTICS_HPP_
+#define COMMON_API_STATISTICS_HPP_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sys/types.h>
+
+namespace commonapistdoutlogger
+{
+    /*
+     * 日志路径上的计数器和写耗时直方图.
+     * 计数按线程分片: 每个线程固定使用一个独占缓存行的分片, 写日志的线程之间不争用同一个缓存行, 只做 relaxed 的 fetch_add;
+     * 读取时把所有分片加起来, 结果不是某一时刻的精确快照, 但每个计数都单调不减.
+     */
+    class Statistics
+    {
+    public:
+        enum Counter : size_t
+        {
+            ROUTED,             /* 交给这个 sink 的消息 */
+            FILTERED,           /* 没有匹配任何 sink 的消息 */
+            RATE_LIMITED,       /* 被限速丢弃的消息 */
+            REPEATED,           /* 被折叠的重复消息 */
+            DROPPED,            /* 异步队列满时丢弃的消息 */
+            WRITES,             /* 写出次数 */
+            BYTES,              /* 写出的字节数 */
+            SHORT_WRITES,       /* 没有一次写完的 writev */
+            EAGAIN_ERRORS,
+            ENOSPC_ERRORS,
+            WRITE_ERRORS,       /* 其它写错误 */
+            RETIRED_FDS,        /* 因为致命错误被关闭的 fd */
+            COUNTERS
+        };
+
+        // 第 i 个桶统计耗时在 [2^(i-1), 2^i) 微秒之间的写出, 第 0 个桶是不到 1 微秒的, 最后一个桶包括更长的
+        static constexpr size_t LATENCY_BUCKETS = 20U;
+
+        struct Snapshot
+        {
+            std::array<uint64_t, COUNTERS> counters{};
+            std::array<uint64_t, LATENCY_BUCKETS> latency{};
+
+            Snapshot& operator+=(const Snapshot& other) noexcept;
+
+            // 至少 percent% 的写出耗时不超过返回值 (所在桶的上界); 没有写出时返回 0
+            std::chrono::microseconds getLatencyPercentile(unsigned percent) const noexcept;
+        };
+
+        Statistics() = default;
+
+        void add(Counter counter, uint64_t value = 1U) noexcept
+        {
+            getShard().counters[counter].fetch_add(value, std::memory_order_relaxed);
+        }
+
+        // 记录一次写出: ret 是写出的字节数或 -1, 此时 error 是 errno
+        void addWrite(ssize_t ret, int error, std::chrono::steady_clock::duration latency) noexcept;
+
+        Snapshot getSnapshot() const noexcept;
+
+        Statistics(const Statistics&) = delete;
+        Statistics(Statistics&&) = delete;
+        Statistics& operator=(const Statistics&) = delete;
+        Statistics& operator=(Statistics&&) = delete;
+    private:
+        static constexpr size_t SHARDS = 16U;
+
+        struct alignas(64) Shard
+        {
+            std::array<std::atomic<uint64_t>, COUNTERS> counters{};
+            std::array<std::atomic<uint64_t>, LATENCY_BUCKETS> latency{};
+        };
+
+        std::array<Shard, SHARDS> shards;
+
+        Shard& getShard() noexcept
+        {
+            return shards[getShardIndex()];
+        }
+
+        static size_t getShardIndex() noexcept;
+    };
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef COMMON_API_URING_LOGGER_HPP_
+#define COMMON_API_URING_LOGGER_HPP_
+
+#include "FileDescriptor.hpp"
+#include "LogWriter.hpp"
+#include "AsyncWriteQueue.hpp"
+#include "Configuration.hpp"
+#include "IoUring.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+namespace commonapistdoutlogger
+{
+    /*
+     * 通过 io_uring 写出异步队列里的记录: fd 和一组固定缓冲区在构造时注册给内核.
+     * 写线程把一批记录拷贝进固定缓冲区, 每个缓冲区一个 WRITE_FIXED, 用 IOSQE_IO_LINK 串起来保证顺序,
+     * 一次 io_uring_enter 提交整批并等待, 完成事件批量收割. 需要持久化时在链尾追加一个 FSYNC.
+     */
+    class UringLogger : public LogWriter
+    {
+    public:
+        // 成功时接管 fd; 内核不支持 io_uring 或注册失败时抛出 std::runtime_error, fd 保持不变. configuration.asyncQueueSize 必须大于 0
+        UringLogger(FileDescriptor& fd, const std::string& name, const WriterConfiguration& configuration);
+        ~UringLogger() = default;
+
+        void write(const std::string& message) override;
+        void writeAsync(const std::string& message) override;
+        void write(const struct iovec* iov, int count) override;
+        void writeAsync(const struct iovec* iov, int count) override;
+        void waitAllWriteAsyncsCompleted() override;
+        const Statistics* getStatistics() const override;
+    private:
+        static constexpr unsigned BUFFER_COUNT = 16U;
+        static constexpr size_t BUFFER_SIZE = 64U * 1024U;
+
+        FileDescriptor fd;
+        const bool regularFile;          /* 只有普通文件需要 fsync */
+
+        /* 以下只由写线程使用 */
+        IoUring ring;
+        std::unique_ptr<char[]> pool;    /* 注册给内核的固定缓冲区 */
+        unsigned pending;                /* 已经准备好的写, 也是下一个可用缓冲区的下标 */
+        size_t lengths[BUFFER_COUNT];
+        int results[BUFFER_COUNT];
+        struct io_uring_sqe* lastSqe;
+
+        std::atomic<bool> fsyncRequested;
+        Statistics statistics;
+        std::unique_ptr<AsyncWriteQueue> queue;    /* 最后声明, 析构时先停掉写线程 */
+
+        char* buffer(unsigned index) const { return pool.get() + index * BUFFER_SIZE; }
+
+        void writeRecords(const AsyncWriteQueue::Records& records);
+        void prepareWrite(size_t size);
+        void completeWrites(bool fsync);
+        void repairWrites(std::chrono::steady_clock::duration latency);
+        bool writeBuffer(const char* data, size_t size);
+    };
+}
+
+#endif
@@ -6,6 +6,8 @@
 #include <type_traits>
 #include <string>
 #include <system_error>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 namespace commonapistdoutlogger
 {
@@ -25,6 +27,19 @@ namespace commonapistdoutlogger
     std::string getLogHostname();
 
     std::string getLogFqd();
+
+    class Statistics;
+
+    // 一条记录或一批 iovec 的总长度
+    size_t getTotalLength(const struct iovec* iov, int count) noexcept;
+
+    // writev 直到全部写完: 处理 EINTR 和短写, 出错时返回 -1 并保留 errno. iov 会被修改; statistics 不为空时记录短写的次数
+    ssize_t writeFully(int fd, struct iovec* iov, int count, Statistics* statistics = nullptr);
+
+#if defined(__x86_64__)
+    // SIMD 扫描是否使用 AVX2: CPU 支持并且 COMMON_API_LOGGER_SIMD 不是 "sse2" (测试用它覆盖 SSE2 路径)
+    bool useAvx2() noexcept;
+#endif
 }
 
 #endif
@@ -0,0 +1,288 @@
+#include "AsyncWriteQueue.hpp"
+#include "SignalSetOperation.hpp"
+
+#include <climits>
+#include <limits>
+#include <pthread.h>
+
+using namespace commonapistdoutlogger;
+
+namespace
+{
+    // 写线程一次最多取出的记录数
+    constexpr size_t MAX_BATCH_RECORDS(IOV_MAX);
+
+    // 唤醒丢失时的兜底等待时间, 也是调用 idle 之前的空闲时间
+    constexpr std::chrono::milliseconds IDLE_WAIT(100);
+
+    uint64_t roundUpToPowerOfTwo(size_t value)
+    {
+        uint64_t ret(2U);
+        while(ret < value)
+        {
+            ret <<= 1U;
+        }
+        return ret;
+    }
+}
+
+AsyncWriteQueue::AsyncWriteQueue(size_t capacity, const std::string& name, size_t maxBatchBytes, std::chrono::microseconds linger, Sink sink, Notice notice,
+                                 Idle idle):
+                name(name),
+                mask(roundUpToPowerOfTwo(capacity) - 1U),
+                maxBatchBytes((maxBatchBytes > 0U) ? maxBatchBytes : std::numeric_limits<size_t>::max()),
+                linger(linger),
+                cells(new Cell[mask + 1U]),
+                enqueuePosition(0U),
+                dequeuePosition(0U),
+                completedPosition(0U),
+                droppedRecords(0U),
+                consumerSleeping(false),
+                waitingProducers(0U),
+                stopping(false),
+                sink(std::move(sink)),
+                notice(std::move(notice)),
+                idle(std::move(idle))
+{
+    for(uint64_t i = 0; i <= mask; i++)
+    {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // 写线程继承创建时的信号掩码: 屏蔽所有信号后再创建, 进程信号不会投递给它,
+    // SIGPIPE 在它的整个生命周期内都被屏蔽, sink 不需要每次写都设置信号掩码
+    sigset_t allSignals;
+    sigset_t oldSignals;
+    signalFillSet(&allSignals);
+    if(const int ret = pthread_sigmask(SIG_SETMASK, &allSignals, &oldSignals); ret != 0)
+    {
+        COMMON_API_STDOUT_LOGGER_ABORT("pthread_sigmask: %s", strerror(ret));
+    }
+
+    writer = std::thread(&AsyncWriteQueue::run, this);
+
+    if(const int ret = pthread_sigmask(SIG_SETMASK, &oldSignals, nullptr); ret != 0)
+    {
+        COMMON_API_STDOUT_LOGGER_ABORT("pthread_sigmask: %s", strerror(ret));
+    }
+}
+
+AsyncWriteQueue::~AsyncWriteQueue()
+{
+    {
+        const std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    consumerWakeup.notify_one();
+    writer.join();
+}
+
+bool AsyncWriteQueue::tryPush(const struct iovec* iov, int count, uint64_t& ticket)
+{
+    uint64_t position = enqueuePosition.load(std::memory_order_relaxed);
+    Cell* cell;
+
+    while (true)
+    {
+        cell = &cells[position & mask];
+        const uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+        const auto diff = static_cast<int64_t>(sequence - position);
+        if(diff == 0)
+        {
+            if(enqueuePosition.compare_exchange_weak(position, position + 1U, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }else if(diff < 0)
+        {
+            return false;
+        }else
+        {
+            position = enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+
+    // clear + append 复用槽位原有的容量, 稳态下不再分配内存
+    cell->data.clear();
+    for(int i = 0; i < count; i++)
+    {
+        cell->data.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    }
+
+    cell->sequence.store(position + 1U, std::memory_order_release);
+    ticket = position + 1U;
+
+    wakeConsumer();
+    return true;
+}
+
+// 只取长度不超过 maxSize 的记录, 放不下的留给下一批
+bool AsyncWriteQueue::pop(std::string& record, size_t maxSize)
+{
+    Cell& cell = cells[dequeuePosition & mask];
+    if((cell.sequence.load(std::memory_order_acquire) != dequeuePosition + 1U) || (cell.data.size() > maxSize))
+    {
+        return false;
+    }
+
+    // 交换而不是复制: 槽位拿到上一批记录的 string, 两边的容量都得到复用
+    record.swap(cell.data);
+    cell.sequence.store(dequeuePosition + mask + 1U, std::memory_order_release);
+    dequeuePosition++;
+    return true;
+}
+
+void AsyncWriteQueue::wakeConsumer()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(consumerSleeping.load(std::memory_order_relaxed))
+    {
+        const std::lock_guard<std::mutex> guard(lock);
+        consumerWakeup.notify_one();
+    }
+}
+
+bool AsyncWriteQueue::push(const struct iovec* iov, int count)
+{
+    uint64_t ticket;
+    if(tryPush(iov, count, ticket))
+    {
+        return true;
+    }
+
+    droppedRecords++;
+    return false;
+}
+
+void AsyncWriteQueue::write(const struct iovec* iov, int count)
+{
+    uint64_t ticket;
+    while(!tryPush(iov, count, ticket))
+    {
+        waitingProducers++;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            consumerWakeup.notify_one();
+            producerWakeup.wait_for(guard, std::chrono::milliseconds(1));
+        }
+        waitingProducers--;
+    }
+
+    waitCompleted(ticket);
+}
+
+void AsyncWriteQueue::waitAllCompleted()
+{
+    waitCompleted(enqueuePosition.load());
+}
+
+void AsyncWriteQueue::waitCompleted(uint64_t ticket)
+{
+    if(completedPosition.load() >= ticket)
+    {
+        return;
+    }
+
+    waitingProducers++;
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        producerWakeup.wait(guard, [this, ticket]() { return completedPosition.load() >= ticket; });
+    }
+    waitingProducers--;
+}
+
+void AsyncWriteQueue::addDroppedRecordsNotice(Records& records)
+{
+    const size_t dropped = droppedRecords.exchange(0U);
+    if(dropped == 0U)
+    {
+        return;
+    }
+
+    records.push_back(notice(name + ": logger overloaded, dropped " + std::to_string(dropped) + " messages"));
+}
+
+void AsyncWriteQueue::run()
+{
+    const std::string threadName = (name + "-writer").substr(0, 15);
+    pthread_setname_np(pthread_self(), threadName.c_str());
+
+    Records records;
+    std::vector<std::string> spare(MAX_BATCH_RECORDS);
+    size_t bytes(0U);
+    bool busy(false);
+
+    // 返回 true 表示因为达到 IOV_MAX 或 maxBatchBytes 而停止, 即队列里还有记录
+    const auto gather = [this, &records, &spare, &bytes]()
+    {
+        while(records.size() < MAX_BATCH_RECORDS)
+        {
+            std::string& record = spare[records.size()];
+            const size_t maxSize = records.empty() ? std::numeric_limits<size_t>::max() :
+                                   ((bytes < maxBatchBytes) ? (maxBatchBytes - bytes) : 0U);
+            if(!pop(record, maxSize))
+            {
+                return (cells[dequeuePosition & mask].sequence.load(std::memory_order_acquire) == dequeuePosition + 1U);
+            }
+            bytes += record.size();
+            records.push_back(std::move(record));
+        }
+        return true;
+    };
+
+    while (true)
+    {
+        records.clear();
+        addDroppedRecordsNotice(records);
+        bytes = 0U;
+
+        bool full = gather();
+
+        // 负载高时 (上一批被截断) 等待 linger 让这一批攒得更满, 低负载时不增加延迟
+        if(!full && busy && !records.empty() && (linger.count() > 0))
+        {
+            std::this_thread::sleep_for(linger);
+            full = gather();
+        }
+        busy = full;
+
+        if(records.empty())
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            consumerSleeping.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(cells[dequeuePosition & mask].sequence.load(std::memory_order_acquire) == dequeuePosition + 1U)
+            {
+                consumerSleeping.store(false);
+                continue;
+            }
+            if(stopping)
+            {
+                break;
+            }
+            const bool timedOut = (consumerWakeup.wait_for(guard, IDLE_WAIT) == std::cv_status::timeout);
+            consumerSleeping.store(false);
+            if(timedOut && idle)
+            {
+                guard.unlock();
+                idle();
+            }
+            continue;
+        }
+
+        sink(records);
+
+        // 把 string 放回 spare, 下一批继续复用它们的容量
+        for(size_t i = 0; i < records.size() && i < spare.size(); i++)
+        {
+            spare[i] = std::move(records[i]);
+        }
+
+        completedPosition.store(dequeuePosition);
+        if(waitingProducers.load() > 0U)
+        {
+            const std::lock_guard<std::mutex> guard(lock);
+            producerWakeup.notify_all();
+        }
+    }
+}
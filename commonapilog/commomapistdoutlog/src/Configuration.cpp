@@ -1,7 +1,10 @@
 #include "Configuration.hpp"
 #include "Utils.hpp"
 #include "AttributeParser.hpp"
+#include "MessageSanitizer.hpp"
 
+#include <algorithm>
+#include <fstream>
 #include <unordered_map>
 #include <optional>
 
@@ -58,6 +61,88 @@ namespace commonapistdoutlogger
         {"uucp",   LOG_UUCP}    /* UUCP subsystem */
     };
 
+    enum SigpipeHandling
+    {
+        SIGPIPE_BLOCK = 0,  /* 每次同步写 pipe 前后临时屏蔽 SIGPIPE */
+        SIGPIPE_IGNORE      /* 整个进程忽略 SIGPIPE */
+    };
+
+    const std::unordered_map<std::string, int> sigpipeHandlingNames =
+    {
+        {"block", SIGPIPE_BLOCK},
+        {"ignore", SIGPIPE_IGNORE}
+    };
+
+    enum FileWriter
+    {
+        FILE_WRITER_WRITE = 0,  /* FileLogger: write/writev */
+        FILE_WRITER_MMAP        /* MmapFileLogger: 预分配 + 内存映射 */
+    };
+
+    const std::unordered_map<std::string, int> fileWriterNames =
+    {
+        {"write", FILE_WRITER_WRITE},
+        {"mmap", FILE_WRITER_MMAP}
+    };
+
+    enum IoBackend
+    {
+        IO_BACKEND_URING = 0,   /* 内核支持时用 io_uring, 否则 writev */
+        IO_BACKEND_WRITEV       /* 总是 writev */
+    };
+
+    const std::unordered_map<std::string, int> ioBackendNames =
+    {
+        {"uring", IO_BACKEND_URING},
+        {"writev", IO_BACKEND_WRITEV}
+    };
+
+    enum Compression
+    {
+        COMPRESSION_NONE = 0,
+        COMPRESSION_GZIP        /* 独立的 gzip member, zcat 可以直接读取 */
+    };
+
+    const std::unordered_map<std::string, int> compressionNames =
+    {
+        {"none", COMPRESSION_NONE},
+        {"gzip", COMPRESSION_GZIP}
+    };
+
+    enum FifoWriter
+    {
+        FIFO_WRITER_WRITEV = 0,   /* FifoLogger: write/writev */
+        FIFO_WRITER_VMSPLICE      /* PipeSplicer: 整页 vmsplice, 需要异步队列 */
+    };
+
+    const std::unordered_map<std::string, int> fifoWriterNames =
+    {
+        {"writev", FIFO_WRITER_WRITEV},
+        {"vmsplice", FIFO_WRITER_VMSPLICE}
+    };
+
+    const std::unordered_map<std::string, int> overflowPolicyNames =
+    {
+        {"block", static_cast<int>(OverflowPolicy::BLOCK)},
+        {"dropNewest", static_cast<int>(OverflowPolicy::DROP_NEWEST)},
+        {"dropOldest", static_cast<int>(OverflowPolicy::DROP_OLDEST)},
+        {"dropBelow", static_cast<int>(OverflowPolicy::DROP_BELOW)}
+    };
+
+    const std::unordered_map<std::string, int> messageFormatNames =
+    {
+        {"text", static_cast<int>(MessageFormat::TEXT)},
+        {"binary", static_cast<int>(MessageFormat::BINARY)},
+        {"json", static_cast<int>(MessageFormat::JSON)}
+    };
+
+    const std::unordered_map<std::string, int> sanitizeNames =
+    {
+        {"escape", MessageSanitizer::ESCAPE_CONTROL},
+        {"utf8", MessageSanitizer::REPLACE_INVALID_UTF8},
+        {"split", MessageSanitizer::SPLIT_LINES}
+    };
+
     std::optional<int> calculateLevel(const std::string& str) noexcept
     {
         int level(0);
@@ -82,14 +167,80 @@ namespace commonapistdoutlogger
         return std::nullopt;
     }
 
+    std::optional<int> calculateNonNegative(const std::string& str) noexcept
+    {
+        int value(0);
+
+        if(stringToInt(str, value) && (value >= 0))
+        {
+            return value;
+        }
+
+        return std::nullopt;
+    }
+
+    // 字节数, 可以带 k/m/g 后缀 (1024 的倍数), 例如 64m
+    std::optional<int64_t> calculateSize(const std::string& str) noexcept
+    {
+        if(str.empty())
+        {
+            return std::nullopt;
+        }
+
+        int shift(0);
+        switch(str.back())
+        {
+            case 'k': case 'K': shift = 10; break;
+            case 'm': case 'M': shift = 20; break;
+            case 'g': case 'G': shift = 30; break;
+            default: break;
+        }
+
+        int64_t value(0);
+        if(!stringToInt(std::string_view(str).substr(0, str.size() - ((shift > 0) ? 1U : 0U)), value) || (value < 0) ||
+           (value > (INT64_MAX >> shift)))
+        {
+            return std::nullopt;
+        }
+
+        return value << shift;
+    }
+
     Configuration getConfiguration(std::ostream& errors)
     {
         auto configStr = ::getenv("COMMON_API_STDOUT_LOGGER_ATTRS");
-        if(nullptr == configStr)
+
+        Configuration configuration = (nullptr == configStr) ? Configuration() : parseConfiguration(configStr, errors);
+        configuration.sinks = getSinkConfigurations(errors);
+
+        return configuration;
+    }
+
+    Configuration reloadConfiguration(std::ostream& errors)
+    {
+        auto path = ::getenv("COMMON_API_STDOUT_LOGGER_ATTRS_FILE");
+        if(nullptr != path)
         {
-            return {};
+            std::ifstream file(path);
+            if(file)
+            {
+                std::ostringstream content;
+                content << file.rdbuf();
+
+                // 文件可以写成多行, 行尾等同于 ','
+                std::string configStr = content.str();
+                std::replace(configStr.begin(), configStr.end(), '\n', ',');
+                return parseConfiguration(configStr, errors);
+            }
         }
 
+        auto configStr = ::getenv("COMMON_API_STDOUT_LOGGER_ATTRS");
+        return (nullptr == configStr) ? Configuration() : parseConfiguration(configStr, errors);
+    }
+
+    Configuration parseConfiguration(const std::string& configStr, std::ostream& errors)
+    {
+
         ValueSet<int> syslogLevels{"level", syslogLevelNames};
         syslogLevels.setExtraEvaluator(calculateLevel);
 
@@ -101,12 +252,116 @@ namespace commonapistdoutlogger
 
         OneOf<int> minErrLevel{"minErrLevel", syslogLevelNames};
 
+        OneOf<int> hostnameRefresh{"hostnameRefresh", {}};
+        hostnameRefresh.setExtraEvaluator(calculateNonNegative);
+
+        OneOf<int> asyncQueueSize{"asyncQueueSize", {}};
+        asyncQueueSize.setExtraEvaluator(calculateNonNegative);
+
+        OneOf<int> batchBytes{"batchBytes", {}};
+        batchBytes.setExtraEvaluator(calculateNonNegative);
+
+        OneOf<int> batchLinger{"batchLinger", {}};
+        batchLinger.setExtraEvaluator(calculateNonNegative);
+
+        OneOf<int> sigpipe{"sigpipe", sigpipeHandlingNames};
+
+        OneOf<int> fileWriter{"fileWriter", fileWriterNames};
+
+        OneOf<int> ioBackend{"ioBackend", ioBackendNames};
+
+        OneOf<int> compress{"compress", compressionNames};
+
+        OneOf<int> messageFormat{"messageFormat", messageFormatNames};
+
+        ValueSet<int> sanitize{"sanitize", sanitizeNames};
+
+        OneOf<int> rateLimit{"rateLimit", {}};
+        rateLimit.setExtraEvaluator(calculateNonNegative);
+
+        OneOf<int> rateBurst{"rateBurst", {}};
+        rateBurst.setExtraEvaluator(calculateNonNegative);
+
+        ValueSet<int> rateLimitLevels{"rateLimitLevel", syslogLevelNames};
+        rateLimitLevels.setExtraEvaluator(calculateLevel);
+
+        OneOf<int> rateLimitReport{"rateLimitReport", {}};
+        rateLimitReport.setExtraEvaluator(calculateNonNegative);
+
+        OneOf<int> repeatInterval{"repeatInterval", {}};
+        repeatInterval.setExtraEvaluator(calculateNonNegative);
+
+        OneOf<int> statsInterval{"statsInterval", {}};
+        statsInterval.setExtraEvaluator(calculateNonNegative);
+
+        OneOf<int64_t> stagingSize{"stagingSize", {}};
+        stagingSize.setExtraEvaluator(calculateSize);
+
+        OneOf<int> stagingInterval{"stagingInterval", {}};
+        stagingInterval.setExtraEvaluator(calculateNonNegative);
+
+        OneOf<int64_t> rotateSize{"rotateSize", {}};
+        rotateSize.setExtraEvaluator(calculateSize);
+
+        OneOf<int> rotateInterval{"rotateInterval", {}};
+        rotateInterval.setExtraEvaluator(calculateNonNegative);
+
+        OneOf<int> rotateKeep{"rotateKeep", {}};
+        rotateKeep.setExtraEvaluator(calculateNonNegative);
+
+        OneOf<int64_t> rotateKeepSize{"rotateKeepSize", {}};
+        rotateKeepSize.setExtraEvaluator(calculateSize);
+
+        OneOf<int64_t> overflowSize{"overflowSize", {}};
+        overflowSize.setExtraEvaluator(calculateSize);
+
+        OneOf<int> overflowPolicy{"overflowPolicy", overflowPolicyNames};
+
+        OneOf<int> overflowDeadline{"overflowDeadline", {}};
+        overflowDeadline.setExtraEvaluator(calculateNonNegative);
+
+        OneOf<int> overflowLevel{"overflowLevel", syslogLevelNames};
+        overflowLevel.setExtraEvaluator(calculateLevel);
+
+        OneOf<int> fifoWriter{"fifoWriter", fifoWriterNames};
+
+        OneOf<int64_t> pipeSize{"pipeSize", {}};
+        pipeSize.setExtraEvaluator(calculateSize);
+
         Parser parser(errors);
 
         parser.addAttribute(&syslogLevels);
         parser.addAttribute(&syslogFacilities);
         parser.addAttribute(&excludedSyslogFacilities);
         parser.addAttribute(&minErrLevel);
+        parser.addAttribute(&hostnameRefresh);
+        parser.addAttribute(&asyncQueueSize);
+        parser.addAttribute(&batchBytes);
+        parser.addAttribute(&batchLinger);
+        parser.addAttribute(&sigpipe);
+        parser.addAttribute(&fileWriter);
+        parser.addAttribute(&ioBackend);
+        parser.addAttribute(&compress);
+        parser.addAttribute(&messageFormat);
+        parser.addAttribute(&sanitize);
+        parser.addAttribute(&rateLimit);
+        parser.addAttribute(&rateBurst);
+        parser.addAttribute(&rateLimitLevels);
+        parser.addAttribute(&rateLimitReport);
+        parser.addAttribute(&repeatInterval);
+        parser.addAttribute(&statsInterval);
+        parser.addAttribute(&stagingSize);
+        parser.addAttribute(&stagingInterval);
+        parser.addAttribute(&rotateSize);
+        parser.addAttribute(&rotateInterval);
+        parser.addAttribute(&rotateKeep);
+        parser.addAttribute(&rotateKeepSize);
+        parser.addAttribute(&overflowSize);
+        parser.addAttribute(&overflowPolicy);
+        parser.addAttribute(&overflowDeadline);
+        parser.addAttribute(&overflowLevel);
+        parser.addAttribute(&fifoWriter);
+        parser.addAttribute(&pipeSize);
 
         parser.parse(configStr);
 
@@ -129,6 +384,204 @@ namespace commonapistdoutlogger
             std::set_difference(includeList.begin(), includeList.end(), excludeList.begin(), excludeList.end(), std::back_inserter(facilityList));
         }
 
-        return {syslogLevels.getValues(), facilityList, errLevel};
+        Configuration configuration{syslogLevels.getValues(), facilityList, errLevel};
+
+        if(const auto& interval = hostnameRefresh.get())
+        {
+            configuration.hostnameRefreshInterval = *interval;
+        }
+
+        if(const auto& size = asyncQueueSize.get())
+        {
+            configuration.writer.asyncQueueSize = static_cast<size_t>(*size);
+        }
+
+        if(const auto& bytes = batchBytes.get())
+        {
+            configuration.writer.batchBytes = static_cast<size_t>(*bytes);
+        }
+
+        if(const auto& linger = batchLinger.get())
+        {
+            configuration.writer.batchLinger = std::chrono::microseconds(*linger);
+        }
+
+        if(const auto& handling = sigpipe.get())
+        {
+            configuration.writer.sigpipeIgnored = (*handling == SIGPIPE_IGNORE);
+        }
+
+        if(const auto& writer = fileWriter.get())
+        {
+            configuration.writer.mmapFile = (*writer == FILE_WRITER_MMAP);
+        }
+
+        if(const auto& backend = ioBackend.get())
+        {
+            configuration.writer.uring = (*backend == IO_BACKEND_URING);
+        }
+
+        if(const auto& compression = compress.get())
+        {
+            configuration.writer.compress = (*compression == COMPRESSION_GZIP);
+        }
+
+        if(const auto& format = messageFormat.get())
+        {
+            configuration.messageFormat = static_cast<MessageFormat>(*format);
+        }
+
+        // 没有给出时 getValues 返回全部取值, 默认不处理
+        if(sanitize.given())
+        {
+            for(const auto mode : sanitize.getValues())
+            {
+                configuration.sanitize |= static_cast<unsigned>(mode);
+            }
+        }
+
+        if(const auto& rate = rateLimit.get())
+        {
+            configuration.rateLimit.rate = static_cast<uint32_t>(*rate);
+        }
+
+        if(const auto& burst = rateBurst.get())
+        {
+            configuration.rateLimit.burst = static_cast<uint32_t>(*burst);
+        }
+
+        configuration.rateLimit.levels = rateLimitLevels.getValues();
+
+        if(const auto& interval = rateLimitReport.get())
+        {
+            configuration.rateLimit.reportInterval = *interval;
+        }
+
+        if(const auto& interval = repeatInterval.get())
+        {
+            configuration.repeatInterval = *interval;
+        }
+
+        if(const auto& interval = statsInterval.get())
+        {
+            configuration.statsInterval = *interval;
+        }
+
+        if(const auto& size = stagingSize.get())
+        {
+            configuration.writer.stagingBytes = static_cast<size_t>(*size);
+        }
+
+        if(const auto& interval = stagingInterval.get())
+        {
+            configuration.writer.stagingInterval = std::chrono::milliseconds(*interval);
+        }
+
+        if(const auto& size = rotateSize.get())
+        {
+            configuration.writer.rotation.maxBytes = static_cast<uint64_t>(*size);
+        }
+
+        if(const auto& interval = rotateInterval.get())
+        {
+            configuration.writer.rotation.interval = std::chrono::seconds(*interval);
+        }
+
+        if(const auto& keep = rotateKeep.get())
+        {
+            configuration.writer.rotation.keepSegments = static_cast<size_t>(*keep);
+        }
+
+        if(const auto& size = rotateKeepSize.get())
+        {
+            configuration.writer.rotation.keepBytes = static_cast<uint64_t>(*size);
+        }
+
+        if(const auto& size = overflowSize.get())
+        {
+            configuration.writer.overflowBytes = static_cast<size_t>(*size);
+        }
+
+        if(const auto& policy = overflowPolicy.get())
+        {
+            configuration.writer.overflowPolicy = static_cast<OverflowPolicy>(*policy);
+        }
+
+        if(const auto& deadline = overflowDeadline.get())
+        {
+            configuration.writer.overflowDeadline = std::chrono::milliseconds(*deadline);
+        }
+
+        if(const auto& level = overflowLevel.get())
+        {
+            configuration.writer.overflowLevel = *level;
+        }
+
+        if(const auto& writer = fifoWriter.get())
+        {
+            configuration.writer.vmsplice = (*writer == FIFO_WRITER_VMSPLICE);
+        }
+
+        if(const auto& size = pipeSize.get())
+        {
+            configuration.writer.pipeSize = static_cast<size_t>(*size);
+        }
+
+        return configuration;
+    }
+
+    SinkConfigurations getSinkConfigurations(std::ostream& errors)
+    {
+        SinkConfigurations sinks;
+
+        auto sinksStr = ::getenv("COMMON_API_STDOUT_LOGGER_SINKS");
+        if(nullptr == sinksStr)
+        {
+            return sinks;
+        }
+
+        for(const auto& definition : extractTokens(sinksStr, ";"))
+        {
+            Text path{"path"};
+
+            ValueSet<int> syslogLevels{"level", syslogLevelNames};
+            syslogLevels.setExtraEvaluator(calculateLevel);
+
+            ValueSet<int> syslogFacilities{"facility", syslogFacilityName};
+            syslogFacilities.setExtraEvaluator(calculateFacility);
+
+            ValueSet<int> excludedSyslogFacilities{"excludeFacility", syslogFacilityName};
+            excludedSyslogFacilities.setExtraEvaluator(calculateFacility);
+
+            Parser parser(errors);
+
+            parser.addAttribute(&path);
+            parser.addAttribute(&syslogLevels);
+            parser.addAttribute(&syslogFacilities);
+            parser.addAttribute(&excludedSyslogFacilities);
+
+            parser.parse(definition);
+
+            if(!path.get())
+            {
+                errors << "ignoring sink without path: " << definition << std::endl;
+                continue;
+            }
+
+            std::vector<int> facilityList;
+            if(!excludedSyslogFacilities.given())
+            {
+                facilityList = syslogFacilities.getValues();
+            }else
+            {
+                auto includeList = syslogFacilities.getValues();
+                auto excludeList = excludedSyslogFacilities.getValues();
+                std::set_difference(includeList.begin(), includeList.end(), excludeList.begin(), excludeList.end(), std::back_inserter(facilityList));
+            }
+
+            sinks.push_back({*path.get(), syslogLevels.getValues(), facilityList});
+        }
+
+        return sinks;
     }
 }
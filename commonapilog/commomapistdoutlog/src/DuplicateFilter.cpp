@@ -0,0 +1,131 @@
+#include "DuplicateFilter.hpp"
+
+#include <algorithm>
+#include <string_view>
+
+using namespace commonapistdoutlogger;
+
+namespace
+{
+    std::atomic<uint64_t> nextDuplicateFilterId(1U);
+}
+
+struct DuplicateFilter::State
+{
+    std::mutex lock;                    /* 只有 takeStale 会和所属线程竞争 */
+    uint64_t hash = 0U;
+    int priority = -1;
+    size_t size = 0U;
+    uint64_t repeats = 0U;
+    std::chrono::steady_clock::time_point runStart;   /* 这段重复开始或上次报告的时间, 只在出现重复时读取时钟 */
+    std::atomic<bool> owned{true};      /* 所属线程退出后为 false, 由 takeStale 报告后回收 */
+    std::atomic<bool> detached{false};  /* DuplicateFilter 析构后为 true, 线程下次查找时丢掉 */
+};
+
+// 每个线程在每个 DuplicateFilter 中的状态, 线程退出时交给 takeStale 回收
+struct DuplicateFilter::ThreadStates
+{
+    std::vector<std::pair<uint64_t, std::shared_ptr<State>>> states;
+
+    ~ThreadStates()
+    {
+        for(const auto& entry : states)
+        {
+            entry.second->owned.store(false, std::memory_order_release);
+        }
+    }
+};
+
+DuplicateFilter::DuplicateFilter(std::chrono::milliseconds interval):
+                 id(nextDuplicateFilterId++),
+                 interval(interval)
+{
+}
+
+DuplicateFilter::~DuplicateFilter()
+{
+    for(const auto& state : states)
+    {
+        state->detached.store(true);
+    }
+}
+
+DuplicateFilter::State& DuplicateFilter::getState()
+{
+    static thread_local ThreadStates threadStates;
+
+    for(const auto& entry : threadStates.states)
+    {
+        if(entry.first == id)
+        {
+            return *entry.second;
+        }
+    }
+
+    auto& entries = threadStates.states;
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [](const auto& entry) { return entry.second->detached.load(); }), entries.end());
+
+    auto state = std::make_shared<State>();
+    {
+        const std::lock_guard<std::mutex> guard(statesLock);
+        states.push_back(state);
+    }
+    entries.emplace_back(id, state);
+
+    return *state;
+}
+
+bool DuplicateFilter::isDuplicate(int priority, const char* message, size_t size, Repeats& repeats)
+{
+    const uint64_t hash = std::hash<std::string_view>()(std::string_view(message, size));
+    State& state = getState();
+
+    const std::lock_guard<std::mutex> guard(state.lock);
+    repeats = {state.priority, 0U};
+
+    if((hash == state.hash) && (priority == state.priority) && (size == state.size))
+    {
+        const auto now = std::chrono::steady_clock::now();
+        if(state.repeats++ == 0U)
+        {
+            state.runStart = now;
+        }else if(now - state.runStart >= interval)
+        {
+            // 持续重复: 每隔 interval 报告一次, 之后的重复重新计数
+            repeats.count = state.repeats;
+            state.repeats = 0U;
+        }
+        return true;
+    }
+
+    repeats.count = state.repeats;
+    state.hash = hash;
+    state.priority = priority;
+    state.size = size;
+    state.repeats = 0U;
+    return false;
+}
+
+std::vector<DuplicateFilter::Repeats> DuplicateFilter::takeStale(bool all)
+{
+    std::vector<Repeats> ret;
+    const auto now = std::chrono::steady_clock::now();
+
+    const std::lock_guard<std::mutex> guard(statesLock);
+    for(auto it = states.begin(); it != states.end();)
+    {
+        State& state = **it;
+        const bool abandoned = !state.owned.load(std::memory_order_acquire);
+        {
+            const std::lock_guard<std::mutex> stateGuard(state.lock);
+            if((state.repeats > 0U) && (all || abandoned || (now - state.runStart >= interval)))
+            {
+                ret.push_back({state.priority, state.repeats});
+                state.repeats = 0U;
+            }
+        }
+        it = abandoned ? states.erase(it) : (it + 1);
+    }
+
+    return ret;
+}
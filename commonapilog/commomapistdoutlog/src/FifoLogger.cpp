@@ -1,52 +1,562 @@
 #include "FifoLogger.hpp"
 #include "SignalPipeBlock.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 
 using namespace commonapistdoutlogger;
 
 namespace
 {
+    // drainer 等待可写时每隔这么久检查一次是否要退出
+    constexpr std::chrono::milliseconds DRAIN_POLL_INTERVAL(100);
+
     bool isFatalError(ssize_t ret)
     {
         return ((ret == -1) && (errno != EAGAIN) && (errno != EMSGSIZE) && (errno != ENOBUFS) && (errno != ENOMEM));
     }
+
+    bool isSocketFd(int fd)
+    {
+        struct stat sb;
+        return (::fstat(fd, &sb) == 0) && S_ISSOCK(sb.st_mode);
+    }
+
+    bool isPipeFd(int fd)
+    {
+        struct stat sb;
+        return (::fstat(fd, &sb) == 0) && S_ISFIFO(sb.st_mode);
+    }
+
+    // 同一个 pipe 的一个新的文件描述, O_NONBLOCK 只影响自己; fifo 没有读端时失败
+    int openNonBlocking(int fd)
+    {
+        const std::string path = "/proc/self/fd/" + std::to_string(fd);
+        return ::open(path.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    }
+}
+
+FifoLogger::FifoLogger(FileDescriptor&& fd, const std::string& name, const WriterConfiguration& configuration):
+                        fd(std::move(fd)),
+                        name(name),
+                        isSocket(isSocketFd(this->fd)),
+                        sigpipeIgnored(configuration.sigpipeIgnored),
+                        overflowLimit(configuration.overflowBytes),
+                        overflowPolicy(configuration.overflowPolicy),
+                        overflowDeadline(configuration.overflowDeadline),
+                        overflowLevel(configuration.overflowLevel),
+                        overflowOffset(0U),
+                        overflowBytes(0U),
+                        overflowDropped(0U),
+                        overflowStalled(false),
+                        stopping(false)
+{
+    if((overflowLimit > 0U) && !isSocket && (this->fd >= 0))
+    {
+        const int nonBlockingFd = openNonBlocking(this->fd);
+        if(nonBlockingFd < 0)
+        {
+            std::cerr << name << ": reopen for non-blocking writes: " << strerror(errno) << ", overflow buffer is disabled" << std::endl;
+            overflowLimit = 0U;
+        }else
+        {
+            this->fd = FileDescriptor(nonBlockingFd, true);
+        }
+    }
+
+    if(overflowLimit > 0U)
+    {
+        // 和异步队列的写线程一样在屏蔽所有信号时创建, SIGPIPE 一直被屏蔽
+        sigset_t allSignals;
+        sigset_t oldSignals;
+        signalFillSet(&allSignals);
+        if(const int ret = pthread_sigmask(SIG_SETMASK, &allSignals, &oldSignals); ret != 0)
+        {
+            COMMON_API_STDOUT_LOGGER_ABORT("pthread_sigmask: %s", strerror(ret));
+        }
+
+        drainer = std::thread(&FifoLogger::runDrainer, this);
+
+        if(const int ret = pthread_sigmask(SIG_SETMASK, &oldSignals, nullptr); ret != 0)
+        {
+            COMMON_API_STDOUT_LOGGER_ABORT("pthread_sigmask: %s", strerror(ret));
+        }
+    }
+
+    // vmsplice 只用在阻塞的 pipe 上, 由异步队列的写线程调用; pipe 的容量已经由调用者按 pipeSize 设置
+    if(configuration.vmsplice && isPipeFd(this->fd) && (configuration.asyncQueueSize > 0U) && (overflowLimit == 0U))
+    {
+        try
+        {
+            splicer = std::make_unique<PipeSplicer>(static_cast<size_t>(std::max(::fcntl(this->fd, F_GETPIPE_SZ), 0)));
+        }
+        catch(const std::runtime_error& e)
+        {
+            std::cerr << name << ": " << e.what() << ", vmsplice is disabled" << std::endl;
+        }
+    }
+
+    if(configuration.asyncQueueSize > 0U)
+    {
+        // 一批的总长度不超过 PIPE_BUF, 整批 writev 是原子的, 读端不会看到被其它写者打断的记录;
+        // vmsplice 时每一页是一个独立的 pipe_buffer, 一批可以更大
+        const size_t batchBytes = splicer ? configuration.batchBytes :
+                                  (((configuration.batchBytes > 0U) && (configuration.batchBytes < PIPE_BUF)) ? configuration.batchBytes : PIPE_BUF);
+        queue = std::make_unique<AsyncWriteQueue>(configuration.asyncQueueSize, name, batchBytes, configuration.batchLinger,
+            [this](const AsyncWriteQueue::Records& records) { writeRecords(records); },
+            [this](const std::string& message) { return formatNotice(message); });
+    }
 }
 
-FifoLogger::FifoLogger(FileDescriptor&& fd):fd(std::move(fd))
+FifoLogger::~FifoLogger()
 {
+    // 写线程可能还在往溢出缓冲区里放记录, 先停掉它
+    queue.reset();
 
+    if(drainer.joinable())
+    {
+        {
+            const std::lock_guard<std::mutex> guard(overflowLock);
+            stopping = true;
+        }
+        overflowPending.notify_one();
+        drainer.join();
+    }
 }
 
 void FifoLogger::write(const std::string& message)
 {
-    if (fd < 0)
+    const struct iovec iov = {const_cast<char*>(message.data()), message.size()};
+    write(&iov, 1);
+}
+
+void FifoLogger::writeAsync(const std::string& message)
+{
+    const struct iovec iov = {const_cast<char*>(message.data()), message.size()};
+    writeAsync(&iov, 1);
+}
+
+void FifoLogger::write(const struct iovec* iov, int count)
+{
+    if(queue)
     {
+        queue->write(iov, count);
+    }else
+    {
+        writeNow(iov, count);
+    }
+}
+
+void FifoLogger::writeAsync(const struct iovec* iov, int count)
+{
+    if(queue)
+    {
+        if(!queue->push(iov, count))
+        {
+            statistics.add(Statistics::DROPPED);
+        }
+    }else
+    {
+        writeNow(iov, count);
+    }
+}
+
+// 异步模式下在写线程上调用: 整批记录用一次 writev 写出
+void FifoLogger::writeRecords(const AsyncWriteQueue::Records& records)
+{
+    if(fd < 0)
+    {
+        statistics.add(Statistics::DROPPED, records.size());
         return;
     }
 
-    const SignalPipeBlocker sigpipeBlocker;
+    if(splicer)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const ssize_t ret = splicer->write(fd, records, statistics);
+        if((ret == -1) && (errno == EPIPE))
+        {
+            discardPendingSigpipe();
+            errno = EPIPE;
+        }
 
-    if(isFatalError(::write(fd, message.c_str(), message.size())))
+        checkWrite(ret, start);
+        return;
+    }
+
+    batch.clear();
+    for(const auto& record : records)
     {
-        fd.close();
+        batch.push_back({const_cast<char*>(record.data()), record.size()});
+    }
+
+    if(overflowLimit > 0U)
+    {
+        writeNonBlocking(batch.data(), static_cast<int>(batch.size()), true);
+        return;
+    }
+
+    // 写线程一直屏蔽着 SIGPIPE, 读端关闭时只会得到 EPIPE
+    const auto start = std::chrono::steady_clock::now();
+    const ssize_t ret = writeFully(fd, batch.data(), static_cast<int>(batch.size()), &statistics);
+    if((ret == -1) && (errno == EPIPE))
+    {
+        discardPendingSigpipe();
     }
+
+    checkWrite(ret, start);
 }
 
-void FifoLogger::writeAsync(const std::string& message)
+// 总长度不超过 PIPE_BUF 时 writev 和 write 一样是原子的, 更长的记录至少不会和本进程的其它记录交错
+void FifoLogger::writeNow(const struct iovec* iov, int count)
+{
+    if(overflowLimit > 0U)
+    {
+        writeNonBlocking(iov, count, false);
+        return;
+    }
+
+    if(fd < 0)
+    {
+        statistics.add(Statistics::DROPPED);
+        return;
+    }
+
+    const size_t size = getTotalLength(iov, count);
+
+    std::unique_lock<std::mutex> guard(largeWriteLock, std::defer_lock);
+    if(size > PIPE_BUF)
+    {
+        guard.lock();
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const ssize_t ret = tryWrite(iov, count, false);
+    if((ret >= 0) && (static_cast<size_t>(ret) < size))
+    {
+        statistics.add(Statistics::SHORT_WRITES);
+    }
+    checkWrite(ret, start);
+}
+
+// sigpipeBlocked 表示调用线程一直屏蔽着 SIGPIPE (写线程, drainer)
+ssize_t FifoLogger::tryWrite(const struct iovec* iov, int count, bool sigpipeBlocked)
+{
+    if(isSocket)
+    {
+        struct msghdr msg = {};
+        msg.msg_iov = const_cast<struct iovec*>(iov);
+        msg.msg_iovlen = count;
+        return ::sendmsg(fd, &msg, MSG_NOSIGNAL | ((overflowLimit > 0U) ? MSG_DONTWAIT : 0));
+    }
+
+    std::optional<SignalPipeBlocker> sigpipeBlocker;
+    if(!sigpipeIgnored && !sigpipeBlocked)
+    {
+        sigpipeBlocker.emplace();
+    }
+
+    const ssize_t ret = ::writev(fd, iov, count);
+    if(sigpipeBlocked && (ret == -1) && (errno == EPIPE))
+    {
+        discardPendingSigpipe();
+        errno = EPIPE;
+    }
+    return ret;
+}
+
+// 缓冲区为空时直接尝试写, 写不完的部分 (或者缓冲区不空时整条记录) 排进缓冲区, 调用线程不会阻塞在 pipe 上
+void FifoLogger::writeNonBlocking(const struct iovec* iov, int count, bool sigpipeBlocked)
 {
+    const size_t size = getTotalLength(iov, count);
+
+    std::unique_lock<std::mutex> guard(overflowLock);
     if(fd < 0)
     {
+        statistics.add(Statistics::DROPPED);
+        return;
+    }
+
+    size_t written(0U);
+    if(overflowRecords.empty())
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const ssize_t ret = tryWrite(iov, count, sigpipeBlocked);
+        if((ret >= 0) && (static_cast<size_t>(ret) < size))
+        {
+            statistics.add(Statistics::SHORT_WRITES);
+        }
+        checkWrite(ret, start);
+
+        if((ret >= 0) && (static_cast<size_t>(ret) == size))
+        {
+            return;
+        }
+
+        if((ret == -1) && (errno != EAGAIN))
+        {
+            statistics.add(Statistics::DROPPED);
+            return;
+        }
+        written = (ret > 0) ? static_cast<size_t>(ret) : 0U;
+    }
+
+    // 已经写出一部分的记录必须写完, 否则读端看到的是被截断的记录
+    if((written == 0U) && !makeRoom(guard, size))
+    {
+        dropOverflow(1U);
         return;
     }
 
-   const SignalPipeBlocker sigpipeBlocker;
+    std::string& record = overflowRecords.emplace_back();
+    record.reserve(size - written);
+    for(int i = 0; i < count; i++)
+    {
+        const size_t skip = std::min(written, iov[i].iov_len);
+        record.append(static_cast<const char*>(iov[i].iov_base) + skip, iov[i].iov_len - skip);
+        written -= skip;
+    }
+    overflowBytes.fetch_add(record.size(), std::memory_order_relaxed);
+    overflowPending.notify_one();
+}
+
+// 缓冲区至少放得下这条记录时返回 true; 缓冲区为空时总是放得下, 超长的记录不会永远被拒绝
+bool FifoLogger::makeRoom(std::unique_lock<std::mutex>& guard, size_t size)
+{
+    const auto hasRoom = [this, size]()
+    {
+        return overflowRecords.empty() || (overflowBytes.load(std::memory_order_relaxed) + size <= overflowLimit);
+    };
+
+    if(hasRoom())
+    {
+        return true;
+    }
+
+    switch(overflowPolicy)
+    {
+    case OverflowPolicy::DROP_NEWEST:
+        return false;
+    case OverflowPolicy::DROP_OLDEST:
+        // 第一条可能已经写出了一部分, 从第二条开始丢弃
+        while(!hasRoom() && (overflowRecords.size() > 1U))
+        {
+            overflowBytes.fetch_sub(overflowRecords[1].size(), std::memory_order_relaxed);
+            overflowRecords.erase(overflowRecords.begin() + 1);
+            dropOverflow(1U);
+        }
+        return hasRoom();
+    default:
+        // 读端停住时只有第一条记录等满 overflowDeadline, 之后的记录在 drainer 写出新数据之前直接丢弃
+        if(overflowStalled)
+        {
+            return false;
+        }
+
+        if(overflowDrained.wait_for(guard, overflowDeadline, [this, &hasRoom]() { return (fd < 0) || hasRoom(); }))
+        {
+            return fd >= 0;
+        }
+        overflowStalled = true;
+        return false;
+    }
+}
+
+void FifoLogger::dropOverflow(uint64_t records)
+{
+    overflowDropped += records;
+    statistics.add(Statistics::DROPPED, records);
+}
+
+// 在锁内写一次 (fd 是非阻塞的, 不会在锁内阻塞); 返回 false 表示 pipe 满了, 需要等待可写.
+// 和写线程的批一样总长度不超过 PIPE_BUF, writev 是原子的; 只有单独一条记录可以更长
+bool FifoLogger::drainOnce()
+{
+    if(fd >= 0)
+    {
+        drainBatch.clear();
+        size_t bytes(0U);
+        for(const auto& record : overflowRecords)
+        {
+            const size_t skip = drainBatch.empty() ? overflowOffset : 0U;
+            const size_t size = record.size() - skip;
+            if((drainBatch.size() == IOV_MAX) || (!drainBatch.empty() && (bytes + size > PIPE_BUF)))
+            {
+                break;
+            }
+
+            drainBatch.push_back({const_cast<char*>(record.data() + skip), size});
+            bytes += size;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        const ssize_t ret = tryWrite(drainBatch.data(), static_cast<int>(drainBatch.size()), true);
+        checkWrite(ret, start);
+
+        if(ret >= 0)
+        {
+            consumeOverflow(static_cast<size_t>(ret));
+            return true;
+        }
+
+        if(fd >= 0)
+        {
+            return false;
+        }
+    }
+
+    // fd 已经退役, 剩下的记录都写不出去了
+    dropOverflow(overflowRecords.size());
+    overflowRecords.clear();
+    overflowBytes.store(0U, std::memory_order_relaxed);
+    overflowOffset = 0U;
+    overflowDrained.notify_all();
+    return true;
+}
 
-    if(isFatalError(::write(fd, message.c_str(), message.size())))
+void FifoLogger::consumeOverflow(size_t written)
+{
+    if(written > 0U)
     {
+        overflowStalled = false;
+    }
+
+    while(written > 0U)
+    {
+        const size_t remaining = overflowRecords.front().size() - overflowOffset;
+        if(written < remaining)
+        {
+            overflowOffset += written;
+            break;
+        }
+
+        written -= remaining;
+        overflowBytes.fetch_sub(overflowRecords.front().size(), std::memory_order_relaxed);
+        overflowRecords.pop_front();
+        overflowOffset = 0U;
+    }
+
+    overflowDrained.notify_all();
+}
+
+bool FifoLogger::waitWritable(std::chrono::milliseconds timeout)
+{
+    struct pollfd pfd = {fd, POLLOUT, 0};
+    return TEMP_FAILURE_RETRY(::poll(&pfd, 1, static_cast<int>(timeout.count()))) > 0;
+}
+
+// 缓冲区写空后把期间丢弃的条数作为一条记录写出; 析构时剩下的记录最多再等 overflowDeadline
+void FifoLogger::runDrainer()
+{
+    const std::string threadName = (name + "-drain").substr(0, 15);
+    pthread_setname_np(pthread_self(), threadName.c_str());
+
+    auto giveUp = std::chrono::steady_clock::time_point::max();
+
+    std::unique_lock<std::mutex> guard(overflowLock);
+    for(;;)
+    {
+        overflowPending.wait(guard, [this]() { return stopping || !overflowRecords.empty() || (overflowDropped > 0U); });
+
+        if(stopping && (giveUp == std::chrono::steady_clock::time_point::max()))
+        {
+            giveUp = std::chrono::steady_clock::now() + overflowDeadline;
+        }
+
+        if(overflowRecords.empty())
+        {
+            if((overflowDropped > 0U) && (fd >= 0))
+            {
+                overflowRecords.push_back(formatNotice(name + ": reader too slow, dropped " + std::to_string(overflowDropped) + " messages"));
+                overflowBytes.fetch_add(overflowRecords.back().size(), std::memory_order_relaxed);
+            }
+            overflowDropped = 0U;
+
+            if(overflowRecords.empty() && stopping)
+            {
+                return;
+            }
+            continue;
+        }
+
+        if(std::chrono::steady_clock::now() >= giveUp)
+        {
+            statistics.add(Statistics::DROPPED, overflowRecords.size());
+            return;
+        }
+
+        if(drainOnce())
+        {
+            continue;
+        }
+
+        guard.unlock();
+        waitWritable(DRAIN_POLL_INTERVAL);
+        guard.lock();
+    }
+}
+
+// 记录一次写出, 致命错误时关闭 fd, 之后的写都直接丢弃
+void FifoLogger::checkWrite(ssize_t ret, std::chrono::steady_clock::time_point start)
+{
+    const int error = errno;
+    statistics.addWrite(ret, error, std::chrono::steady_clock::now() - start);
+
+    errno = error;
+    if(isFatalError(ret))
+    {
+        statistics.add(Statistics::RETIRED_FDS);
         fd.close();
     }
+    errno = error;
 }
 
+// 溢出缓冲区最多等 overflowDeadline, 读端停住时不会让调用者一直阻塞
 void FifoLogger::waitAllWriteAsyncsCompleted()
 {
+    if(queue)
+    {
+        queue->waitAllCompleted();
+    }
 
-}
\ No newline at end of file
+    if(overflowLimit > 0U)
+    {
+        std::unique_lock<std::mutex> guard(overflowLock);
+        overflowDrained.wait_for(guard, overflowDeadline, [this]() { return overflowRecords.empty(); });
+    }
+}
+
+// 只有 DROP_BELOW 在缓冲区超过一半时拒绝低级别的记录, 剩下的空间留给重要的记录
+bool FifoLogger::isAccepted(int priority)
+{
+    if((overflowPolicy != OverflowPolicy::DROP_BELOW) || (overflowLimit == 0U) || (LOG_PRI(priority) <= overflowLevel)
+       || (overflowBytes.load(std::memory_order_relaxed) <= overflowLimit / 2U))
+    {
+        return true;
+    }
+
+    const std::lock_guard<std::mutex> guard(overflowLock);
+    dropOverflow(1U);
+    overflowPending.notify_one();
+    return false;
+}
+
+const Statistics* FifoLogger::getStatistics() const
+{
+    return &statistics;
+}
+
+bool FifoLogger::isVmspliceEnabled() const noexcept
+{
+    return splicer != nullptr;
+}
@@ -11,10 +11,9 @@ FileDescriptor::FileDescriptor(int fd, bool ownership) noexcept:
 }
 
 FileDescriptor::FileDescriptor(FileDescriptor&& fd) noexcept :
-                    fd(fd.fd),
+                    fd(fd.fd.exchange(-1)),
                     ownership(fd.ownership)
 {
-    fd.fd = -1;
     fd.ownership = false;
 }
 
@@ -26,8 +25,8 @@ FileDescriptor::~FileDescriptor()
 FileDescriptor&  FileDescriptor::operator=(FileDescriptor&& fd) noexcept
 {
     close();
-    this->fd = fd.fd;
-    fd.fd = -1;
+    this->fd = fd.fd.exchange(-1);
+    this->ownership = fd.ownership;
     fd.ownership = false;
     return *this;
 }
@@ -35,8 +34,9 @@ FileDescriptor&  FileDescriptor::operator=(FileDescriptor&& fd) noexcept
 
 void FileDescriptor::close() noexcept
 {
-    if(fd >= 0 && ownership)
+    const int old = fd.exchange(-1);
+    if(old >= 0 && ownership)
     {
-        ::close(fd);
+        ::close(old);
     }
 }
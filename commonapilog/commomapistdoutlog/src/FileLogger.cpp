@@ -1,7 +1,10 @@
 #include "FileLogger.hpp"
-#include "SignalPipeBlock.hpp"
+#include "Utils.hpp"
 
+#include <cerrno>
 #include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 using namespace commonapistdoutlogger;
 
@@ -13,48 +16,228 @@ namespace
                 (errno != EIO) && (errno != EMSGSIZE) &&
                 (errno != ENOMEM) && (errno != ENOBUFS));
     }
+
+    // 压缩模式下没有配置 asyncQueueSize 时的队列大小
+    constexpr size_t DEFAULT_COMPRESS_QUEUE_SIZE(4096U);
+
+    // 一个 gzip member 的最大输入, 越大压缩率越高, 进程崩溃时丢失的也越多
+    constexpr size_t MAX_BLOCK_INPUT(1024U * 1024U);
+
+    // 低负载时数据最多在压缩器里停留这么久
+    constexpr std::chrono::seconds MAX_BLOCK_AGE(1);
+
+    // 压缩线程的 nice 值, 只使用空闲的 CPU
+    constexpr int COMPRESS_NICENESS(19);
 }
 
-FileLogger::FileLogger(FileDescriptor&& fd):fd(std::move(fd))
+// 普通文件和终端不会产生 SIGPIPE, 写的时候不需要屏蔽它
+FileLogger::FileLogger(FileDescriptor&& fd, const std::string& name, const WriterConfiguration& configuration):
+            fd(std::move(fd)),
+            lowPriority(false)
 {
+    if(configuration.compress)
+    {
+        gzip = std::make_unique<GzipStream>(Z_DEFAULT_COMPRESSION);
+        const size_t queueSize = (configuration.asyncQueueSize > 0U) ? configuration.asyncQueueSize : DEFAULT_COMPRESS_QUEUE_SIZE;
+        queue = std::make_unique<AsyncWriteQueue>(queueSize, name, configuration.batchBytes, configuration.batchLinger,
+            [this](const AsyncWriteQueue::Records& records) { compressRecords(records); },
+            [this](const std::string& message) { return formatNotice(message); },
+            [this]() { finishExpiredBlock(); });
+    }else if(configuration.asyncQueueSize > 0U)
+    {
+        queue = std::make_unique<AsyncWriteQueue>(configuration.asyncQueueSize, name, configuration.batchBytes, configuration.batchLinger,
+            [this](const AsyncWriteQueue::Records& records) { writeRecords(records); },
+            [this](const std::string& message) { return formatNotice(message); });
+    }
+}
 
+FileLogger::~FileLogger()
+{
+    // 写线程排空队列之后, 把最后一个 gzip member 写完整
+    queue.reset();
+    if(gzip)
+    {
+        finishBlock();
+    }
 }
 
 
 void FileLogger::write(const std::string& message)
+{
+    const struct iovec iov = {const_cast<char*>(message.data()), message.size()};
+    write(&iov, 1);
+}
+
+void FileLogger::writeAsync(const std::string& message)
+{
+    const struct iovec iov = {const_cast<char*>(message.data()), message.size()};
+    writeAsync(&iov, 1);
+}
+
+void FileLogger::write(const struct iovec* iov, int count)
+{
+    if(queue)
+    {
+        queue->write(iov, count);
+    }else
+    {
+        writeNow(iov, count);
+    }
+}
+
+void FileLogger::writeAsync(const struct iovec* iov, int count)
+{
+    if(queue)
+    {
+        if(!queue->push(iov, count))
+        {
+            statistics.add(Statistics::DROPPED);
+        }
+    }else
+    {
+        writeNow(iov, count);
+    }
+}
+
+// 异步模式下在写线程上调用: 整批记录用一次 writev 写出
+void FileLogger::writeRecords(const AsyncWriteQueue::Records& records)
 {
     if(fd < 0)
     {
+        statistics.add(Statistics::DROPPED, records.size());
         return;
     }
 
-    const SignalPipeBlocker sigpipeBlocker;
+    batch.clear();
+    for(const auto& record : records)
+    {
+        batch.push_back({const_cast<char*>(record.data()), record.size()});
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    checkWrite(writeFully(fd, batch.data(), static_cast<int>(batch.size()), &statistics), start);
+}
 
-    if(isFatalError(TEMP_FAILURE_RETRY(::write(fd, message.c_str(), message.size()))))
+// 在写线程上调用, 应用线程只把记录放进队列, 从不接触压缩器
+void FileLogger::compressRecords(const AsyncWriteQueue::Records& records)
+{
+    if(!lowPriority)
     {
-        fd.close();
+        ::setpriority(PRIO_PROCESS, static_cast<id_t>(::syscall(SYS_gettid)), COMPRESS_NICENESS);
+        lowPriority = true;
+    }
+
+    // waitAllWriteAsyncsCompleted 放进来的空记录: 它之前的记录都在这一批或更早的批次里, 结束 member 后它们都已经写出
+    bool flush(false);
+    for(const auto& record : records)
+    {
+        if(record.empty())
+        {
+            flush = true;
+            continue;
+        }
+
+        if(gzip->pendingInput() == 0U)
+        {
+            blockStart = std::chrono::steady_clock::now();
+        }
+        gzip->append(record.data(), record.size(), compressed);
+    }
+
+    if(flush || (gzip->pendingInput() >= MAX_BLOCK_INPUT) || isBlockExpired())
+    {
+        finishBlock();
+        return;
     }
+
+    // 还没有结束的 member 的输出也先写出去, 不在内存里累积
+    writeCompressed();
 }
 
-void FileLogger::writeAsync(const std::string& message)
+bool FileLogger::isBlockExpired() const
+{
+    return (gzip->pendingInput() > 0U) && (std::chrono::steady_clock::now() - blockStart >= MAX_BLOCK_AGE);
+}
+
+// 队列空闲时由写线程调用; 零星的日志继续攒进同一个 member, 只在停留超过 MAX_BLOCK_AGE 后结束它
+void FileLogger::finishExpiredBlock()
+{
+    if(isBlockExpired())
+    {
+        finishBlock();
+    }
+}
+
+void FileLogger::finishBlock()
+{
+    gzip->finish(compressed);
+    writeCompressed();
+}
+
+// 压缩数据被截断后整个 member 都无法解压, 必须全部写完
+void FileLogger::writeCompressed()
+{
+    if(compressed.empty() || (fd < 0))
+    {
+        compressed.clear();
+        return;
+    }
+
+    struct iovec iov = {compressed.data(), compressed.size()};
+    const auto start = std::chrono::steady_clock::now();
+    checkWrite(writeFully(fd, &iov, 1, &statistics), start);
+    compressed.clear();
+}
+
+void FileLogger::writeNow(const struct iovec* iov, int count)
 {
     if(fd < 0)
     {
+        statistics.add(Statistics::DROPPED);
         return;
     }
 
-    const SignalPipeBlocker sigpipeBlocker;
+    const auto start = std::chrono::steady_clock::now();
+    const ssize_t ret = TEMP_FAILURE_RETRY(::writev(fd, iov, count));
+    if((ret >= 0) && (static_cast<size_t>(ret) < getTotalLength(iov, count)))
+    {
+        statistics.add(Statistics::SHORT_WRITES);
+    }
+    checkWrite(ret, start);
+}
 
-    if(isFatalError(TEMP_FAILURE_RETRY(::write(fd, message.c_str(), message.size()))))
+// 记录一次写出, 致命错误时关闭 fd, 之后的写都直接丢弃
+void FileLogger::checkWrite(ssize_t ret, std::chrono::steady_clock::time_point start)
+{
+    const int error = errno;
+    statistics.addWrite(ret, error, std::chrono::steady_clock::now() - start);
+
+    errno = error;
+    if(isFatalError(ret))
     {
+        statistics.add(Statistics::RETIRED_FDS);
         fd.close();
     }
 }
 
 void FileLogger::waitAllWriteAsyncsCompleted()
 {
+    if(gzip)
+    {
+        // 空记录让写线程结束当前的 gzip member, write 返回时它和之前的记录都已经压缩并写出
+        queue->write(nullptr, 0);
+    }else if(queue)
+    {
+        queue->waitAllCompleted();
+    }
+
     if(fd >=0 )
     {
         ::fsync(fd);
     }
 }
+
+const Statistics* FileLogger::getStatistics() const
+{
+    return &statistics;
+}
@@ -0,0 +1,73 @@
+#include "GzipStream.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+using namespace commonapistdoutlogger;
+
+namespace
+{
+    // windowBits 加 16 表示输出 gzip 头和尾而不是 zlib 格式
+    constexpr int GZIP_WINDOW_BITS(15 + 16);
+
+    constexpr int MEMORY_LEVEL(8);
+
+    // 每次为 deflate 预留的输出空间
+    constexpr size_t OUTPUT_CHUNK(16U * 1024U);
+}
+
+GzipStream::GzipStream(int level):input(0U)
+{
+    memset(&stream, 0, sizeof(stream));
+    if(deflateInit2(&stream, level, Z_DEFLATED, GZIP_WINDOW_BITS, MEMORY_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        throw std::runtime_error(std::string("deflateInit2: ") + ((stream.msg != nullptr) ? stream.msg : "failed"));
+    }
+}
+
+GzipStream::~GzipStream()
+{
+    deflateEnd(&stream);
+}
+
+void GzipStream::append(const char* data, size_t size, std::string& out)
+{
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = static_cast<uInt>(size);
+    input += size;
+
+    while(stream.avail_in > 0U)
+    {
+        deflateInto(out, Z_NO_FLUSH);
+    }
+}
+
+void GzipStream::finish(std::string& out)
+{
+    if(input == 0U)
+    {
+        return;
+    }
+
+    stream.next_in = nullptr;
+    stream.avail_in = 0U;
+
+    // 输出空间不够时返回 Z_OK, 全部输出后返回 Z_STREAM_END
+    while(deflateInto(out, Z_FINISH) == Z_OK)
+    {
+    }
+
+    deflateReset(&stream);
+    input = 0U;
+}
+
+int GzipStream::deflateInto(std::string& out, int flush)
+{
+    const size_t used = out.size();
+    out.resize(used + OUTPUT_CHUNK);
+    stream.next_out = reinterpret_cast<Bytef*>(&out[used]);
+    stream.avail_out = static_cast<uInt>(OUTPUT_CHUNK);
+    const int ret = deflate(&stream, flush);
+    out.resize(used + OUTPUT_CHUNK - stream.avail_out);
+    return ret;
+}
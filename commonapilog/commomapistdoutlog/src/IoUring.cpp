@@ -0,0 +1,183 @@
+#include "IoUring.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace commonapistdoutlogger;
+
+namespace
+{
+    std::runtime_error uringError(const char* operation)
+    {
+        return std::runtime_error(std::string(operation) + ": " + strerror(errno));
+    }
+
+    int setup(unsigned entries, struct io_uring_params& params)
+    {
+        const int fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        if(fd < 0)
+        {
+            throw uringError("io_uring_setup");
+        }
+        return fd;
+    }
+
+    void* mapRing(int fd, size_t size, off_t offset)
+    {
+        void* ret = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        if(ret == MAP_FAILED)
+        {
+            throw uringError("mmap io_uring");
+        }
+        return ret;
+    }
+
+    template<typename T>
+    T* at(void* base, uint32_t offset)
+    {
+        return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+    }
+}
+
+IoUring::IoUring(unsigned entries):
+         ringFd(-1, true),
+         sqEntries(0U),
+         sqRing(MAP_FAILED),
+         sqRingSize(0U),
+         cqRing(MAP_FAILED),
+         cqRingSize(0U),
+         sqes(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+         sqesSize(0U),
+         sqeTail(0U)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFd = FileDescriptor(setup(entries, params), true);
+
+    // 5.6 以前的内核不支持 off = -1 (使用并推进文件的当前位置), 普通文件的每个写都会返回 EINVAL
+    if(!(params.features & IORING_FEAT_RW_CUR_POS))
+    {
+        throw std::runtime_error("io_uring: IORING_FEAT_RW_CUR_POS is not supported");
+    }
+
+    sqEntries = params.sq_entries;
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    // 构造函数中途抛出异常时析构函数不会执行, 已经映射的部分在这里释放
+    try
+    {
+        if(params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+            sqRing = cqRing = mapRing(ringFd, sqRingSize, IORING_OFF_SQ_RING);
+        }else
+        {
+            sqRing = mapRing(ringFd, sqRingSize, IORING_OFF_SQ_RING);
+            cqRing = mapRing(ringFd, cqRingSize, IORING_OFF_CQ_RING);
+        }
+
+        sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes = static_cast<struct io_uring_sqe*>(mapRing(ringFd, sqesSize, IORING_OFF_SQES));
+    }
+    catch(const std::runtime_error&)
+    {
+        unmap();
+        throw;
+    }
+
+    sqHead = at<unsigned>(sqRing, params.sq_off.head);
+    sqTail = at<unsigned>(sqRing, params.sq_off.tail);
+    sqMask = at<unsigned>(sqRing, params.sq_off.ring_mask);
+    sqArray = at<unsigned>(sqRing, params.sq_off.array);
+    cqHead = at<unsigned>(cqRing, params.cq_off.head);
+    cqTail = at<unsigned>(cqRing, params.cq_off.tail);
+    cqMask = at<unsigned>(cqRing, params.cq_off.ring_mask);
+    cqes = at<struct io_uring_cqe>(cqRing, params.cq_off.cqes);
+
+    sqeTail = *sqTail;
+}
+
+IoUring::~IoUring()
+{
+    unmap();
+}
+
+void IoUring::unmap() noexcept
+{
+    if(sqes != MAP_FAILED)
+    {
+        ::munmap(sqes, sqesSize);
+        sqes = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+    }
+
+    if((cqRing != MAP_FAILED) && (cqRing != sqRing))
+    {
+        ::munmap(cqRing, cqRingSize);
+    }
+    cqRing = MAP_FAILED;
+
+    if(sqRing != MAP_FAILED)
+    {
+        ::munmap(sqRing, sqRingSize);
+        sqRing = MAP_FAILED;
+    }
+}
+
+void IoUring::registerFiles(const int* fds, unsigned count)
+{
+    if(::syscall(__NR_io_uring_register, static_cast<int>(ringFd), IORING_REGISTER_FILES, fds, count) != 0)
+    {
+        throw uringError("IORING_REGISTER_FILES");
+    }
+}
+
+void IoUring::registerBuffers(const struct iovec* iov, unsigned count)
+{
+    if(::syscall(__NR_io_uring_register, static_cast<int>(ringFd), IORING_REGISTER_BUFFERS, iov, count) != 0)
+    {
+        throw uringError("IORING_REGISTER_BUFFERS");
+    }
+}
+
+struct io_uring_sqe* IoUring::getSqe()
+{
+    const unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if(sqeTail - head >= sqEntries)
+    {
+        return nullptr;
+    }
+
+    struct io_uring_sqe* sqe = &sqes[sqeTail & *sqMask];
+    sqeTail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IoUring::submitAndWait(unsigned waitCount)
+{
+    unsigned tail = *sqTail;
+    for(; tail != sqeTail; tail++)
+    {
+        sqArray[tail & *sqMask] = tail & *sqMask;
+    }
+    __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+
+    // 上一次没有被内核取走的 sqe 也一起提交
+    const unsigned toSubmit = tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+
+    const unsigned flags = (waitCount > 0U) ? IORING_ENTER_GETEVENTS : 0U;
+    int ret;
+    do
+    {
+        ret = static_cast<int>(::syscall(__NR_io_uring_enter, static_cast<int>(ringFd), toSubmit, waitCount, flags, nullptr, 0));
+    }while((ret == -1) && (errno == EINTR));
+
+    return ret;
+}
@@ -0,0 +1,333 @@
+#include "JsonMessageFormat.hpp"
+#include "LogClock.hpp"
+#include "Utils.hpp"
+
+#include <charconv>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+using namespace commonapistdoutlogger;
+
+namespace
+{
+    // 由基类按秒缓存渲染, 每条日志只补上微秒
+    constexpr const char* TIMESTAMP_FORMAT("%Y-%m-%dT%H:%M:%S.$6$z");
+
+    constexpr char HEX_DIGITS[] = "0123456789abcdef";
+
+    // U+FFFD, 替换不合法的 UTF-8 字节
+    constexpr const char REPLACEMENT[] = "\\ufffd";
+
+    // 需要转义的字节和非 ASCII 字节; 后者再检查是不是合法的 UTF-8 序列
+    bool needsEscape(unsigned char c) noexcept
+    {
+        return (c < 0x20U) || (c == '"') || (c == '\\') || (c >= 0x80U);
+    }
+
+    bool isContinuation(unsigned char c) noexcept
+    {
+        return (c & 0xc0U) == 0x80U;
+    }
+
+    // p 开头的合法 UTF-8 多字节序列的长度 (RFC 3629: 不接受过长编码, 代理区和超过 U+10FFFF 的码点), 不合法时返回 0
+    size_t getUtf8Length(const unsigned char* p, size_t size) noexcept
+    {
+        const unsigned char c = p[0];
+        size_t length;
+        unsigned char low(0x80U);
+        unsigned char high(0xbfU);
+
+        if((c >= 0xc2U) && (c <= 0xdfU))
+        {
+            length = 2U;
+        }else if((c >= 0xe0U) && (c <= 0xefU))
+        {
+            length = 3U;
+            low = (c == 0xe0U) ? 0xa0U : 0x80U;
+            high = (c == 0xedU) ? 0x9fU : 0xbfU;
+        }else if((c >= 0xf0U) && (c <= 0xf4U))
+        {
+            length = 4U;
+            low = (c == 0xf0U) ? 0x90U : 0x80U;
+            high = (c == 0xf4U) ? 0x8fU : 0xbfU;
+        }else
+        {
+            return 0U;
+        }
+
+        if((size < length) || (p[1] < low) || (p[1] > high))
+        {
+            return 0U;
+        }
+
+        for(size_t i = 2U; i < length; i++)
+        {
+            if(!isContinuation(p[i]))
+            {
+                return 0U;
+            }
+        }
+        return length;
+    }
+
+    size_t findEscapeScalar(const char* data, size_t size, size_t i) noexcept
+    {
+        for(; i < size; i++)
+        {
+            if(needsEscape(static_cast<unsigned char>(data[i])))
+            {
+                return i;
+            }
+        }
+        return size;
+    }
+
+#if defined(__x86_64__)
+    /*
+     * 每个块返回命中位掩码. c <= 0x1f 用无符号 max 判断: max(c, 0x1f) == 0x1f; c >= 0x80 直接取每个字节的最高位.
+     * 这些辅助函数总是内联: 在 AVX2 版本里被编译成 VEX 编码, 不会在 SSE 和 AVX 之间切换状态.
+     * 末尾不足一个块时把最后一个块和已经检查过的部分重叠着再读一次, 只有整条消息短于 16 字节时才逐字节检查.
+     */
+    __attribute__((always_inline)) inline unsigned getEscapeMask16(const char* p) noexcept
+    {
+        const __m128i control = _mm_set1_epi8(0x1f);
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+                                          _mm_cmpeq_epi8(_mm_max_epu8(v, control), control));
+        return static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(hits, v)));
+    }
+
+    // data[0, i) 已经检查过, 剩下不到 16 字节
+    __attribute__((always_inline)) inline size_t findEscapeTail16(const char* data, size_t size, size_t i) noexcept
+    {
+        if(i == size)
+        {
+            return size;
+        }
+
+        if(size < 16U)
+        {
+            return findEscapeScalar(data, size, i);
+        }
+
+        const size_t start = size - 16U;
+        const unsigned mask = getEscapeMask16(data + start) >> (i - start);
+        return (mask != 0U) ? (i + static_cast<size_t>(__builtin_ctz(mask))) : size;
+    }
+
+    size_t findEscapeSse2(const char* data, size_t size) noexcept
+    {
+        size_t i(0U);
+        for(; i + 16U <= size; i += 16U)
+        {
+            const unsigned mask = getEscapeMask16(data + i);
+            if(mask != 0U)
+            {
+                return i + static_cast<size_t>(__builtin_ctz(mask));
+            }
+        }
+        return findEscapeTail16(data, size, i);
+    }
+
+    __attribute__((target("avx2"), always_inline)) inline unsigned getEscapeMask32(const char* p) noexcept
+    {
+        const __m256i control = _mm256_set1_epi8(0x1f);
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        const __m256i hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))),
+                                             _mm256_cmpeq_epi8(_mm256_max_epu8(v, control), control));
+        return static_cast<unsigned>(_mm256_movemask_epi8(_mm256_or_si256(hits, v)));
+    }
+
+    __attribute__((target("avx2")))
+    size_t findEscapeAvx2(const char* data, size_t size) noexcept
+    {
+        size_t i(0U);
+        for(; i + 32U <= size; i += 32U)
+        {
+            const unsigned mask = getEscapeMask32(data + i);
+            if(mask != 0U)
+            {
+                return i + static_cast<size_t>(__builtin_ctz(mask));
+            }
+        }
+
+        if((i == size) || (size < 32U))
+        {
+            if(i + 16U <= size)
+            {
+                const unsigned mask = getEscapeMask16(data + i);
+                if(mask != 0U)
+                {
+                    return i + static_cast<size_t>(__builtin_ctz(mask));
+                }
+                i += 16U;
+            }
+            return findEscapeTail16(data, size, i);
+        }
+
+        const size_t start = size - 32U;
+        const unsigned mask = getEscapeMask32(data + start) >> (i - start);
+        return (mask != 0U) ? (i + static_cast<size_t>(__builtin_ctz(mask))) : size;
+    }
+
+    using FindEscape = size_t (*)(const char*, size_t) noexcept;
+
+    FindEscape selectFindEscape() noexcept
+    {
+        return useAvx2() ? findEscapeAvx2 : findEscapeSse2;
+    }
+
+    const FindEscape findCandidate = selectFindEscape();
+#else
+    size_t findCandidate(const char* data, size_t size) noexcept
+    {
+        return findEscapeScalar(data, size, 0U);
+    }
+#endif
+
+    // 跳过合法的 UTF-8 序列, 返回第一个需要转义或替换的字节; 连续的非 ASCII 字节 (例如中文) 逐个序列检查, 不再回到向量扫描
+    size_t findEscape(const char* data, size_t size) noexcept
+    {
+        const unsigned char* const bytes = reinterpret_cast<const unsigned char*>(data);
+        size_t i(0U);
+        for(;;)
+        {
+            i += findCandidate(data + i, size - i);
+            while((i < size) && (bytes[i] >= 0x80U))
+            {
+                const size_t length = getUtf8Length(bytes + i, size - i);
+                if(length == 0U)
+                {
+                    return i;
+                }
+                i += length;
+            }
+
+            if((i == size) || needsEscape(bytes[i]))
+            {
+                return i;
+            }
+        }
+    }
+
+    void appendEscapedByte(std::string& out, unsigned char c)
+    {
+        switch(c)
+        {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        case '\b': out += "\\b"; break;
+        case '\f': out += "\\f"; break;
+        default:
+        {
+            if(c >= 0x80U)
+            {
+                out.append(REPLACEMENT, sizeof(REPLACEMENT) - 1U);
+                break;
+            }
+
+            const char escaped[] = {'\\', 'u', '0', '0', HEX_DIGITS[c >> 4], HEX_DIGITS[c & 0x0fU]};
+            out.append(escaped, sizeof(escaped));
+            break;
+        }
+        }
+    }
+
+    void appendField(std::string& out, const char* name, const std::string& value)
+    {
+        out += name;
+        appendJsonEscaped(out, value.data(), value.size());
+        out += '"';
+    }
+}
+
+size_t commonapistdoutlogger::findJsonEscape(const char* data, size_t size) noexcept
+{
+    return findEscape(data, size);
+}
+
+void commonapistdoutlogger::appendJsonEscaped(std::string& out, const char* data, size_t size)
+{
+    size_t start(0U);
+    for(;;)
+    {
+        const size_t hit = start + findEscape(data + start, size - start);
+        out.append(data + start, hit - start);
+        if(hit == size)
+        {
+            return;
+        }
+
+        appendEscapedByte(out, static_cast<unsigned char>(data[hit]));
+        start = hit + 1U;
+    }
+}
+
+JsonMessageFormatter::JsonMessageFormatter():MessageFormatter(TIMESTAMP_FORMAT)
+{
+}
+
+void JsonMessageFormatter::createFragments(std::string& buffer, MessageFragments& fragments, const std::string& ident, pid_t pid, int facility, int priority, const char* message, size_t size)
+{
+    static const char end[] = "\"}\n";
+
+    if((priority & LOG_FACMASK) == 0)
+    {
+        priority |= facility;
+    }
+
+    struct timespec t;
+    getLogTime(t);
+
+    buffer.clear();
+    buffer += "{\"ts\":\"";
+    appendPrefix(buffer, priority, ident, pid, t);
+    buffer += "\",\"level\":\"";
+    buffer += levelToName(priority);
+    buffer += "\",\"facility\":";
+    if(const char* name = facilityToName(priority))
+    {
+        buffer += '"';
+        buffer += name;
+        buffer += '"';
+    }else
+    {
+        char number[16];
+        buffer.append(number, std::to_chars(number, number + sizeof(number), LOG_FAC(priority)).ptr);
+    }
+    appendField(buffer, ",\"ident\":\"", ident);
+    buffer += ",\"pid\":";
+    char number[16];
+    buffer.append(number, std::to_chars(number, number + sizeof(number), pid).ptr);
+    appendField(buffer, ",\"host\":\"", getHostNames().fqdn);
+    buffer += ",\"msg\":\"";
+
+    if((size > 0U) && (message[size - 1U] == '\n'))
+    {
+        size--;
+    }
+
+    const size_t hit = findEscape(message, size);
+    if(hit == size)
+    {
+        fragments.iov[0] = {const_cast<char*>(buffer.data()), buffer.size()};
+        fragments.iov[1] = {const_cast<char*>(message), size};
+        fragments.iov[2] = {const_cast<char*>(end), sizeof(end) - 1U};
+        fragments.count = 3;
+        return;
+    }
+
+    // 已经扫描过的前 hit 个字节不需要再检查
+    buffer.append(message, hit);
+    appendEscapedByte(buffer, static_cast<unsigned char>(message[hit]));
+    appendJsonEscaped(buffer, message + hit + 1U, size - hit - 1U);
+    buffer.append(end, sizeof(end) - 1U);
+
+    fragments.iov[0] = {const_cast<char*>(buffer.data()), buffer.size()};
+    fragments.count = 1;
+}
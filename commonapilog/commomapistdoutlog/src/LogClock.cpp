@@ -0,0 +1,373 @@
+#include "LogClock.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#if defined(__x86_64__)
+#include "SignalSetOperation.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <cpuid.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <x86intrin.h>
+#endif
+
+using namespace commonapistdoutlogger;
+
+namespace
+{
+    constexpr uint64_t NANOSECONDS_PER_SECOND(1000000000U);
+
+#if defined(__x86_64__)
+    // 第一次校准前测量的时长; 之后频率按从启动到现在的总时长计算, 越来越准
+    constexpr std::chrono::milliseconds FIRST_CALIBRATION(10);
+
+    // 重新对齐 CLOCK_REALTIME 的周期, 同时吸收 NTP 的调整
+    constexpr std::chrono::seconds RECALIBRATION_INTERVAL(1);
+
+    // 每次采样读几次, 取两次 rdtsc 间隔最短的一次
+    constexpr int SAMPLE_TRIES(5);
+
+    // 重新对齐时落后不超过这个值就在下一个周期内走慢追上, 不往回跳; 更大的差距 (例如手动往回调时间) 直接跳变
+    constexpr uint64_t MAX_SLEW_NANOSECONDS(100000000U);
+
+    bool hasInvariantTsc() noexcept
+    {
+        unsigned eax, ebx, ecx, edx;
+        return (__get_cpuid(0x80000007U, &eax, &ebx, &ecx, &edx) != 0) && ((edx & (1U << 8)) != 0U);
+    }
+
+    /*
+     * 换算参数 (baseTsc, baseNanoseconds, multiplier) 用 seqlock 发布, 读者不加锁:
+     *   realtime = baseNanoseconds + ((rdtsc() - baseTsc) * multiplier) >> 32
+     * 频率用 CLOCK_MONOTONIC_RAW 测量, 不受 NTP 调频影响; 基准点用 CLOCK_REALTIME, 每秒更新一次.
+     * NTP 调频时 CLOCK_REALTIME 和 RAW 频率每秒可以差几百微秒. 新基准点比旧参数推算的时间早时不往回跳,
+     * 而是从推算值出发, 在下一个周期内按比例走慢追上; 每个线程另外保证自己拿到的时间不倒退.
+     */
+    class TscClock
+    {
+    public:
+        TscClock():
+            sequence(0U),
+            baseTsc(0U),
+            baseNanoseconds(0U),
+            multiplier(0U),
+            epoch(0U),
+            owner(::getpid()),
+            calibration(std::make_unique<Calibration>())
+        {
+            sigset_t allSignals;
+            sigset_t oldSignals;
+            signalFillSet(&allSignals);
+            if(const int ret = pthread_sigmask(SIG_SETMASK, &allSignals, &oldSignals); ret != 0)
+            {
+                COMMON_API_STDOUT_LOGGER_ABORT("pthread_sigmask: %s", strerror(ret));
+            }
+
+            // 子进程里没有校准线程, 参数会一直停在 fork 时的值, 改用 CLOCK_REALTIME
+            if(const int ret = pthread_atfork(nullptr, nullptr, &TscClock::disableInChild); ret != 0)
+            {
+                COMMON_API_STDOUT_LOGGER_ABORT("pthread_atfork: %s", strerror(ret));
+            }
+
+            try
+            {
+                calibration->thread = std::thread(&TscClock::run, this);
+            }
+            catch(const std::system_error& e)
+            {
+                // 没有校准线程时一直使用 CLOCK_REALTIME
+                std::cerr << "COMMON_API_LOGGER_CLOCK=tsc: " << e.what() << ", use realtime" << std::endl;
+            }
+
+            if(const int ret = pthread_sigmask(SIG_SETMASK, &oldSignals, nullptr); ret != 0)
+            {
+                COMMON_API_STDOUT_LOGGER_ABORT("pthread_sigmask: %s", strerror(ret));
+            }
+        }
+
+        ~TscClock()
+        {
+            // fork 出的子进程调用 exit 时校准线程不存在: join 会一直阻塞, wakeup 上还记着它的等待, 析构也会阻塞.
+            // 这些状态属于父进程的线程, 在子进程里直接放弃
+            if(owner != ::getpid())
+            {
+                calibration.release();
+                return;
+            }
+
+            {
+                const std::lock_guard<std::mutex> guard(calibration->lock);
+                calibration->stopping = true;
+            }
+            calibration->wakeup.notify_one();
+
+            if(calibration->thread.joinable())
+            {
+                calibration->thread.join();
+            }
+        }
+
+        // 还没有校准时返回 false
+        bool now(struct timespec& ts) const noexcept
+        {
+            uint64_t seq, tsc, nanoseconds, mult, steps;
+            do
+            {
+                seq = sequence.load(std::memory_order_acquire);
+                tsc = baseTsc.load(std::memory_order_relaxed);
+                nanoseconds = baseNanoseconds.load(std::memory_order_relaxed);
+                mult = multiplier.load(std::memory_order_relaxed);
+                steps = epoch.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+            } while(((seq & 1U) != 0U) || (seq != sequence.load(std::memory_order_relaxed)));
+
+            if(mult == 0U)
+            {
+                return false;
+            }
+
+            uint64_t realtime = convert(__rdtsc(), tsc, nanoseconds, mult);
+
+            // 读到旧参数的线程可能比读到新参数的线程多走一点; 同一个线程返回的时间不倒退, 直到时钟被整体往回调
+            static thread_local Latest latest = {0U, 0U};
+            if((latest.epoch != steps) || (realtime > latest.realtime))
+            {
+                latest = {steps, realtime};
+            }else
+            {
+                realtime = latest.realtime;
+            }
+
+            ts.tv_sec = static_cast<time_t>(realtime / NANOSECONDS_PER_SECOND);
+            ts.tv_nsec = static_cast<long>(realtime % NANOSECONDS_PER_SECOND);
+            return true;
+        }
+
+        TscClock(const TscClock&) = delete;
+        TscClock(TscClock&&) = delete;
+        TscClock& operator=(const TscClock&) = delete;
+        TscClock& operator=(TscClock&&) = delete;
+    private:
+        struct Sample
+        {
+            uint64_t tsc;
+            uint64_t nanoseconds;
+        };
+
+        struct Latest
+        {
+            uint64_t epoch;
+            uint64_t realtime;
+        };
+
+        std::atomic<uint64_t> sequence;
+        std::atomic<uint64_t> baseTsc;
+        std::atomic<uint64_t> baseNanoseconds;
+        std::atomic<uint64_t> multiplier;     /* 每个 TSC 周期的纳秒数, 32.32 定点数; 0 表示还没有校准 */
+        std::atomic<uint64_t> epoch;          /* 每次往回跳变加一, 线程私有的不倒退保护随之重新开始 */
+
+        const pid_t owner;    /* 启动校准线程的进程 */
+
+        // 校准线程和唤醒它用的同步对象
+        struct Calibration
+        {
+            std::mutex lock;
+            std::condition_variable wakeup;
+            bool stopping = false;
+            std::thread thread;
+        };
+
+        std::unique_ptr<Calibration> calibration;
+
+        static void disableInChild() noexcept;
+
+        // 基准点可能刚在另一个 CPU 上采样, 比 current 稍晚
+        static uint64_t convert(uint64_t current, uint64_t tsc, uint64_t nanoseconds, uint64_t mult) noexcept
+        {
+            const uint64_t delta = (current > tsc) ? (current - tsc) : 0U;
+            return nanoseconds + static_cast<uint64_t>((static_cast<unsigned __int128>(delta) * mult) >> 32);
+        }
+
+        static Sample sample(clockid_t clock) noexcept
+        {
+            Sample best = {0U, 0U};
+            uint64_t window = std::numeric_limits<uint64_t>::max();
+
+            for(int i = 0; i < SAMPLE_TRIES; i++)
+            {
+                struct timespec ts;
+                const uint64_t before = __rdtsc();
+                ::clock_gettime(clock, &ts);
+                const uint64_t after = __rdtsc();
+
+                if(after - before < window)
+                {
+                    window = after - before;
+                    best.tsc = before + window / 2U;
+                    best.nanoseconds = static_cast<uint64_t>(ts.tv_sec) * NANOSECONDS_PER_SECOND + static_cast<uint64_t>(ts.tv_nsec);
+                }
+            }
+            return best;
+        }
+
+        void publish(uint64_t tsc, uint64_t nanoseconds, uint64_t mult, uint64_t steps) noexcept
+        {
+            const uint64_t seq = sequence.load(std::memory_order_relaxed);
+            sequence.store(seq + 1U, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            baseTsc.store(tsc, std::memory_order_relaxed);
+            baseNanoseconds.store(nanoseconds, std::memory_order_relaxed);
+            multiplier.store(mult, std::memory_order_relaxed);
+            epoch.store(steps, std::memory_order_relaxed);
+
+            sequence.store(seq + 2U, std::memory_order_release);
+        }
+
+        // 只在校准线程上调用, 它是唯一的写者, 可以直接读当前参数
+        void align(const Sample& real, uint64_t mult) noexcept
+        {
+            const uint64_t current = multiplier.load(std::memory_order_relaxed);
+            const uint64_t steps = epoch.load(std::memory_order_relaxed);
+            if(current == 0U)
+            {
+                publish(real.tsc, real.nanoseconds, mult, steps);
+                return;
+            }
+
+            const uint64_t predicted = convert(real.tsc, baseTsc.load(std::memory_order_relaxed), baseNanoseconds.load(std::memory_order_relaxed), current);
+            if(predicted <= real.nanoseconds)
+            {
+                publish(real.tsc, real.nanoseconds, mult, steps);
+                return;
+            }
+
+            const uint64_t behind = predicted - real.nanoseconds;
+            if(behind > MAX_SLEW_NANOSECONDS)
+            {
+                publish(real.tsc, real.nanoseconds, mult, steps + 1U);
+                return;
+            }
+
+            // 从推算值出发, 下一个周期走过 period - behind 纳秒, 周期结束时和 CLOCK_REALTIME 重新对齐
+            const uint64_t period = static_cast<uint64_t>(std::chrono::nanoseconds(RECALIBRATION_INTERVAL).count());
+            const uint64_t slewed = static_cast<uint64_t>((static_cast<unsigned __int128>(mult) * (period - behind)) / period);
+            publish(real.tsc, predicted, slewed, steps);
+        }
+
+        void run()
+        {
+            pthread_setname_np(pthread_self(), "commonapi-clock");
+
+            const Sample first = sample(CLOCK_MONOTONIC_RAW);
+            std::chrono::milliseconds interval(FIRST_CALIBRATION);
+
+            std::unique_lock<std::mutex> guard(calibration->lock);
+            while(!calibration->wakeup.wait_for(guard, interval, [this]() { return calibration->stopping; }))
+            {
+                const Sample raw = sample(CLOCK_MONOTONIC_RAW);
+                const Sample real = sample(CLOCK_REALTIME);
+                if((raw.tsc > first.tsc) && (raw.nanoseconds > first.nanoseconds))
+                {
+                    const uint64_t mult = static_cast<uint64_t>((static_cast<unsigned __int128>(raw.nanoseconds - first.nanoseconds) << 32) / (raw.tsc - first.tsc));
+                    align(real, mult);
+                }
+                interval = RECALIBRATION_INTERVAL;
+            }
+        }
+    };
+
+    // 第一次使用 tsc 时钟时才启动校准线程
+    TscClock& getTscClock()
+    {
+        static TscClock clock;
+        return clock;
+    }
+
+    // pthread_atfork 的子进程处理函数, 只在 getTscClock 构造之后注册; 子进程此时只有一个线程
+    void TscClock::disableInChild() noexcept
+    {
+        TscClock& clock = getTscClock();
+        clock.publish(0U, 0U, 0U, clock.epoch.load(std::memory_order_relaxed));
+    }
+#endif
+
+    LogClockSource readLogClockSource() noexcept
+    {
+        const char* value = ::getenv("COMMON_API_LOGGER_CLOCK");
+        if((value == nullptr) || (strcmp(value, "realtime") == 0))
+        {
+            return LogClockSource::REALTIME;
+        }
+
+        if(strcmp(value, "coarse") == 0)
+        {
+            return LogClockSource::REALTIME_COARSE;
+        }
+
+        if(strcmp(value, "tsc") == 0)
+        {
+#if defined(__x86_64__)
+            if(hasInvariantTsc())
+            {
+                return LogClockSource::TSC;
+            }
+#endif
+            std::cerr << "COMMON_API_LOGGER_CLOCK=tsc: no invariant TSC, use realtime" << std::endl;
+            return LogClockSource::REALTIME;
+        }
+
+        std::cerr << "COMMON_API_LOGGER_CLOCK: unknown clock \"" << value << "\", use realtime" << std::endl;
+        return LogClockSource::REALTIME;
+    }
+}
+
+LogClockSource commonapistdoutlogger::getLogClockSource() noexcept
+{
+    static const LogClockSource source = readLogClockSource();
+    return source;
+}
+
+const char* commonapistdoutlogger::getLogClockName(LogClockSource source) noexcept
+{
+    switch (source)
+    {
+    case LogClockSource::REALTIME: return "realtime";
+    case LogClockSource::REALTIME_COARSE: return "coarse";
+    case LogClockSource::TSC: return "tsc";
+    }
+    return "unknown";
+}
+
+void commonapistdoutlogger::getLogTime(struct timespec& ts) noexcept
+{
+    switch (getLogClockSource())
+    {
+    case LogClockSource::REALTIME_COARSE:
+        ::clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+        return;
+#if defined(__x86_64__)
+    case LogClockSource::TSC:
+        if(getTscClock().now(ts))
+        {
+            return;
+        }
+        break;
+#endif
+    default:
+        break;
+    }
+
+    ::clock_gettime(CLOCK_REALTIME, &ts);
+}
@@ -0,0 +1,57 @@
+#include "LogWriter.hpp"
+
+#include <syslog.h>
+
+using namespace commonapistdoutlogger;
+
+void LogWriter::write(const struct iovec* iov, int count)
+{
+    write(concatenate(iov, count));
+}
+
+void LogWriter::writeAsync(const struct iovec* iov, int count)
+{
+    writeAsync(concatenate(iov, count));
+}
+
+bool LogWriter::isAccepted(int)
+{
+    return true;
+}
+
+const Statistics* LogWriter::getStatistics() const
+{
+    return nullptr;
+}
+
+void LogWriter::setNoticeFormatter(NoticeFormatter formatter)
+{
+    noticeFormatter = std::move(formatter);
+}
+
+std::string LogWriter::formatNotice(const std::string& message) const
+{
+    if(noticeFormatter)
+    {
+        return noticeFormatter(LOG_SYSLOG | LOG_WARNING, message);
+    }
+    return message + "\n";
+}
+
+std::string LogWriter::concatenate(const struct iovec* iov, int count)
+{
+    size_t size(0U);
+    for(int i = 0; i < count; i++)
+    {
+        size += iov[i].iov_len;
+    }
+
+    std::string message;
+    message.reserve(size);
+    for(int i = 0; i < count; i++)
+    {
+        message.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    }
+
+    return message;
+}
@@ -1,6 +1,8 @@
 
 #include <logger/Logger.hpp>
 #include <logger/LoggerPlugin.hpp>
+#include <plugin/TimerService.hpp>
+#include <plugin/SignalMonitorService.hpp>
 
 #include "FileDescriptor.hpp"
 #include "RedirectOutPid.hpp"
@@ -8,16 +10,29 @@
 #include "MessageRouter.hpp"
 #include "FileLogger.hpp"
 #include "FifoLogger.hpp"
+#include "MmapFileLogger.hpp"
+#include "UringLogger.hpp"
+#include "RotatingFileLogger.hpp"
+#include "StagingLogger.hpp"
 #include "NullLogger.hpp"
 #include "MessageFormat.hpp"
-
+#include "BinaryMessageFormat.hpp"
+#include "JsonMessageFormat.hpp"
+#include "Rfc5424MessageFormat.hpp"
+#include "LogClock.hpp"
+#include "SignalRegistration.hpp"
+
+#include <algorithm>
+#include <climits>
 #include <iostream>
 #include <memory>
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <csignal>
 #include <cstring>
 #include <sys/stat.h>
+#include <fcntl.h>
 
 using namespace commonApi;
 using namespace commonApi::logger;
@@ -25,10 +40,6 @@ using namespace commonapistdoutlogger;
 
 namespace
 {
-    /* https://tools.ietf.org/html/rfc5424 */
-    //<34>1 2024-11-06T14:48:27.003Z mymachine.example.com app-name 12345 ID47 [exampleSDID@32473 iut="3" eventSource="Application"] User login successful
-    constexpr const char* RFC5424_PREFIX("<$r>1 %Y-%m-%dT%H:%M:%S.$6$z $H $i $p - - ");
-
     struct LoggerInfo
     {
         std::shared_ptr<PluginServices>& service;
@@ -122,7 +133,31 @@ namespace
     bool isFifoOrSocket(int fd)
     {
         struct  stat sb;
-        return (fstat(fd, &sb) == 0 && ((S_ISREG(sb.st_mode) || (S_ISCHR(sb.st_mode)))));
+        return (fstat(fd, &sb) == 0 && ((S_ISFIFO(sb.st_mode) || (S_ISSOCK(sb.st_mode)))));
+    }
+
+    bool isPipe(int fd)
+    {
+        struct stat sb;
+        return (0 == ::fstat(fd, &sb)) && S_ISFIFO(sb.st_mode);
+    }
+
+    // pipe 的容量属于 pipe 本身, 对所有写者生效; 非特权进程不能超过 /proc/sys/fs/pipe-max-size
+    void setPipeSize(int fd, size_t size, const std::string& name)
+    {
+        const int ret = ::fcntl(fd, F_SETPIPE_SZ, static_cast<int>(std::min<size_t>(size, INT_MAX)));
+        if(ret == -1)
+        {
+            std::cerr << name << ": F_SETPIPE_SZ " << size << ": " << strerror(errno) << std::endl;
+            return;
+        }
+        std::cout << name << ": pipe size " << ret << " bytes" << std::endl;
+    }
+
+    bool isRegularFile(int fd)
+    {
+        struct stat sb;
+        return (0 == ::fstat(fd, &sb)) && S_ISREG(sb.st_mode);
     }
 
     bool isFileOrCharDevice(int fd)
@@ -132,23 +167,173 @@ namespace
         return (0 == ::fstat(fd, &sb)) && (S_ISREG(sb.st_mode) || S_ISCHR(sb.st_mode));
     }
 
-    std::unique_ptr<MessageFormatter> getMessageFormatter()
+    std::unique_ptr<MessageFormatter> createMessageFormatter(const char* prefixFormat, MessageFormat format)
     {
-        return std::make_unique<MessageFormatter>(getMessageFormatPrefix());
+        if(format == MessageFormat::BINARY)
+        {
+            return std::make_unique<BinaryMessageFormatter>(prefixFormat);
+        }
+
+        // 绝大多数进程使用默认前缀, 它有不解释 token 的专用版本
+        if(strcmp(prefixFormat, RFC5424_PREFIX) == 0)
+        {
+            return std::make_unique<Rfc5424MessageFormatter>();
+        }
+        return std::make_unique<MessageFormatter>(prefixFormat);
     }
 
-    std::unique_ptr<LogWriter> createLogWriter(FileDescriptor&& fd, const std::string& name)
+    std::unique_ptr<MessageFormatter> getMessageFormatter(MessageFormat format)
     {
+        std::cout << "COMMON_API_LOGGER_CLOCK: " << getLogClockName(getLogClockSource()) << std::endl;
+
+        // JSON 的字段固定, 不使用前缀格式
+        if(format == MessageFormat::JSON)
+        {
+            std::cout << "messageFormat=json: one JSON object per line" << std::endl;
+            return std::make_unique<JsonMessageFormatter>();
+        }
+
+        if(format == MessageFormat::BINARY)
+        {
+            std::cout << "messageFormat=binary: use commonapilogdecode to read the output" << std::endl;
+        }
+
+        try
+        {
+            return createMessageFormatter(getMessageFormatPrefix(), format);
+        }
+        catch(const std::runtime_error& e)
+        {
+            std::cerr << e.what() << ", use RFC 5424 as default " << std::endl;
+            return createMessageFormatter(RFC5424_PREFIX, format);
+        }
+    }
+
+    // 插件自己打开、并且不是本进程 stdout/stderr 的文件只有 logger 在写
+    bool isExclusiveSink(int fd)
+    {
+        return !isTheSameFile(fd, STDOUT_FILENO) && !isTheSameFile(fd, STDERR_FILENO);
+    }
+
+    /*
+     * gzip 流只写到 logger 独占的普通文件: tty 和 pipe 的读者要的是文本, 共用的文件里应用的明文会夹在 gzip member 之间,
+     * 切分出的段也不是完整的 gzip 流. 不能压缩时给出原因
+     */
+    bool canCompress(int fd, const std::string& name, const WriterConfiguration& configuration, bool exclusive)
+    {
+        const char* reason(nullptr);
+        if(!isRegularFile(fd))
+        {
+            reason = "is not a regular file";
+        }else if(!exclusive)
+        {
+            reason = "is shared with other writers";
+        }else if(configuration.rotation.enabled())
+        {
+            reason = "is rotated";
+        }
+
+        if(reason != nullptr)
+        {
+            std::cerr << name << " (fd " << fd << " ) " << reason << ", compress is ignored" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    /*
+     * exclusive 为 false 时文件和应用的 printf/std::cout (或者被重定向的进程) 共用, 别人的写入不经过 logger:
+     * mmap 预留的偏移会和它们的 O_APPEND 写入互相覆盖, 这种文件不使用 MmapFileLogger, 也不压缩
+     */
+    std::unique_ptr<LogWriter> createLogWriter(FileDescriptor&& fd, const std::string& name, const WriterConfiguration& configuration, bool exclusive)
+    {
+        if(configuration.compress && !canCompress(fd, name, configuration, exclusive))
+        {
+            WriterConfiguration plain(configuration);
+            plain.compress = false;
+            return createLogWriter(std::move(fd), name, plain, exclusive);
+        }
+
+        // 在选择 writer 之前设置, io_uring 和 FifoLogger 写的 pipe 都生效, vmsplice 按设置后的容量分配页
+        if((configuration.pipeSize > 0U) && isPipe(fd))
+        {
+            setPipeSize(fd, configuration.pipeSize, name);
+        }
+
+        if(configuration.rotation.enabled() && isRegularFile(fd))
+        {
+            const int rawFd = fd;
+            try
+            {
+                auto logger = std::make_unique<RotatingFileLogger>(fd, name, configuration);
+                std::cout << name << " (fd " << rawFd << " ) " << "is a regular file, creating rotating file logger" << std::endl;
+                return logger;
+            }
+            catch(const std::runtime_error& e)
+            {
+                std::cerr << name << ": " << e.what() << ", rotation is disabled" << std::endl;
+            }
+        }
+
+        if(configuration.compress)
+        {
+            std::cout << name << " (fd " << fd << " ) " << "is a regular file, creating gzip file logger" << std::endl;
+            return std::make_unique<FileLogger>(std::move(fd), name, configuration);
+        }
+
+        if(configuration.mmapFile && isRegularFile(fd) && !exclusive)
+        {
+            std::cerr << name << " (fd " << fd << " ) " << "is shared with other writers, fileWriter=mmap is ignored" << std::endl;
+        }else if(configuration.mmapFile && isRegularFile(fd))
+        {
+            try
+            {
+                auto logger = std::make_unique<MmapFileLogger>(fd);
+                std::cout << name << " (fd " << fd << " ) " << "is a regular file, creating mmap file logger" << std::endl;
+                return logger;
+            }
+            catch(const std::runtime_error& e)
+            {
+                std::cerr << name << ": " << e.what() << ", creating file logger" << std::endl;
+            }
+        }
+
+        // 设置了溢出缓冲区或 vmsplice 时 pipe/socket 由 FifoLogger 写
+        const bool fifoLoggerOnly = ((configuration.overflowBytes > 0U) || configuration.vmsplice) && isFifoOrSocket(fd);
+        if(configuration.uring && (configuration.asyncQueueSize > 0U) && !fifoLoggerOnly && (isFifoOrSocket(fd) || isFileOrCharDevice(fd)))
+        {
+            const int rawFd = fd;
+            try
+            {
+                auto logger = std::make_unique<UringLogger>(fd, name, configuration);
+                std::cout << name << " (fd " << rawFd << " ) " << "creating io_uring logger" << std::endl;
+                return logger;
+            }
+            catch(const std::runtime_error& e)
+            {
+                std::cerr << name << ": " << e.what() << ", io_uring is not available" << std::endl;
+            }
+        }
+
         if(isFifoOrSocket(fd))
         {
             std::cout << name << " (fd " << fd << " ) " << "is a pipe/socket, creating fifo logger" <<std::endl;
-            return std::make_unique<FifoLogger>(std::move(fd));
+            if(configuration.overflowBytes > 0U)
+            {
+                std::cout << name << ": non-blocking writes, " << configuration.overflowBytes << " bytes overflow buffer" << std::endl;
+            }
+            auto logger = std::make_unique<FifoLogger>(std::move(fd), name, configuration);
+            if(logger->isVmspliceEnabled())
+            {
+                std::cout << name << ": records are handed to the pipe with vmsplice" << std::endl;
+            }
+            return logger;
         }
 
         if(isFileOrCharDevice(fd))
         {
             std::cout << name << " (fd " << fd << " ) " << " is a regular file or tty, creating fifo logger" <<std::endl;
-            return std::make_unique<FileLogger>(std::move(fd));
+            return std::make_unique<FileLogger>(std::move(fd), name, configuration);
         }
 
         std::cout << name << " ( fd " << fd << " ) of type "<< getFdType(fd) << "can not be written to, creating null logger " << std::endl;
@@ -156,40 +341,218 @@ namespace
         return std::make_unique<NullLogger>();
     }
 
-    std::shared_ptr<Logger> getLoggerPlugin(const LoggerInfo& info)
+    // stagingSize 大于 0 时在 writer 外面包一层每线程暂存区; pipe/socket 的整块写入不超过 PIPE_BUF, 保持原子
+    std::unique_ptr<LogWriter> createStagedLogWriter(FileDescriptor&& fd, const std::string& name, const WriterConfiguration& configuration, bool exclusive)
     {
-        FileDescriptor stdoutFd = getStdoutFd();
-        FileDescriptor stderrFd = getStdErrFd();
+        const bool writable = isFifoOrSocket(fd) || isFileOrCharDevice(fd);
+        const size_t stagingBytes = isFifoOrSocket(fd) ? std::min<size_t>(configuration.stagingBytes, PIPE_BUF) : configuration.stagingBytes;
 
-        std::ostringstream errors;
+        auto logger = createLogWriter(std::move(fd), name, configuration, exclusive);
+        if(!writable || (stagingBytes == 0U))
+        {
+            return logger;
+        }
 
-        auto config = getConfiguration(errors);
-        auto errs = errors.str();
-        if(!errs.empty())
+        std::cout << name << ": writeAsync is staged per thread, " << stagingBytes << " bytes, flushed every "
+                  << configuration.stagingInterval.count() << " ms" << std::endl;
+        return std::make_unique<StagingLogger>(std::move(logger), name, stagingBytes, configuration.stagingInterval);
+    }
+
+    // fifo 没有读端时 open 会一直阻塞, 所以先用 O_NONBLOCK 打开 (没有读端时失败), 打开后恢复成和 stdout 一样的阻塞写
+    FileDescriptor openSink(const std::string& path)
+    {
+        const int fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC | O_NONBLOCK, 0644);
+        if(fd < 0)
         {
-            ::dprintf(stderrFd,"%s", errs.c_str());
+            throw std::runtime_error("open " + path + ": " + strerror(errno));
+        }
+
+        FileDescriptor ret(fd, true);
+        const int flags = ::fcntl(fd, F_GETFL);
+        if((flags == -1) || (::fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) == -1))
+        {
+            throw std::runtime_error("fcntl " + path + ": " + strerror(errno));
+        }
+
+        return ret;
+    }
+
+    std::vector<MessageSink> createExtraSinks(const SinkConfigurations& sinkConfigurations, const WriterConfiguration& configuration)
+    {
+        std::vector<MessageSink> sinks;
+        for(const auto& sink : sinkConfigurations)
+        {
+            // stdout 和 stderr 占用前两个
+            if(sinks.size() + 2U >= MessageRouter::MAX_SINKS)
+            {
+                std::cerr << "too many sinks, " << sink.path << " is ignored" << std::endl;
+                continue;
+            }
+
+            try
+            {
+                const std::string name = "sink" + std::to_string(sinks.size());
+                FileDescriptor fd = openSink(sink.path);
+                const bool exclusive = isExclusiveSink(fd);
+                auto logger = createStagedLogWriter(std::move(fd), name, configuration, exclusive);
+                std::cout << name << ": " << sink.path << " added" << std::endl;
+                sinks.push_back({std::move(logger), sink.includeLevels, sink.includeFacilities});
+            }
+            catch(const std::runtime_error& e)
+            {
+                std::cerr << e.what() << ", sink is ignored" << std::endl;
+            }
         }
 
+        return sinks;
+    }
+
+    // 周期性地在 router 上执行 action (重新读取主机名, 报告限速丢弃), 定时器只持有弱引用, logger 释放后自然停止
+    void armRouterTimer(const std::weak_ptr<PluginServices>& services, const std::weak_ptr<MessageRouter>& router, int intervalMs,
+                        void (MessageRouter::*action)())
+    {
+        auto lockedServices = services.lock();
+        if(!lockedServices)
+        {
+            return;
+        }
+
+        lockedServices->getTimerService().addOnceTimer([services, router, intervalMs, action]()
+        {
+            if(auto lockedRouter = router.lock())
+            {
+                ((*lockedRouter).*action)();
+                armRouterTimer(services, router, intervalMs, action);
+            }
+        }, intervalMs);
+    }
+
+    // 只有设置了 COMMON_API_STDOUT_LOGGER_ATTRS_FILE 时才注册 SIGHUP, 不覆盖应用自己的处理; 回调只持有弱引用, 注册由 router 持有, 随它一起注销
+    void registerReloadSignal(const std::shared_ptr<PluginServices>& services, const std::shared_ptr<MessageRouter>& router)
+    {
+        const char* path = ::getenv("COMMON_API_STDOUT_LOGGER_ATTRS_FILE");
+        if(!services || (nullptr == path))
+        {
+            return;
+        }
+
+        std::cout << "SIGHUP reloads level/facility filters from " << path << std::endl;
+        const std::weak_ptr<MessageRouter> weakRouter(router);
+        router->setReloadSignal(std::make_unique<SignalRegistration>(services, SIGHUP, [weakRouter]()
+        {
+            auto lockedRouter = weakRouter.lock();
+            if(!lockedRouter)
+            {
+                return;
+            }
+
+            std::ostringstream errors;
+            const auto config = reloadConfiguration(errors);
+            const auto errs = errors.str();
+            if(!errs.empty())
+            {
+                std::cerr << errs;
+            }
+
+            lockedRouter->reloadFilters(config);
+            lockedRouter->refreshHostNames();
+            std::cout << "SIGHUP: filters reloaded" << std::endl;
+        }));
+    }
+
+    std::shared_ptr<MessageRouter> createMessageRouter(const LoggerInfo& info, Configuration&& config, FileDescriptor&& stdoutFd, FileDescriptor&& stderrFd)
+    {
+        if(config.writer.asyncQueueSize > 0U)
+        {
+            std::cout << "writeAsync will be handed to a writer thread, queue size " << config.writer.asyncQueueSize << std::endl;
+        }
+
+        const WriterConfiguration writerConfig = config.writer;
+        const MessageFormat messageFormat = config.messageFormat;
+
+        if(writerConfig.sigpipeIgnored)
+        {
+            std::cout << "sigpipe=ignore: SIGPIPE is ignored process wide" << std::endl;
+            ::signal(SIGPIPE, SIG_IGN);
+        }
+
+        auto extraSinks = createExtraSinks(config.sinks, writerConfig);
+
         if(isTheSameFile(stdoutFd, stderrFd))
         {
             std::cout << "STDOUT ( " << stdoutFd << ") and STDERR (" <<stderrFd << ") are the same: all will be write to STDOUT" << std::endl;
 
             return std::make_shared<MessageRouter>(
-                getMessageFormatter(),
+                getMessageFormatter(messageFormat),
                 info.ident,
                 info.facility,
                 info.pid,
                 std::move(config),
-                createLogWriter(std::move(stdoutFd), "stdout"));
+                createStagedLogWriter(std::move(stdoutFd), "stdout", writerConfig, false),
+                std::move(extraSinks));
         }
 
         std::cout << "STDOUT (" << stdoutFd << ") and STDERR ( " << stderrFd << " ) are not the same: messages with level <= " << config.minErrLevel
         << "will be written to STDERR " <<std::endl;
 
-        return std::make_shared<MessageRouter>(getMessageFormatter(), 
+        return std::make_shared<MessageRouter>(getMessageFormatter(messageFormat), 
         info.ident, info.facility, info.pid, std::move(config),
-        createLogWriter(std::move(stdoutFd), "stdout"),
-        createLogWriter(std::move(stderrFd), "stderr"));
+        createStagedLogWriter(std::move(stdoutFd), "stdout", writerConfig, false),
+        createStagedLogWriter(std::move(stderrFd), "stderr", writerConfig, false),
+        std::move(extraSinks));
+    }
+
+    std::shared_ptr<Logger> getLoggerPlugin(const LoggerInfo& info)
+    {
+        FileDescriptor stdoutFd = getStdoutFd();
+        FileDescriptor stderrFd = getStdErrFd();
+
+        std::ostringstream errors;
+
+        auto config = getConfiguration(errors);
+        auto errs = errors.str();
+        if(!errs.empty())
+        {
+            ::dprintf(stderrFd,"%s", errs.c_str());
+        }
+
+        const int hostnameRefreshInterval = config.hostnameRefreshInterval;
+        const RateLimitConfiguration rateLimit = config.rateLimit;
+        const int repeatInterval = config.repeatInterval;
+        const int statsInterval = config.statsInterval;
+
+        auto router = createMessageRouter(info, std::move(config), std::move(stdoutFd), std::move(stderrFd));
+
+        if(hostnameRefreshInterval > 0)
+        {
+            std::cout << "hostname will be refreshed every " << hostnameRefreshInterval << " seconds" << std::endl;
+            armRouterTimer(info.service, router, hostnameRefreshInterval * 1000, &MessageRouter::refreshHostNames);
+        }
+
+        if(rateLimit.enabled())
+        {
+            std::cout << "messages are limited to " << rateLimit.rate << "/s per priority, burst " << rateLimit.getBurst() << std::endl;
+            if(rateLimit.reportInterval > 0)
+            {
+                armRouterTimer(info.service, router, rateLimit.reportInterval * 1000, &MessageRouter::reportSuppressed);
+            }
+        }
+
+        if(repeatInterval > 0)
+        {
+            std::cout << "repeated messages are collapsed, reported at least every " << repeatInterval << " seconds" << std::endl;
+            armRouterTimer(info.service, router, repeatInterval * 1000, &MessageRouter::reportRepeats);
+        }
+
+        if(statsInterval > 0)
+        {
+            std::cout << "logger statistics are reported every " << statsInterval << " seconds" << std::endl;
+            armRouterTimer(info.service, router, statsInterval * 1000, &MessageRouter::reportStatistics);
+        }
+
+        registerReloadSignal(info.service, router);
+
+        return router;
     }
 }
 
@@ -1,111 +1,217 @@
-#include <sys/time.h>
+#include <atomic>
+#include <cctype>
+#include <charconv>
 #include <cstdio>
-#include <iomanip>
+#include <cstring>
+#include <stdexcept>
 #include <time.h>
 #include <unistd.h>
 
 #include "MessageFormat.hpp"
+#include "LogClock.hpp"
 #include "Utils.hpp"
 
 using namespace commonapistdoutlogger;
 
 namespace
 {
+    std::atomic<uint64_t> nextFormatterId(1U);
+
+    // RFC5424 默认前缀去掉 ident 后的典型长度, 用来一次性 reserve
+    constexpr size_t PREFIX_SIZE_HINT(96U);
 
     bool endsWithNewLine(const char* message, size_t size) noexcept
     {
         return ((size > 0) && (message[size - 1U] == '\n'));
     }
+}
 
+const char* commonapistdoutlogger::facilityToName(int facility) noexcept
+{
+    switch (facility & LOG_FACMASK)
+    {
+    case LOG_AUTH:
+        return "auth";
+    case LOG_AUTHPRIV:
+        return "authpriv";
+    case LOG_CRON:
+        return "cron";
+    case LOG_DAEMON:
+        return "daemon";
+    case LOG_FTP:
+        return "ftp";
+    case LOG_KERN:
+        return "kern";
+    case LOG_LOCAL0:
+        return "local0";
+    case LOG_LOCAL1:
+        return "local1";
+    case LOG_LOCAL2:
+        return "local2";
+    case LOG_LOCAL3:
+        return "local3";
+    case LOG_LOCAL4:
+        return "local4";
+    case LOG_LOCAL5:
+        return "local5";
+    case LOG_LOCAL6:
+        return "local6";
+    case LOG_LOCAL7:
+        return "local7";
+    case LOG_LPR:
+        return "lpr";
+    case LOG_MAIL:
+        return "mail";
+    case LOG_NEWS:
+        return "news";
+    case LOG_SYSLOG:
+        return "syslog";
+    case LOG_USER:
+        return "user";
+    case LOG_UUCP:
+        return "uucp";
+    }
+
+    return nullptr;
+}
 
-    std::string facilityToName(int facility) noexcept
+const char* commonapistdoutlogger::levelToName(int level) noexcept
+{
+    switch (LOG_PRI(level))
     {
-        switch (facility & LOG_FACMASK)
-        {
-        case LOG_AUTH:
-            return "auth";
-        case LOG_AUTHPRIV:
-            return "authpriv";
-        case LOG_CRON:
-            return "cron";
-        case LOG_DAEMON:
-            return "daemon";
-        case LOG_FTP:
-            return "ftp";
-        case LOG_KERN:
-            return "kern";
-        case LOG_LOCAL0:
-            return "local0";
-        case LOG_LOCAL1:
-            return "local1";
-        case LOG_LOCAL2:
-            return "local2";
-        case LOG_LOCAL3:
-            return "local3";
-        case LOG_LOCAL4:
-            return "local4";
-        case LOG_LOCAL5:
-            return "local5";
-        case LOG_LOCAL6:
-            return "local6";
-        case LOG_LOCAL7:
-            return "local7";
-        case LOG_LPR:
-            return "lpr";
-        case LOG_MAIL:
-            return "mail";
-        case LOG_NEWS:
-            return "news";
-        case LOG_SYSLOG:
-            return "syslog";
-        case LOG_USER:
-            return "user";
-        case LOG_UUCP:
-            return "uucp";
-        }
+        case LOG_EMERG:
+            return "emerg";
+        case LOG_ALERT:
+            return "alert";
+        case LOG_CRIT:
+            return "crit";
+        case LOG_ERR:
+            return "err";
+        case LOG_WARNING:
+            return "warning";
+        case LOG_NOTICE:
+            return "notice";
+        case LOG_INFO:
+            return "info";
+        case LOG_DEBUG:
+            return "debug";
+    }
+
+    ::dprintf(STDERR_FILENO,  "missing switch-case for: %d ",  LOG_PRI(level));
+    ::abort();
+}
 
-        return std::to_string(facility);
+namespace
+{
+    template<typename IntegerType>
+    void appendNumber(std::string& out, IntegerType value)
+    {
+        char buffer[24];
+        const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        out.append(buffer, result.ptr);
     }
 
-    std::string levelToName(int level) noexcept
+    void appendPadded(std::string& out, long value, size_t width)
     {
-        switch (LOG_PRI(level))
+        char buffer[24];
+        const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        const size_t length = result.ptr - buffer;
+        if(length < width)
         {
-            case LOG_EMERG:
-                return "emerg";
-            case LOG_ALERT:
-                return "alert";
-            case LOG_CRIT:
-                return "crit";
-            case LOG_ERR:
-                return "err";
-            case LOG_WARNING:
-                return "warning";
-            case LOG_NOTICE:
-                return "notice";
-            case LOG_INFO:
-                return "info";
-            case LOG_DEBUG:
-                return "debug";
+            out.append(width - length, '0');
         }
+        out.append(buffer, length);
+    }
 
-        ::dprintf(STDERR_FILENO,  "missing switch-case for: %d ",  LOG_PRI(level));
-        ::abort();
+    // +hh:mm 形式的时区偏移
+    void appendTimezone(std::string& out, const struct tm& tm)
+    {
+        long offset = tm.tm_gmtoff / 60;
+        out += (offset < 0) ? '-' : '+';
+        if(offset < 0)
+        {
+            offset = -offset;
+        }
+        appendPadded(out, offset / 60, 2);
+        out += ':';
+        appendPadded(out, offset % 60, 2);
     }
 }
 
-MessageFormatter::MessageFormatter(const std::string& prefixFormat):prefixFormat(prefixFormat)
+/*
+ * 同一秒内 localtime_r (需要 glibc 的时区锁) 和 strftime 的结果都不变,
+ * 所以每个线程按秒缓存一份, 每条日志只需要补上 $3/$6/$9 的亚秒部分.
+ * 缓存是 thread_local 的, 读取不需要任何锁; formatterId 区分不同的 MessageFormatter 实例.
+ */
+struct MessageFormatter::TimeCache
 {
+    uint64_t formatterId = 0U;
+    time_t second = -1;
+    std::string text;                               /* 所有 STRFTIME token 的渲染结果依次拼接 */
+    std::vector<std::pair<size_t, size_t>> spans;   /* 每个 STRFTIME token 在 text 中的 (offset, length) */
+    std::string timezone;                           /* $z, +hh:mm */
+};
 
+MessageFormatter::MessageFormatter(const std::string& prefixFormat):
+                  id(nextFormatterId++),
+                  prefixFormat(prefixFormat),
+                  program(compile(prefixFormat)),
+                  hostNames(nullptr)
+{
+    refreshHostNames();
 }
 
 MessageFormatter::~MessageFormatter()
 {
 }
 
-std::string MessageFormatter::formatPrefix(int priority, const std::string& ident, pid_t pid, const struct timeval& t, const struct tm& tm)
+/*
+ * 把 prefixFormat 一次性编译成 token 序列:
+ *   $x          -> 对应的字段 token
+ *   %x 及字面量  -> 相邻的合并成一个 STRFTIME token, 没有任何转换符时退化为 LITERAL
+ * 这样每条日志只需要按 token 顺序追加, 不再逐字符解析, 也不再对整个前缀再跑一遍 strftime.
+ */
+MessageFormatter::Program MessageFormatter::compile(const std::string& prefixFormat)
 {
-    std::ostringstream preformattedPrefix;
+    Program program;
+    std::string pending;            // strftime 语法的待定片段, 字面量 '%' 以 "%%" 保存
+    bool pendingConverts(false);
+
+    size_t slots(0U);
+
+    const auto flush = [&program, &pending, &pendingConverts, &slots]()
+    {
+        if(pending.empty())
+        {
+            return;
+        }
+
+        if(pendingConverts)
+        {
+            program.push_back({Operation::STRFTIME, pending, slots++});
+        }else
+        {
+            std::string literal;
+            for(size_t i = 0; i < pending.size(); i++)
+            {
+                literal += pending[i];
+                if(pending[i] == '%')
+                {
+                    i++;
+                }
+            }
+            program.push_back({Operation::LITERAL, literal, 0U});
+        }
+
+        pending.clear();
+        pendingConverts = false;
+    };
+
+    const auto add = [&program, &flush](Operation operation)
+    {
+        flush();
+        program.push_back({operation, {}, 0U});
+    };
 
     for(auto i = prefixFormat.begin(); i != prefixFormat.end(); i++)
     {
@@ -114,73 +220,212 @@ std::string MessageFormatter::formatPrefix(int priority, const std::string& iden
             i++;
             if(i == prefixFormat.end())
             {
-                throw " Invalid prefix format " ;
+                throw std::runtime_error("invalid prefix format: trailing '$' in \"" + prefixFormat + "\"");
             }
 
             switch (*i)
             {
-            case 'f': preformattedPrefix << (priority & LOG_FACMASK); break;
-            case 'F': preformattedPrefix << facilityToName(priority); break;
-            case 'l': preformattedPrefix << LOG_PRI(priority); break;
-            case 'L': preformattedPrefix << levelToName(priority); break;
-            case 'r': preformattedPrefix << priority; break;
-            case 'h': preformattedPrefix << getLogHostname(); break;
-            case 'H': preformattedPrefix << getLogFqd(); break;
-            case 'i': preformattedPrefix << ident; break;
-            case 'p': preformattedPrefix << pid; break;
-            case 'z':
+            case 'f': add(Operation::FACILITY); break;
+            case 'F': add(Operation::FACILITY_NAME); break;
+            case 'l': add(Operation::LEVEL); break;
+            case 'L': add(Operation::LEVEL_NAME); break;
+            case 'r': add(Operation::PRIORITY); break;
+            case 'h': add(Operation::HOSTNAME); break;
+            case 'H': add(Operation::FQDN); break;
+            case 'i': add(Operation::IDENT); break;
+            case 'p': add(Operation::PID); break;
+            case 'z': add(Operation::TIMEZONE); break;
+            case '3': add(Operation::MILLISECONDS); break;
+            case '6': add(Operation::MICROSECONDS); break;
+            case '9': add(Operation::NANOSECONDS); break;
+            case '$': pending += '$'; break;
+            default:
+                throw std::runtime_error(std::string("invalid prefix format: unknown conversion $") + *i + " in \"" + prefixFormat + "\"");
+            }
+        }else if(*i == '%')
+        {
+            // %[flags][width][E|O]conversion, 结尾孤立的 '%' 当作字面量
+            auto end = i + 1;
+            while((end != prefixFormat.end()) && (std::strchr("_-0^#", *end) != nullptr))
+            {
+                end++;
+            }
+            while((end != prefixFormat.end()) && std::isdigit(static_cast<unsigned char>(*end)))
             {
-                char tz[7] = {0};
-                ::strftime(tz, sizeof(tz), "%z", &tm);
-                preformattedPrefix << tz[0] << tz[1] << tz[2] << ':' << tz[3] << tz[4];
-                break;
+                end++;
             }
-            case '3': preformattedPrefix << std::setfill('0') << std::setw(3) << (t.tv_usec / 1000); break;
-            case '6': preformattedPrefix << std::setfill('0') << std::setw(6) << t.tv_usec; break;
-            case '$': preformattedPrefix << '$'; break;
-            default: throw " Invalid prefix format " ;
+            if((end != prefixFormat.end()) && ((*end == 'E') || (*end == 'O')))
+            {
+                end++;
             }
+
+            if(end == prefixFormat.end())
+            {
+                pending += "%%";
+                i = end - 1;
+                continue;
+            }
+
+            pending.append(i, end + 1);
+            if(*end != '%')
+            {
+                pendingConverts = true;
+            }
+            i = end;
         }else
         {
-            preformattedPrefix << *i;
+            pending += *i;
         }
     }
 
-    return preformattedPrefix.str();
+    flush();
+
+    return program;
 }
 
-std::string MessageFormatter::createMessage(const std::string& ident, pid_t pid, int facility, int priority, const char* message, size_t size)
+void MessageFormatter::refreshHostNames()
+{
+    auto names = std::make_unique<const HostNames>(HostNames{getLogHostname(), getLogFqd()});
+
+    const std::lock_guard<std::mutex> lock(hostNamesLock);
+
+    const auto current = hostNames.load(std::memory_order_relaxed);
+    if((current != nullptr) && (current->hostname == names->hostname) && (current->fqdn == names->fqdn))
+    {
+        return;
+    }
+
+    hostNames.store(names.get(), std::memory_order_release);
+    publishedHostNames.push_back(std::move(names));
+}
+
+const MessageFormatter::TimeCache& MessageFormatter::getTimeCache(time_t second) const
+{
+    static thread_local TimeCache timeCache;
+
+    if((timeCache.formatterId == id) && (timeCache.second == second))
+    {
+        return timeCache;
+    }
+
+    struct tm tm = {};
+    ::localtime_r(&second, &tm);
+
+    timeCache.formatterId = id;
+    timeCache.second = second;
+    timeCache.text.clear();
+    timeCache.spans.clear();
+    for(const auto& token : program)
+    {
+        if(token.operation == Operation::STRFTIME)
+        {
+            char buffer[256];
+            const size_t length = ::strftime(buffer, sizeof(buffer), token.text.c_str(), &tm);
+            timeCache.spans.emplace_back(timeCache.text.size(), length);
+            timeCache.text.append(buffer, length);
+        }
+    }
+    timeCache.timezone.clear();
+    appendTimezone(timeCache.timezone, tm);
+
+    return timeCache;
+}
+
+void MessageFormatter::formatPrefix(std::string& out, int priority, const std::string& ident, pid_t pid, const struct timespec& t, const TimeCache& timeCache, const HostNames& names) const
+{
+    for(const auto& token : program)
+    {
+        switch (token.operation)
+        {
+        case Operation::LITERAL: out += token.text; break;
+        case Operation::STRFTIME:
+        {
+            const auto& span = timeCache.spans[token.slot];
+            out.append(timeCache.text, span.first, span.second);
+            break;
+        }
+        case Operation::FACILITY: appendNumber(out, priority & LOG_FACMASK); break;
+        case Operation::FACILITY_NAME:
+        {
+            if(const char* name = facilityToName(priority))
+            {
+                out += name;
+            }else
+            {
+                appendNumber(out, priority & LOG_FACMASK);
+            }
+            break;
+        }
+        case Operation::LEVEL: appendNumber(out, LOG_PRI(priority)); break;
+        case Operation::LEVEL_NAME: out += levelToName(priority); break;
+        case Operation::PRIORITY: appendNumber(out, priority); break;
+        case Operation::HOSTNAME: out += names.hostname; break;
+        case Operation::FQDN: out += names.fqdn; break;
+        case Operation::IDENT: out += ident; break;
+        case Operation::PID: appendNumber(out, pid); break;
+        case Operation::TIMEZONE: out += timeCache.timezone; break;
+        case Operation::MILLISECONDS: appendPadded(out, t.tv_nsec / 1000000, 3); break;
+        case Operation::MICROSECONDS: appendPadded(out, t.tv_nsec / 1000, 6); break;
+        case Operation::NANOSECONDS: appendPadded(out, t.tv_nsec, 9); break;
+        }
+    }
+}
+
+void MessageFormatter::renderPrefix(std::string& out, int priority, const std::string& ident, pid_t pid, const struct timespec& t,
+                                    const std::string& hostname, const std::string& fqdn) const
+{
+    formatPrefix(out, priority, ident, pid, t, getTimeCache(t.tv_sec), HostNames{hostname, fqdn});
+}
+
+void MessageFormatter::appendPrefix(std::string& out, int priority, const std::string& ident, pid_t pid, const struct timespec& t) const
+{
+    formatPrefix(out, priority, ident, pid, t, getTimeCache(t.tv_sec), getHostNames());
+}
+
+void MessageFormatter::createFragments(std::string& buffer, MessageFragments& fragments, const std::string& ident, pid_t pid, int facility, int priority, const char* message, size_t size)
 {
+    static const char newLine('\n');
+
     if((priority & LOG_FACMASK) == 0)
     {
         priority |= facility;
     }
 
-    struct timeval t;
-    ::gettimeofday(&t, nullptr);
-    struct tm tm = {};
-    ::localtime_r(&t.tv_sec, &tm);
+    struct timespec t;
+    getLogTime(t);
 
-    std::string preformattedPrefix = formatPrefix(priority, ident, pid, t, tm);
+    buffer.clear();
+    formatPrefix(buffer, priority, ident, pid, t, getTimeCache(t.tv_sec), *hostNames.load(std::memory_order_acquire));
 
-    char prefix[256] = {};
-    
-    const size_t prefixSize = strftime(prefix, sizeof(prefix), preformattedPrefix.c_str(), &tm);
+    fragments.iov[0] = {const_cast<char*>(buffer.data()), buffer.size()};
+    fragments.iov[1] = {const_cast<char*>(message), size};
+    fragments.count = 2;
 
-    const bool addNewLine = endsWithNewLine(message, size);
+    if(!endsWithNewLine(message, size))
+    {
+        fragments.iov[fragments.count++] = {const_cast<char*>(&newLine), 1U};
+    }
+}
 
-    std::string ret;
+bool MessageFormatter::createContext(std::string&, const std::string&, pid_t, const struct timespec&) const
+{
+    return false;
+}
+
+std::string MessageFormatter::createMessage(const std::string& ident, pid_t pid, int facility, int priority, const char* message, size_t size)
+{
+    std::string prefix;
+    prefix.reserve(PREFIX_SIZE_HINT + ident.size());
 
-    ret.reserve(prefixSize + size + (addNewLine ? 1 : 0));
-    
-    ret += std::string_view(prefix, prefixSize);
-    ret += std::string_view(message, size);
+    MessageFragments fragments;
+    createFragments(prefix, fragments, ident, pid, facility, priority, message, size);
 
-    if(addNewLine)
+    std::string ret;
+    ret.reserve(prefix.size() + size + 1U);
+    for(int i = 0; i < fragments.count; i++)
     {
-        ret += '\n';
+        ret.append(static_cast<const char*>(fragments.iov[i].iov_base), fragments.iov[i].iov_len);
     }
 
     return ret;
 }
-
@@ -1,9 +1,12 @@
 #include <algorithm>
+#include <cinttypes>
+#include <cstdio>
 #include <sstream>
 
 #include "NullLogger.hpp"
 #include "MessageRouter.hpp"
 #include "MessageFormat.hpp"
+#include "SignalRegistration.hpp"
 
 using namespace commonapistdoutlogger;
 
@@ -11,25 +14,29 @@ namespace
 {
     constexpr bool ONLY_STDOUT(true);
 
+    // stdout, stderr 之后的第一个 extraSinks
+    constexpr size_t FIRST_EXTRA_SINK(2U);
+
     bool isBadFacility(int priority) noexcept
     {
         return (LOG_FAC(priority) >= LOG_NFACILITIES);
     }
 
-    bool isIncludeLevel(const Configuration& configuration, int level) noexcept
+    bool isIncludeLevel(const SyslogLevels& levels, int level) noexcept
     {
-        return (std::find(configuration.includeLevels.cbegin(), configuration.includeLevels.cend(), level) != configuration.includeLevels.end());
+        return (std::find(levels.cbegin(), levels.cend(), level) != levels.cend());
     }
 
-    bool isIncludedFacility(const Configuration& configuration, int facility) noexcept
+    bool isIncludedFacility(const SyslogFacilities& facilities, int facility) noexcept
     {
 
-        return ((facility == LOG_KERN) || (std::find(configuration.includeFacilities.cbegin(),
-                configuration.includeFacilities.cend(),
-                facility) != configuration.includeFacilities.cend()));
+        return ((facility == LOG_KERN) || (std::find(facilities.cbegin(),
+                facilities.cend(),
+                facility) != facilities.cend()));
     }
 
-    MessageRouter::MessageTargets createMessageTargetArray(const Configuration& configuration, bool onlySTDOUT = false) noexcept
+    template<typename SinkFilters>
+    MessageRouter::MessageTargets createMessageTargetArray(const Configuration& configuration, const SinkFilters& extraSinks, bool onlySTDOUT)
     {
         MessageRouter::MessageTargets targets{};
         for(size_t i = 0; i < targets.size(); i++)
@@ -37,14 +44,22 @@ namespace
             const int level = LOG_PRI(i);
             const int facility = (i & LOG_FACMASK);
 
-            if(isIncludedFacility(configuration, facility) && isIncludeLevel(configuration, level))
+            if(isIncludedFacility(configuration.includeFacilities, facility) && isIncludeLevel(configuration.includeLevels, level))
             {
                 if(!(onlySTDOUT) && (level <= configuration.minErrLevel))
                 {
-                    targets[i] = MessageRouter::MessageTarget::STDERR;
+                    targets[i] |= MessageRouter::STDERR_SINK;
                 }else
                 {
-                    targets[i] = MessageRouter::MessageTarget::STDOUT;
+                    targets[i] |= MessageRouter::STDOUT_SINK;
+                }
+            }
+
+            for(size_t sink = 0; sink < extraSinks.size(); sink++)
+            {
+                if(isIncludedFacility(extraSinks[sink].includeFacilities, facility) && isIncludeLevel(extraSinks[sink].includeLevels, level))
+                {
+                    targets[i] |= (1U << (FIRST_EXTRA_SINK + sink));
                 }
             }
         }
@@ -52,7 +67,64 @@ namespace
         return targets;
     }
 
-    bool checkFacility(int defaultFacility)
+    std::vector<std::unique_ptr<LogWriter>> createSinks(std::unique_ptr<LogWriter> stdoutLogger, std::unique_ptr<LogWriter> stderrLogger, std::vector<MessageSink>& extraSinks)
+    {
+        if(FIRST_EXTRA_SINK + extraSinks.size() > MessageRouter::MAX_SINKS)
+        {
+            std::ostringstream os;
+            os << "too many sinks: " << extraSinks.size() << ", at most " << (MessageRouter::MAX_SINKS - FIRST_EXTRA_SINK) << " are supported";
+            throw std::runtime_error(os.str());
+        }
+
+        std::vector<std::unique_ptr<LogWriter>> sinks;
+        sinks.push_back(std::move(stdoutLogger));
+        sinks.push_back(std::move(stderrLogger));
+        for(auto& sink : extraSinks)
+        {
+            sinks.push_back(std::move(sink.logger));
+        }
+        return sinks;
+    }
+
+    std::unique_ptr<RateLimiter> createRateLimiter(const Configuration& configuration)
+    {
+        if(!configuration.rateLimit.enabled())
+        {
+            return nullptr;
+        }
+        return std::make_unique<RateLimiter>(configuration.rateLimit);
+    }
+
+    std::unique_ptr<DuplicateFilter> createDuplicateFilter(const Configuration& configuration)
+    {
+        if(configuration.repeatInterval <= 0)
+        {
+            return nullptr;
+        }
+        return std::make_unique<DuplicateFilter>(std::chrono::seconds(configuration.repeatInterval));
+    }
+
+    std::unique_ptr<MessageSanitizer> createSanitizer(const Configuration& configuration)
+    {
+        if(configuration.sanitize == 0U)
+        {
+            return nullptr;
+        }
+        return std::make_unique<MessageSanitizer>(configuration.sanitize);
+    }
+
+    // 格式有上下文记录时, 每个 sink 一个最近一次输出它的秒数; 否则为空
+    std::unique_ptr<std::atomic<time_t>[]> createContextSeconds(const MessageFormatter& formatter, const std::string& ident, pid_t pid, size_t sinkCount)
+    {
+        std::string context;
+        if(!formatter.createContext(context, ident, pid, {}))
+        {
+            return nullptr;
+        }
+        return std::make_unique<std::atomic<time_t>[]>(sinkCount);
+    }
+
+    int checkFacility(int defaultFacility)
     {
         if(defaultFacility < 0 || (defaultFacility >= (LOG_NFACILITIES << 3)))
         {
@@ -75,15 +147,10 @@ MessageRouter::MessageRouter(std::unique_ptr<MessageFormatter> messageFormatter,
                     int facility,
                     pid_t pid,
                     Configuration&& configuration,
-                    std::unique_ptr<LogWriter> logger):
-                    messageTargets(createMessageTargetArray(configuration, ONLY_STDOUT)),
-                    messageFormatter(std::move(messageFormatter)),
-                    ident(ident),
-                    defaultFacility(checkFacility(facility)),
-                    pid(pid),
-                    configuration(std::move(configuration)),
-                    stdoutLogger(std::move(logger)),
-                    stderrLogger(std::make_unique<NullLogger>())
+                    std::unique_ptr<LogWriter> logger,
+                    std::vector<MessageSink> extraSinks):
+                    MessageRouter(std::move(messageFormatter), ident, facility, pid, std::move(configuration),
+                                  std::move(logger), std::make_unique<NullLogger>(), std::move(extraSinks), ONLY_STDOUT)
 {
 }              
 
@@ -93,25 +160,72 @@ MessageRouter::MessageRouter(std::unique_ptr<MessageFormatter> messageFormatter,
                    pid_t pid,
                    Configuration&& configuration,
                    std::unique_ptr<LogWriter> stdoutLogger,
-                   std::unique_ptr<LogWriter> stderrLogger):
-                   messageTargets(createMessageTargetArray(configuration, ONLY_STDOUT)),
+                   std::unique_ptr<LogWriter> stderrLogger,
+                   std::vector<MessageSink> extraSinks):
+                   MessageRouter(std::move(messageFormatter), ident, facility, pid, std::move(configuration),
+                                 std::move(stdoutLogger), std::move(stderrLogger), std::move(extraSinks), !ONLY_STDOUT)
+{
+
+}
+
+MessageRouter::MessageRouter(std::unique_ptr<MessageFormatter> messageFormatter,
+                   const std::string& ident,
+                   int facility,
+                   pid_t pid,
+                   Configuration&& configuration,
+                   std::unique_ptr<LogWriter> stdoutLogger,
+                   std::unique_ptr<LogWriter> stderrLogger,
+                   std::vector<MessageSink>&& extraSinks,
+                   bool onlyStdout):
+                   messageTargets(nullptr),
+                   onlyStdout(onlyStdout),
                    messageFormatter(std::move(messageFormatter)),
                    ident(ident),
                    defaultFacility(checkFacility(facility)),
                    pid(pid),
                    configuration(std::move(configuration)),
-                   stdoutLogger(std::move(stdoutLogger)),
-                   stderrLogger(std::move(stderrLogger))
+                   sinks(createSinks(std::move(stdoutLogger), std::move(stderrLogger), extraSinks)),
+                   rateLimiter(createRateLimiter(this->configuration)),
+                   duplicateFilter(createDuplicateFilter(this->configuration)),
+                   sanitizer(createSanitizer(this->configuration)),
+                   sinkStatistics(std::make_unique<Statistics[]>(sinks.size())),
+                   contextSeconds(createContextSeconds(*this->messageFormatter, ident, pid, sinks.size()))
+{
+    for(const auto& sink : extraSinks)
+    {
+        extraSinkFilters.push_back({sink.includeLevels, sink.includeFacilities});
+    }
+
+    reloadFilters(this->configuration);
+
+    // writer 报告丢弃等情况时使用和普通日志相同的前缀 (ident, pid, 时间)
+    for(const auto& sink : sinks)
+    {
+        sink->setNoticeFormatter([this](int priority, const std::string& message) { return formatNotice(priority, message); });
+    }
+}
+
+MessageRouter::~MessageRouter()
+{
+    reportRepeats(true);
+    reportSuppressed();
+}
 
+void MessageRouter::reloadFilters(const Configuration& filters)
 {
+    auto targets = std::make_unique<const MessageTargets>(createMessageTargetArray(filters, extraSinkFilters, onlyStdout));
 
+    const std::lock_guard<std::mutex> lock(messageTargetsLock);
+    messageTargets.store(targets.get(), std::memory_order_release);
+    publishedTargets.push_back(std::move(targets));
 }
 
-MessageRouter::MessageTarget MessageRouter::getMessageTarget(int priority) const noexcept
+MessageRouter::SinkMask MessageRouter::getMessageTargets(int priority, const char* message, size_t size)
 {
-    if(isBadFacility(priority) || priority < 0 || static_cast<size_t>(priority) >= messageTargets.size())
+    if(isBadFacility(priority) || priority < 0 || static_cast<size_t>(priority) >= std::tuple_size<MessageTargets>::value)
     {
-        return MessageTarget::DROPPED;
+        statistics.add(Statistics::FILTERED);
+        return 0U;
     }
 
     if(!(priority & LOG_FACMASK))
@@ -119,51 +233,298 @@ MessageRouter::MessageTarget MessageRouter::getMessageTarget(int priority) const
         priority |= defaultFacility;
     }
 
-    return messageTargets[priority];
-}
+    const SinkMask targets = (*messageTargets.load(std::memory_order_acquire))[priority];
+    if(targets == 0U)
+    {
+        statistics.add(Statistics::FILTERED);
+        return targets;
+    }
 
-bool MessageRouter::isStderrMessage(int messagePriority) const noexcept
-{
-    return ((messagePriority & LOG_PRIMASK) <= configuration.minErrLevel);
+    // 重复的消息在限速之前折叠, 不消耗令牌
+    if(duplicateFilter && isRepeated(priority, message, size))
+    {
+        statistics.add(Statistics::REPEATED);
+        return 0U;
+    }
+
+    if(rateLimiter && !rateLimiter->allow(priority))
+    {
+        statistics.add(Statistics::RATE_LIMITED);
+        return 0U;
+    }
+
+    return targets;
 }
 
-std::string MessageRouter::createMessage(int priority, const char* message, size_t size)
+void MessageRouter::createMessage(std::string& buffer, MessageFragments& fragments, int priority, const char* message, size_t size)
 {
-    return messageFormatter->createMessage(ident, pid, defaultFacility, priority, message, size);
+    messageFormatter->createFragments(buffer, fragments, ident, pid, defaultFacility, priority, message, size);
 }
 
 void MessageRouter::write(int priority, const char* message, size_t size)
 {
-    switch (getMessageTarget(priority))
+    const SinkMask targets = getMessageTargets(priority, message, size);
+    if(targets == 0U)
+    {
+        return;
+    }
+
+    if(sanitizer && sanitizer->needsSanitizing(message, size))
     {
-    case MessageTarget::DROPPED:
-        break;
-    case MessageTarget::STDERR:
-        stderrLogger->write(createMessage(priority, message, size));
-        break;
-    case MessageTarget::STDOUT:
-        stdoutLogger->write(createMessage(priority, message, size));
-        break;
+        writeSanitized(targets, priority, message, size, false);
+        return;
     }
+
+    writeToSinks(targets, priority, message, size, false);
 }
 
 void MessageRouter::writeAsync(int priority, const char* message, size_t size)
 {
-    switch (getMessageTarget(priority))
+    const SinkMask targets = getMessageTargets(priority, message, size);
+    if(targets == 0U)
+    {
+        return;
+    }
+
+    if(sanitizer && sanitizer->needsSanitizing(message, size))
+    {
+        writeSanitized(targets, priority, message, size, true);
+        return;
+    }
+
+    writeToSinks(targets, priority, message, size, true);
+}
+
+// 前缀渲染到线程私有的 buffer (容量复用, 稳态下不分配内存), 消息体以 iovec 直接交给 writer
+void MessageRouter::writeToSinks(SinkMask targets, int priority, const char* message, size_t size, bool async)
+{
+    static thread_local std::string buffer;
+    MessageFragments fragments;
+
+    createMessage(buffer, fragments, priority, message, size);
+    for(; targets != 0U; targets &= (targets - 1U))
+    {
+        const size_t sink = __builtin_ctz(targets);
+        if(!sinks[sink]->isAccepted(priority))
+        {
+            continue;
+        }
+
+        sinkStatistics[sink].add(Statistics::ROUTED);
+        writeFragments(sink, fragments, async);
+    }
+}
+
+// 上下文记录和这一秒的第一条记录放在同一次写出里, 每个 sink (和它切分出的每个文件) 都能单独解码;
+// 经过队列时其它线程同一秒的记录可能排在它前面, 由解码器暂存到 CONTEXT 出现
+void MessageRouter::writeFragments(size_t sink, const MessageFragments& fragments, bool async)
+{
+    const struct iovec* iov = fragments.iov;
+    int count = fragments.count;
+    struct iovec withContext[MessageFragments::MAX_FRAGMENTS + 1];
+
+    if(contextSeconds)
+    {
+        static thread_local std::string context;
+        struct timespec now;
+        ::clock_gettime(CLOCK_REALTIME_COARSE, &now);
+
+        std::atomic<time_t>& last = contextSeconds[sink];
+        if((last.load(std::memory_order_relaxed) != now.tv_sec) && (last.exchange(now.tv_sec, std::memory_order_relaxed) != now.tv_sec) &&
+           messageFormatter->createContext(context, ident, pid, now))
+        {
+            withContext[0] = {const_cast<char*>(context.data()), context.size()};
+            std::copy(fragments.iov, fragments.iov + fragments.count, withContext + 1);
+            iov = withContext;
+            count++;
+        }
+    }
+
+    if(async)
+    {
+        sinks[sink]->writeAsync(iov, count);
+    }else
     {
-    case MessageTarget::DROPPED:
-        break;
-    case MessageTarget::STDERR:
-        stderrLogger->writeAsync(createMessage(priority, message, size));
-        break;
-    case MessageTarget::STDOUT:
-       stdoutLogger->writeAsync(createMessage(priority, message, size));
-       break;
+        sinks[sink]->write(iov, count);
     }
 }
 
+// 处理后的消息体放在线程私有的缓存里, 拆分出的每一行作为一条独立的记录按顺序写出
+void MessageRouter::writeSanitized(SinkMask targets, int priority, const char* message, size_t size, bool async)
+{
+    static thread_local MessageSanitizer::Lines lines;
+
+    sanitizer->sanitize(message, size, lines);
+    for(const auto& span : lines.spans)
+    {
+        writeToSinks(targets, priority, lines.text.data() + span.first, span.second, async);
+    }
+}
+
+void MessageRouter::setReloadSignal(std::unique_ptr<SignalRegistration> registration)
+{
+    reloadSignal = std::move(registration);
+}
+
+void MessageRouter::refreshHostNames()
+{
+    messageFormatter->refreshHostNames();
+}
+
+void MessageRouter::reportSuppressed()
+{
+    if(!rateLimiter)
+    {
+        return;
+    }
+
+    for(size_t slot = 0; slot < RateLimiter::SLOTS; slot++)
+    {
+        const uint64_t suppressed = rateLimiter->takeSuppressed(slot);
+        if(suppressed == 0U)
+        {
+            continue;
+        }
+
+        char message[128];
+        const int size = snprintf(message, sizeof(message), "rate limit exceeded, suppressed %" PRIu64 " messages of facility %d level %d",
+                                  suppressed, static_cast<int>(LOG_FAC(slot)), static_cast<int>(LOG_PRI(slot)));
+        writeNotice(slot, message, size);
+    }
+}
+
+void MessageRouter::reportRepeats()
+{
+    reportRepeats(false);
+}
+
+void MessageRouter::reportRepeats(bool all)
+{
+    if(!duplicateFilter)
+    {
+        return;
+    }
+
+    for(const auto& repeats : duplicateFilter->takeStale(all))
+    {
+        writeRepeats(repeats);
+    }
+}
+
+bool MessageRouter::isRepeated(int priority, const char* message, size_t size)
+{
+    DuplicateFilter::Repeats repeats;
+    const bool duplicate = duplicateFilter->isDuplicate(priority, message, size, repeats);
+    if(repeats.count > 0U)
+    {
+        writeRepeats(repeats);
+    }
+    return duplicate;
+}
+
+void MessageRouter::writeRepeats(const DuplicateFilter::Repeats& repeats)
+{
+    char message[64];
+    const int size = snprintf(message, sizeof(message), "last message repeated %" PRIu64 " times", repeats.count);
+    writeNotice(repeats.priority, message, size);
+}
+
+// 汇总写到原消息的目标, 本身不受限速和重复折叠; 和同一个线程之后的 write 保持顺序
+void MessageRouter::writeNotice(int priority, const char* message, size_t size)
+{
+    static thread_local std::string buffer;
+    MessageFragments fragments;
+
+    SinkMask targets = (*messageTargets.load(std::memory_order_acquire))[priority];
+    if(targets == 0U)
+    {
+        return;
+    }
+
+    createMessage(buffer, fragments, priority, message, size);
+    for(; targets != 0U; targets &= (targets - 1U))
+    {
+        writeFragments(__builtin_ctz(targets), fragments, true);
+    }
+}
+
+// 在 writer 的线程上调用, 提示很少, 每次分配一个新的 string
+std::string MessageRouter::formatNotice(int priority, const std::string& message)
+{
+    std::string buffer;
+    MessageFragments fragments;
+    createMessage(buffer, fragments, priority, message.data(), message.size());
+
+    std::string record;
+    for(int i = 0; i < fragments.count; i++)
+    {
+        record.append(static_cast<const char*>(fragments.iov[i].iov_base), fragments.iov[i].iov_len);
+    }
+    return record;
+}
+
+MessageRouter::RouterStatistics MessageRouter::getStatistics() const
+{
+    RouterStatistics ret;
+    ret.messages = statistics.getSnapshot();
+    for(size_t i = 0; i < sinks.size(); i++)
+    {
+        auto snapshot = sinkStatistics[i].getSnapshot();
+        if(const auto writerStatistics = sinks[i]->getStatistics())
+        {
+            snapshot += writerStatistics->getSnapshot();
+        }
+        ret.sinks.push_back(snapshot);
+    }
+    return ret;
+}
+
+// 汇总作为 syslog facility 的消息写出, 和其它提示一样受过滤表控制; 没有消息经过的 sink 不输出
+void MessageRouter::reportStatistics()
+{
+    const auto current = getStatistics();
+
+    char message[128];
+    const int size = snprintf(message, sizeof(message), "statistics: filtered %" PRIu64 ", rate limited %" PRIu64 ", repeated %" PRIu64,
+                              current.messages.counters[Statistics::FILTERED],
+                              current.messages.counters[Statistics::RATE_LIMITED],
+                              current.messages.counters[Statistics::REPEATED]);
+    writeNotice(LOG_SYSLOG | LOG_INFO, message, size);
+
+    for(size_t i = 0; i < current.sinks.size(); i++)
+    {
+        const auto& snapshot = current.sinks[i];
+        if((snapshot.counters[Statistics::ROUTED] == 0U) && (snapshot.counters[Statistics::WRITES] == 0U))
+        {
+            continue;
+        }
+
+        const std::string name = (i == 0U) ? "stdout" : ((i == 1U) ? "stderr" : ("sink" + std::to_string(i - FIRST_EXTRA_SINK)));
+        writeStatistics(name.c_str(), snapshot);
+    }
+}
+
+void MessageRouter::writeStatistics(const char* name, const Statistics::Snapshot& snapshot)
+{
+    const auto& counters = snapshot.counters;
+
+    char message[384];
+    const int size = snprintf(message, sizeof(message),
+                              "statistics %s: routed %" PRIu64 ", dropped %" PRIu64 ", writes %" PRIu64 ", bytes %" PRIu64
+                              ", short writes %" PRIu64 ", EAGAIN %" PRIu64 ", ENOSPC %" PRIu64 ", errors %" PRIu64
+                              ", retired fds %" PRIu64 ", latency p50 <%lldus p99 <%lldus",
+                              name, counters[Statistics::ROUTED], counters[Statistics::DROPPED], counters[Statistics::WRITES],
+                              counters[Statistics::BYTES], counters[Statistics::SHORT_WRITES], counters[Statistics::EAGAIN_ERRORS],
+                              counters[Statistics::ENOSPC_ERRORS], counters[Statistics::WRITE_ERRORS], counters[Statistics::RETIRED_FDS],
+                              static_cast<long long>(snapshot.getLatencyPercentile(50U).count()),
+                              static_cast<long long>(snapshot.getLatencyPercentile(99U).count()));
+    writeNotice(LOG_SYSLOG | LOG_INFO, message, std::min(static_cast<size_t>(size), sizeof(message) - 1U));
+}
+
 void MessageRouter::waitAllWriteAndCompleted()
 {
-    stdoutLogger->waitAllWriteAsyncsCompleted();
-    stderrLogger->waitAllWriteAsyncsCompleted();
+    for(const auto& sink : sinks)
+    {
+        sink->waitAllWriteAsyncsCompleted();
+    }
 }
@@ -0,0 +1,277 @@
+#include "MessageSanitizer.hpp"
+#include "Utils.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+using namespace commonapistdoutlogger;
+
+namespace
+{
+    constexpr char REPLACEMENT_CHARACTER[] = "\xEF\xBF\xBD";
+
+    bool isControl(unsigned char c) noexcept
+    {
+        return ((c < 0x20U) && (c != '\t')) || (c == 0x7fU);
+    }
+
+    size_t findSpecialScalar(const char* data, size_t size, size_t i, unsigned controlMask, unsigned highMask) noexcept
+    {
+        for(; i < size; i++)
+        {
+            const unsigned char c = static_cast<unsigned char>(data[i]);
+            if((isControl(c) && (controlMask != 0U)) || ((c >= 0x80U) && (highMask != 0U)))
+            {
+                return i;
+            }
+        }
+        return size;
+    }
+
+#if defined(__x86_64__)
+    /*
+     * 每个块返回命中位掩码: 控制字符 (max(c, 0x1f) == 0x1f 且不是制表符, 或者是 DEL) 和非 ASCII 字节 (最高位, 直接取 movemask).
+     * 和 JSON 转义一样, 末尾不足一个块时重叠着读最后一个块; 辅助函数总是内联, 在 AVX2 版本里是 VEX 编码.
+     */
+    __attribute__((always_inline)) inline unsigned getSpecialMask16(const char* p, unsigned controlMask, unsigned highMask) noexcept
+    {
+        const __m128i low = _mm_set1_epi8(0x1f);
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i control = _mm_or_si128(_mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(_mm_max_epu8(v, low), low)),
+                                             _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+        return (static_cast<unsigned>(_mm_movemask_epi8(control)) & controlMask) | (static_cast<unsigned>(_mm_movemask_epi8(v)) & highMask);
+    }
+
+    __attribute__((target("avx2"), always_inline)) inline unsigned getSpecialMask32(const char* p, unsigned controlMask, unsigned highMask) noexcept
+    {
+        const __m256i low = _mm256_set1_epi8(0x1f);
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        const __m256i control = _mm256_or_si256(_mm256_andnot_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')), _mm256_cmpeq_epi8(_mm256_max_epu8(v, low), low)),
+                                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7f)));
+        return (static_cast<unsigned>(_mm256_movemask_epi8(control)) & controlMask) | (static_cast<unsigned>(_mm256_movemask_epi8(v)) & highMask);
+    }
+
+    // data[0, i) 已经检查过, 剩下不到 16 字节
+    __attribute__((always_inline)) inline size_t findSpecialTail16(const char* data, size_t size, size_t i, unsigned controlMask, unsigned highMask) noexcept
+    {
+        if(i == size)
+        {
+            return size;
+        }
+
+        if(size < 16U)
+        {
+            return findSpecialScalar(data, size, i, controlMask, highMask);
+        }
+
+        const size_t start = size - 16U;
+        const unsigned mask = getSpecialMask16(data + start, controlMask, highMask) >> (i - start);
+        return (mask != 0U) ? (i + static_cast<size_t>(__builtin_ctz(mask))) : size;
+    }
+
+    size_t findSpecialSse2(const char* data, size_t size, unsigned controlMask, unsigned highMask) noexcept
+    {
+        size_t i(0U);
+        for(; i + 16U <= size; i += 16U)
+        {
+            const unsigned mask = getSpecialMask16(data + i, controlMask, highMask);
+            if(mask != 0U)
+            {
+                return i + static_cast<size_t>(__builtin_ctz(mask));
+            }
+        }
+        return findSpecialTail16(data, size, i, controlMask, highMask);
+    }
+
+    __attribute__((target("avx2")))
+    size_t findSpecialAvx2(const char* data, size_t size, unsigned controlMask, unsigned highMask) noexcept
+    {
+        size_t i(0U);
+        for(; i + 32U <= size; i += 32U)
+        {
+            const unsigned mask = getSpecialMask32(data + i, controlMask, highMask);
+            if(mask != 0U)
+            {
+                return i + static_cast<size_t>(__builtin_ctz(mask));
+            }
+        }
+
+        if((i == size) || (size < 32U))
+        {
+            if(i + 16U <= size)
+            {
+                const unsigned mask = getSpecialMask16(data + i, controlMask, highMask);
+                if(mask != 0U)
+                {
+                    return i + static_cast<size_t>(__builtin_ctz(mask));
+                }
+                i += 16U;
+            }
+            return findSpecialTail16(data, size, i, controlMask, highMask);
+        }
+
+        const size_t start = size - 32U;
+        const unsigned mask = getSpecialMask32(data + start, controlMask, highMask) >> (i - start);
+        return (mask != 0U) ? (i + static_cast<size_t>(__builtin_ctz(mask))) : size;
+    }
+
+    using FindSpecial = size_t (*)(const char*, size_t, unsigned, unsigned) noexcept;
+
+    FindSpecial selectFindSpecial() noexcept
+    {
+        return useAvx2() ? findSpecialAvx2 : findSpecialSse2;
+    }
+
+    const FindSpecial findSpecialBytes = selectFindSpecial();
+#else
+    size_t findSpecialBytes(const char* data, size_t size, unsigned controlMask, unsigned highMask) noexcept
+    {
+        return findSpecialScalar(data, size, 0U, controlMask, highMask);
+    }
+#endif
+
+    bool isContinuation(unsigned char c) noexcept
+    {
+        return (c & 0xc0U) == 0x80U;
+    }
+
+    // 从 p 开始的一个合法 UTF-8 多字节序列的长度, 不合法时返回 0
+    size_t getUtf8SequenceLength(const unsigned char* p, size_t size) noexcept
+    {
+        const unsigned char c = p[0];
+        size_t length;
+        unsigned char secondMin(0x80U);
+        unsigned char secondMax(0xbfU);
+
+        if((c >= 0xc2U) && (c <= 0xdfU))
+        {
+            length = 2U;
+        }else if((c >= 0xe0U) && (c <= 0xefU))
+        {
+            length = 3U;
+            if(c == 0xe0U)
+            {
+                secondMin = 0xa0U;      /* 过长编码 */
+            }else if(c == 0xedU)
+            {
+                secondMax = 0x9fU;      /* UTF-16 代理区 */
+            }
+        }else if((c >= 0xf0U) && (c <= 0xf4U))
+        {
+            length = 4U;
+            if(c == 0xf0U)
+            {
+                secondMin = 0x90U;      /* 过长编码 */
+            }else if(c == 0xf4U)
+            {
+                secondMax = 0x8fU;      /* 超过 U+10FFFF */
+            }
+        }else
+        {
+            return 0U;
+        }
+
+        if((size < length) || (p[1] < secondMin) || (p[1] > secondMax))
+        {
+            return 0U;
+        }
+
+        for(size_t i = 2U; i < length; i++)
+        {
+            if(!isContinuation(p[i]))
+            {
+                return 0U;
+            }
+        }
+        return length;
+    }
+
+    void appendEscaped(std::string& out, unsigned char c)
+    {
+        const char escaped[] = {'#', static_cast<char>('0' + (c >> 6)), static_cast<char>('0' + ((c >> 3) & 07U)), static_cast<char>('0' + (c & 07U))};
+        out.append(escaped, sizeof(escaped));
+    }
+
+    size_t stripTrailingNewLine(const char* message, size_t size) noexcept
+    {
+        return ((size > 0U) && (message[size - 1U] == '\n')) ? (size - 1U) : size;
+    }
+}
+
+MessageSanitizer::MessageSanitizer(unsigned modes):
+                  modes(modes),
+                  controlMask((modes & (ESCAPE_CONTROL | SPLIT_LINES)) ? ~0U : 0U),
+                  highMask((modes & REPLACE_INVALID_UTF8) ? ~0U : 0U)
+{
+}
+
+size_t MessageSanitizer::findSpecial(const char* data, size_t size) const noexcept
+{
+    return findSpecialBytes(data, size, controlMask, highMask);
+}
+
+bool MessageSanitizer::needsSanitizing(const char* message, size_t size) const noexcept
+{
+    size = stripTrailingNewLine(message, size);
+    return findSpecial(message, size) != size;
+}
+
+// 从第一个需要处理的字节开始逐个处理, 中间干净的片段仍然用 SIMD 跳过并整段拷贝
+void MessageSanitizer::sanitize(const char* message, size_t size, Lines& lines) const
+{
+    lines.text.clear();
+    lines.spans.clear();
+    size = stripTrailingNewLine(message, size);
+
+    size_t lineStart(0U);
+    const auto endLine = [&lines, &lineStart]()
+    {
+        if(lines.text.size() > lineStart)
+        {
+            lines.spans.emplace_back(lineStart, lines.text.size() - lineStart);
+        }
+        lineStart = lines.text.size();
+    };
+
+    size_t i(0U);
+    for(;;)
+    {
+        const size_t hit = i + findSpecial(message + i, size - i);
+        lines.text.append(message + i, hit - i);
+        if(hit == size)
+        {
+            break;
+        }
+
+        const unsigned char c = static_cast<unsigned char>(message[hit]);
+        i = hit + 1U;
+
+        if(c >= 0x80U)
+        {
+            const size_t length = getUtf8SequenceLength(reinterpret_cast<const unsigned char*>(message + hit), size - hit);
+            if(length > 0U)
+            {
+                lines.text.append(message + hit, length);
+                i = hit + length;
+            }else
+            {
+                lines.text.append(REPLACEMENT_CHARACTER, sizeof(REPLACEMENT_CHARACTER) - 1U);
+            }
+        }else if((modes & SPLIT_LINES) && (c == '\n'))
+        {
+            endLine();
+        }else if((modes & SPLIT_LINES) && (c == '\r') && (i < size) && (message[i] == '\n'))
+        {
+            // "\r\n" 和 '\n' 一样结束一行
+        }else if(modes & ESCAPE_CONTROL)
+        {
+            appendEscaped(lines.text, c);
+        }else
+        {
+            lines.text += static_cast<char>(c);
+        }
+    }
+
+    endLine();
+}
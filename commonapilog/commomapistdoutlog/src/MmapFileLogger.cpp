@@ -0,0 +1,282 @@
+#include "MmapFileLogger.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace commonapistdoutlogger;
+
+namespace
+{
+    // 每次映射的窗口大小, 必须是页大小的整数倍
+    constexpr uint64_t CHUNK_SIZE(4U * 1024U * 1024U);
+
+    // 每次 fallocate 预分配的长度
+    constexpr uint64_t EXTENT_SIZE(64U * 1024U * 1024U);
+
+    FileDescriptor reopenReadWrite(int fd)
+    {
+        const std::string path = "/proc/self/fd/" + std::to_string(fd);
+        const int ret = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if(ret < 0)
+        {
+            throw std::runtime_error(path + ": " + strerror(errno));
+        }
+
+        return {ret, true};
+    }
+
+    uint64_t getFileSize(int fd)
+    {
+        struct stat sb;
+        if(::fstat(fd, &sb) != 0)
+        {
+            throw std::runtime_error(std::string("fstat: ") + strerror(errno));
+        }
+
+        return static_cast<uint64_t>(sb.st_size);
+    }
+}
+
+MmapFileLogger::MmapFileLogger(const FileDescriptor& fd):
+                fd(reopenReadWrite(fd)),
+                start(getFileSize(this->fd)),
+                tail(start),
+                degraded(false),
+                allocated(start),
+                mappedEnd(0U)
+{
+    for(auto& window : windows)
+    {
+        window.chunk.store(0U, std::memory_order_relaxed);
+        window.base = nullptr;
+        window.filled.store(0U, std::memory_order_relaxed);
+    }
+
+    // 先映射第一个窗口, 文件系统不支持时由调用者换用 FileLogger
+    if(getWindow(start / CHUNK_SIZE) == nullptr)
+    {
+        throw std::runtime_error(std::string("fallocate/mmap: ") + strerror(errno));
+    }
+}
+
+MmapFileLogger::~MmapFileLogger()
+{
+    for(auto& window : windows)
+    {
+        if(window.chunk.load() != 0U)
+        {
+            ::munmap(window.base, CHUNK_SIZE);
+        }
+    }
+
+    // 去掉预分配但没有用到的部分
+    if(::ftruncate(fd, static_cast<off_t>(tail.load())) != 0)
+    {
+        std::cerr << "ftruncate: " << strerror(errno) << std::endl;
+    }
+}
+
+void MmapFileLogger::write(const std::string& message)
+{
+    const struct iovec iov = {const_cast<char*>(message.data()), message.size()};
+    write(&iov, 1);
+}
+
+void MmapFileLogger::writeAsync(const std::string& message)
+{
+    const struct iovec iov = {const_cast<char*>(message.data()), message.size()};
+    write(&iov, 1);
+}
+
+// 写入只是一次内存拷贝, 同步和异步没有区别
+void MmapFileLogger::writeAsync(const struct iovec* iov, int count)
+{
+    write(iov, count);
+}
+
+void MmapFileLogger::write(const struct iovec* iov, int count)
+{
+    size_t size(0U);
+    for(int i = 0; i < count; i++)
+    {
+        size += iov[i].iov_len;
+    }
+
+    if(size == 0U)
+    {
+        return;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    copyToWindows(tail.fetch_add(size), size, iov, count);
+    statistics.addWrite(static_cast<ssize_t>(size), 0, std::chrono::steady_clock::now() - start);
+}
+
+/*
+ * 一条记录可能跨越 chunk 边界, 逐个 chunk 拷贝. 映射不到的 chunk (窗口已经滑过或者映射失败) 用 pwrite 写这一段,
+ * 映射到的 chunk 总是 release 自己预留的字节: 少算一个字节这个窗口就永远写不满, 映射到同一个窗口的后续 chunk 会一直等待.
+ */
+void MmapFileLogger::copyToWindows(uint64_t offset, size_t size, const struct iovec* iov, int count)
+{
+    const uint64_t end = offset + size;
+    uint64_t position = offset;
+    int index(0);
+    size_t used(0U);    /* iov[index] 中已经写出的字节数 */
+
+    while(position < end)
+    {
+        const uint64_t chunk = position / CHUNK_SIZE;
+        char* const base = getWindow(chunk);
+
+        const size_t begin = static_cast<size_t>(position % CHUNK_SIZE);
+        const size_t room = static_cast<size_t>(std::min<uint64_t>(CHUNK_SIZE - begin, end - position));
+        size_t copied(0U);
+        while((copied < room) && (index < count))
+        {
+            const size_t n = std::min(iov[index].iov_len - used, room - copied);
+            const char* data = static_cast<const char*>(iov[index].iov_base) + used;
+            if(base != nullptr)
+            {
+                memcpy(base + begin + copied, data, n);
+            }else
+            {
+                writeFallback(position + copied, data, n);
+            }
+
+            copied += n;
+            used += n;
+            if(used == iov[index].iov_len)
+            {
+                index++;
+                used = 0U;
+            }
+        }
+
+        if(base != nullptr)
+        {
+            release(chunk, room);
+        }
+        position += room;
+    }
+}
+
+char* MmapFileLogger::getWindow(uint64_t chunk)
+{
+    Window& window = windows[chunk % WINDOW_COUNT];
+    if(window.chunk.load(std::memory_order_acquire) == chunk + 1U)
+    {
+        return window.base;
+    }
+
+    if(degraded.load(std::memory_order_relaxed))
+    {
+        return nullptr;
+    }
+
+    std::unique_lock<std::mutex> guard(mapLock);
+    while (true)
+    {
+        const uint64_t current = window.chunk.load(std::memory_order_acquire);
+        if(current == chunk + 1U)
+        {
+            return window.base;
+        }
+
+        // 写者在预留和拷贝之间被抢占太久, 窗口已经滑过这个 chunk, 这条记录改用 pwrite
+        if(degraded.load() || (chunk + WINDOW_COUNT < mappedEnd))
+        {
+            return nullptr;
+        }
+
+        if(current == 0U)
+        {
+            break;
+        }
+
+        // 窗口还被更早的 chunk 占用, 等它的写者拷贝完成
+        guard.unlock();
+        std::this_thread::yield();
+        guard.lock();
+    }
+
+    const uint64_t end = (chunk + 1U) * CHUNK_SIZE;
+    if(end > allocated)
+    {
+        const uint64_t newAllocated = (end + EXTENT_SIZE - 1U) / EXTENT_SIZE * EXTENT_SIZE;
+        if(::fallocate(fd, 0, static_cast<off_t>(allocated), static_cast<off_t>(newAllocated - allocated)) != 0)
+        {
+            degraded.store(true);
+            return nullptr;
+        }
+        allocated = newAllocated;
+    }
+
+    void* base = ::mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, static_cast<off_t>(chunk * CHUNK_SIZE));
+    if(base == MAP_FAILED)
+    {
+        degraded.store(true);
+        return nullptr;
+    }
+
+    // 第一个 chunk 中打开之前已有的内容不会再被写入, 预先算作已完成
+    window.base = static_cast<char*>(base);
+    window.filled.store((chunk == start / CHUNK_SIZE) ? static_cast<size_t>(start % CHUNK_SIZE) : 0U);
+    window.chunk.store(chunk + 1U, std::memory_order_release);
+    mappedEnd = std::max(mappedEnd, chunk + 1U);
+    return window.base;
+}
+
+void MmapFileLogger::release(uint64_t chunk, size_t bytes)
+{
+    Window& window = windows[chunk % WINDOW_COUNT];
+    if(window.filled.fetch_add(bytes, std::memory_order_acq_rel) + bytes == CHUNK_SIZE)
+    {
+        // 整个 chunk 都已经写完, 不会再有写者访问这个映射
+        ::munmap(window.base, CHUNK_SIZE);
+        window.chunk.store(0U, std::memory_order_release);
+    }
+}
+
+// 映射和 pwrite 都不会关闭 fd; 写不出的部分读起来是 0 (预分配的) 或者是空洞, 记为写错误
+void MmapFileLogger::writeFallback(uint64_t offset, const char* data, size_t size)
+{
+    while(size > 0U)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const ssize_t ret = TEMP_FAILURE_RETRY(::pwrite(fd, data, size, static_cast<off_t>(offset)));
+        if(ret <= 0)
+        {
+            const int error = errno;
+            statistics.addWrite(-1, (ret == 0) ? EIO : error, std::chrono::steady_clock::now() - start);
+            return;
+        }
+
+        if(static_cast<size_t>(ret) < size)
+        {
+            statistics.add(Statistics::SHORT_WRITES);
+        }
+        data += ret;
+        size -= static_cast<size_t>(ret);
+        offset += static_cast<uint64_t>(ret);
+    }
+}
+
+void MmapFileLogger::waitAllWriteAsyncsCompleted()
+{
+    ::fsync(fd);
+}
+
+const Statistics* MmapFileLogger::getStatistics() const
+{
+    return &statistics;
+}
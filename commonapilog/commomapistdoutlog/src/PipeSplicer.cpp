@@ -0,0 +1,223 @@
+#include "PipeSplicer.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace commonapistdoutlogger;
+
+namespace
+{
+    // 最旧的一页还在 pipe 里时 (读端落后了整个环形缓冲区) 每隔这么久检查一次
+    constexpr std::chrono::milliseconds CONSUMED_POLL_INTERVAL(1);
+
+    size_t getPageSize() noexcept
+    {
+        const long size = ::sysconf(_SC_PAGESIZE);
+        return (size > 0) ? static_cast<size_t>(size) : 4096U;
+    }
+
+    size_t getPageCount(size_t pipeBytes, size_t pageSize) noexcept
+    {
+        return std::max<size_t>(2U * ((pipeBytes + pageSize - 1U) / pageSize), 4U);
+    }
+}
+
+PipeSplicer::PipeSplicer(size_t pipeBytes):
+             pageSize(getPageSize()),
+             pageCount(getPageCount(pipeBytes, pageSize)),
+             pages(nullptr),
+             pageEnds(pageCount, 0U),
+             nextPage(0U),
+             queuedBytes(0U),
+             splicedBytes(0U),
+             consumedBytes(0U)
+{
+    void* memory = ::mmap(nullptr, pageCount * pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED)
+    {
+        throw std::runtime_error(std::string("mmap: ") + strerror(errno));
+    }
+    pages = static_cast<char*>(memory);
+    pending.reserve(std::min<size_t>(pageCount / 2U, IOV_MAX));
+}
+
+// pipe 里剩下的页由内核持有引用, 解除映射后仍然有效
+PipeSplicer::~PipeSplicer()
+{
+    ::munmap(pages, pageCount * pageSize);
+}
+
+ssize_t PipeSplicer::write(int fd, const std::vector<std::string>& records, Statistics& statistics)
+{
+    // pending 最多占环形缓冲区的一半, 另一半留给 pipe 里还没有读走的页
+    const size_t maxPending = std::min<size_t>(pageCount / 2U, IOV_MAX);
+    const uint64_t start = queuedBytes;
+
+    size_t page(0U);
+    size_t used(0U);
+    bool hasPage(false);
+
+    for(const auto& record : records)
+    {
+        if(record.empty())
+        {
+            continue;
+        }
+
+        if(record.size() > pageSize)
+        {
+            if(hasPage)
+            {
+                finishPage(page, used);
+                hasPage = false;
+            }
+
+            if((flush(fd, statistics) == -1) || (writeLarge(fd, record, statistics) == -1))
+            {
+                return -1;
+            }
+            continue;
+        }
+
+        if(hasPage && (used + record.size() > pageSize))
+        {
+            finishPage(page, used);
+            hasPage = false;
+            if((pending.size() >= maxPending) && (flush(fd, statistics) == -1))
+            {
+                return -1;
+            }
+        }
+
+        if(!hasPage)
+        {
+            if(!acquirePage(fd, statistics, page))
+            {
+                return -1;
+            }
+            hasPage = true;
+            used = 0U;
+        }
+
+        ::memcpy(pages + page * pageSize + used, record.data(), record.size());
+        used += record.size();
+    }
+
+    if(hasPage)
+    {
+        finishPage(page, used);
+    }
+
+    if(flush(fd, statistics) == -1)
+    {
+        return -1;
+    }
+    return static_cast<ssize_t>(queuedBytes - start);
+}
+
+// 环形缓冲区里最旧的一页; 它还在 pipe 里时先把 pending 交给 pipe, 再等读端把它读走
+bool PipeSplicer::acquirePage(int fd, Statistics& statistics, size_t& page)
+{
+    page = nextPage;
+    if(pageEnds[page] > consumedBytes)
+    {
+        if(!updateConsumed(fd))
+        {
+            return false;
+        }
+
+        if((pageEnds[page] > consumedBytes) && !pending.empty() && (flush(fd, statistics) == -1))
+        {
+            return false;
+        }
+
+        while(pageEnds[page] > consumedBytes)
+        {
+            std::this_thread::sleep_for(CONSUMED_POLL_INTERVAL);
+            if(!updateConsumed(fd))
+            {
+                return false;
+            }
+        }
+    }
+
+    nextPage = (nextPage + 1U) % pageCount;
+    return true;
+}
+
+void PipeSplicer::finishPage(size_t page, size_t used)
+{
+    pending.push_back({pages + page * pageSize, used});
+    queuedBytes += used;
+    pageEnds[page] = queuedBytes;
+}
+
+bool PipeSplicer::updateConsumed(int fd)
+{
+    int inPipe(0);
+    if(::ioctl(fd, FIONREAD, &inPipe) == -1)
+    {
+        return false;
+    }
+
+    consumedBytes = splicedBytes - std::min<uint64_t>(splicedBytes, static_cast<uint64_t>(inPipe));
+    return true;
+}
+
+ssize_t PipeSplicer::flush(int fd, Statistics& statistics)
+{
+    size_t index(0U);
+    while(index < pending.size())
+    {
+        const size_t count = std::min<size_t>(pending.size() - index, IOV_MAX);
+        const ssize_t ret = ::vmsplice(fd, &pending[index], count, SPLICE_F_GIFT);
+        if(ret == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            pending.clear();
+            return -1;
+        }
+
+        splicedBytes += static_cast<uint64_t>(ret);
+        size_t spliced = static_cast<size_t>(ret);
+        while((spliced > 0U) && (spliced >= pending[index].iov_len))
+        {
+            spliced -= pending[index].iov_len;
+            index++;
+        }
+
+        if(spliced > 0U)
+        {
+            statistics.add(Statistics::SHORT_WRITES);
+            pending[index].iov_base = static_cast<char*>(pending[index].iov_base) + spliced;
+            pending[index].iov_len -= spliced;
+        }
+    }
+
+    pending.clear();
+    return 0;
+}
+
+ssize_t PipeSplicer::writeLarge(int fd, const std::string& record, Statistics& statistics)
+{
+    struct iovec iov = {const_cast<char*>(record.data()), record.size()};
+    const ssize_t ret = writeFully(fd, &iov, 1, &statistics);
+    if(ret >= 0)
+    {
+        queuedBytes += record.size();
+        splicedBytes += record.size();
+    }
+    return ret;
+}
@@ -0,0 +1,65 @@
+#include "RateLimiter.hpp"
+
+#include <algorithm>
+#include <time.h>
+
+using namespace commonapistdoutlogger;
+
+namespace
+{
+    constexpr uint64_t NANOSECONDS_PER_SECOND(1000000000U);
+
+    // vDSO 读取, 不进入内核; 精度是一个 tick, 对每秒条数的限制足够了
+    uint64_t now() noexcept
+    {
+        struct timespec ts;
+        ::clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * NANOSECONDS_PER_SECOND + static_cast<uint64_t>(ts.tv_nsec);
+    }
+}
+
+RateLimiter::RateLimiter(const RateLimitConfiguration& configuration):
+             emissionInterval(NANOSECONDS_PER_SECOND / std::max<uint32_t>(configuration.rate, 1U)),
+             tolerance(emissionInterval * (configuration.getBurst() - 1U))
+{
+    for(size_t i = 0; i < buckets.size(); i++)
+    {
+        buckets[i].limited = (std::find(configuration.levels.cbegin(), configuration.levels.cend(), LOG_PRI(i)) != configuration.levels.cend());
+    }
+}
+
+bool RateLimiter::allow(int slot) noexcept
+{
+    Bucket& bucket = buckets[slot];
+    if(!bucket.limited)
+    {
+        return true;
+    }
+
+    const uint64_t t = now();
+    uint64_t tat = bucket.tat.load(std::memory_order_relaxed);
+    for(;;)
+    {
+        const uint64_t start = std::max(tat, t);
+        if(start - t > tolerance)
+        {
+            bucket.suppressed.fetch_add(1U, std::memory_order_relaxed);
+            return false;
+        }
+
+        if(bucket.tat.compare_exchange_weak(tat, start + emissionInterval, std::memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+}
+
+uint64_t RateLimiter::takeSuppressed(int slot) noexcept
+{
+    Bucket& bucket = buckets[slot];
+    if(bucket.suppressed.load(std::memory_order_relaxed) == 0U)
+    {
+        return 0U;
+    }
+    return bucket.suppressed.exchange(0U, std::memory_order_relaxed);
+}
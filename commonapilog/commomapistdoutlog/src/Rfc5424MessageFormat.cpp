@@ -0,0 +1,183 @@
+#include "Rfc5424MessageFormat.hpp"
+#include "LogClock.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <time.h>
+
+using namespace commonapistdoutlogger;
+
+namespace
+{
+    constexpr size_t TIME_SIZE(20U);        /* "YYYY-MM-DDTHH:MM:SS." */
+    constexpr size_t ZONE_SIZE(6U);         /* "+hh:mm" */
+    constexpr size_t MAX_DECIMAL_SIZE(10U); /* uint32_t */
+
+    // 除了主机名和 ident 以外前缀的最大长度: "<pri>1 " 时间 微秒 时区 ' ' ' ' ' ' pid " - - "
+    constexpr size_t MAX_FIXED_SIZE(1U + MAX_DECIMAL_SIZE + 3U + TIME_SIZE + 6U + ZONE_SIZE + 3U + MAX_DECIMAL_SIZE + 5U);
+
+    struct DigitPairs
+    {
+        char digits[200];
+    };
+
+    // "00" "01" ... "99", 编译期生成
+    constexpr DigitPairs makeDigitPairs()
+    {
+        DigitPairs pairs = {};
+        for(int i = 0; i < 100; i++)
+        {
+            pairs.digits[2 * i] = static_cast<char>('0' + i / 10);
+            pairs.digits[2 * i + 1] = static_cast<char>('0' + i % 10);
+        }
+        return pairs;
+    }
+
+    constexpr DigitPairs DIGIT_PAIRS = makeDigitPairs();
+
+    // value < 100
+    inline void writePair(char* p, unsigned value) noexcept
+    {
+        ::memcpy(p, &DIGIT_PAIRS.digits[2U * value], 2U);
+    }
+
+    inline char* writeBytes(char* p, const char* data, size_t size) noexcept
+    {
+        ::memcpy(p, data, size);
+        return p + size;
+    }
+
+    inline char* writeDecimal(char* p, uint32_t value) noexcept
+    {
+        char digits[MAX_DECIMAL_SIZE];
+        char* const end = digits + sizeof(digits);
+        char* start = end;
+
+        while(value >= 100U)
+        {
+            start -= 2;
+            writePair(start, value % 100U);
+            value /= 100U;
+        }
+
+        if(value >= 10U)
+        {
+            start -= 2;
+            writePair(start, value);
+        }else
+        {
+            *--start = static_cast<char>('0' + value);
+        }
+
+        return writeBytes(p, start, static_cast<size_t>(end - start));
+    }
+
+    inline bool endsWithNewLine(const char* message, size_t size) noexcept
+    {
+        return ((size > 0) && (message[size - 1U] == '\n'));
+    }
+
+    // 和 MessageFormatter 的 TimeCache 一样每个线程按秒缓存, 布局固定, 所有实例可以共用
+    struct SecondCache
+    {
+        time_t second = -1;
+        char time[TIME_SIZE];
+        char zone[ZONE_SIZE];
+    };
+
+    const SecondCache& getSecondCache(time_t second)
+    {
+        static thread_local SecondCache cache;
+
+        if(cache.second == second)
+        {
+            return cache;
+        }
+
+        struct tm tm = {};
+        ::localtime_r(&second, &tm);
+
+        const unsigned year = static_cast<unsigned>(tm.tm_year + 1900);
+        char* p = cache.time;
+        writePair(p, year / 100U);
+        writePair(p + 2, year % 100U);
+        p[4] = '-';
+        writePair(p + 5, static_cast<unsigned>(tm.tm_mon + 1));
+        p[7] = '-';
+        writePair(p + 8, static_cast<unsigned>(tm.tm_mday));
+        p[10] = 'T';
+        writePair(p + 11, static_cast<unsigned>(tm.tm_hour));
+        p[13] = ':';
+        writePair(p + 14, static_cast<unsigned>(tm.tm_min));
+        p[16] = ':';
+        writePair(p + 17, static_cast<unsigned>(tm.tm_sec));
+        p[19] = '.';
+
+        long offset = tm.tm_gmtoff / 60;
+        cache.zone[0] = (offset < 0) ? '-' : '+';
+        if(offset < 0)
+        {
+            offset = -offset;
+        }
+        writePair(cache.zone + 1, static_cast<unsigned>(offset / 60));
+        cache.zone[3] = ':';
+        writePair(cache.zone + 4, static_cast<unsigned>(offset % 60));
+
+        cache.second = second;
+        return cache;
+    }
+}
+
+Rfc5424MessageFormatter::Rfc5424MessageFormatter():MessageFormatter(RFC5424_PREFIX)
+{
+}
+
+void Rfc5424MessageFormatter::createFragments(std::string& buffer, MessageFragments& fragments, const std::string& ident, pid_t pid, int facility, int priority, const char* message, size_t size)
+{
+    static const char newLine('\n');
+
+    if((priority & LOG_FACMASK) == 0)
+    {
+        priority |= facility;
+    }
+
+    struct timespec t;
+    getLogTime(t);
+
+    const SecondCache& cache = getSecondCache(t.tv_sec);
+    const HostNames& names = getHostNames();
+
+    buffer.resize(MAX_FIXED_SIZE + names.fqdn.size() + ident.size());
+    char* p = &buffer[0];
+
+    *p++ = '<';
+    p = writeDecimal(p, static_cast<uint32_t>(priority));
+    p = writeBytes(p, ">1 ", 3U);
+    p = writeBytes(p, cache.time, TIME_SIZE);
+
+    const unsigned microseconds = static_cast<unsigned>(t.tv_nsec / 1000);
+    writePair(p, microseconds / 10000U);
+    writePair(p + 2, (microseconds / 100U) % 100U);
+    writePair(p + 4, microseconds % 100U);
+    p += 6;
+
+    p = writeBytes(p, cache.zone, ZONE_SIZE);
+    *p++ = ' ';
+    p = writeBytes(p, names.fqdn.data(), names.fqdn.size());
+    *p++ = ' ';
+    p = writeBytes(p, ident.data(), ident.size());
+    *p++ = ' ';
+    p = writeDecimal(p, static_cast<uint32_t>(pid));
+    p = writeBytes(p, " - - ", 5U);
+
+    buffer.resize(static_cast<size_t>(p - buffer.data()));
+
+    fragments.iov[0] = {const_cast<char*>(buffer.data()), buffer.size()};
+    fragments.iov[1] = {const_cast<char*>(message), size};
+    fragments.count = 2;
+
+    if(!endsWithNewLine(message, size))
+    {
+        fragments.iov[fragments.count++] = {const_cast<char*>(&newLine), 1U};
+    }
+}
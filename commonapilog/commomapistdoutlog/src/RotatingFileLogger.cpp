@@ -0,0 +1,486 @@
+#include "RotatingFileLogger.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace commonapistdoutlogger;
+
+namespace
+{
+    // 只按时间切分时的检查周期, 也是 path.next 打开失败后的重试周期
+    constexpr std::chrono::seconds IDLE_WAIT(1);
+
+    // 回收退役的段时最多等待 acquiring 回到 0 的次数, 等不到就留到下一次
+    constexpr int RECLAIM_TRIES(100);
+
+    // 预分配下一个段的上限
+    constexpr uint64_t MAX_PREALLOCATION(256U * 1024U * 1024U);
+
+    struct stat getStat(int fd)
+    {
+        struct stat sb;
+        if(::fstat(fd, &sb) != 0)
+        {
+            throw std::runtime_error(std::string("fstat: ") + strerror(errno));
+        }
+
+        if(!S_ISREG(sb.st_mode))
+        {
+            throw std::runtime_error("not a regular file");
+        }
+        return sb;
+    }
+
+    std::string getPath(int fd)
+    {
+        const std::string link = "/proc/self/fd/" + std::to_string(fd);
+        char buffer[PATH_MAX];
+        const ssize_t size = ::readlink(link.c_str(), buffer, sizeof(buffer) - 1U);
+        if(size <= 0)
+        {
+            throw std::runtime_error(link + ": " + strerror(errno));
+        }
+
+        const std::string path(buffer, static_cast<size_t>(size));
+        if((path.front() != '/') || (path.find(" (deleted)") != std::string::npos))
+        {
+            throw std::runtime_error(path + ": can not be rotated");
+        }
+        return path;
+    }
+
+    bool isTheSameFile(int fdA, int fdB)
+    {
+        struct stat statA, statB;
+        return (::fstat(fdA, &statA) == 0) && (::fstat(fdB, &statB) == 0) && (statA.st_dev == statB.st_dev) && (statA.st_ino == statB.st_ino);
+    }
+
+    // 和 fd 是同一个文件的本进程 stdout/stderr
+    std::vector<int> getStandardFds(int fd)
+    {
+        std::vector<int> fds;
+        for(const int standardFd : {STDOUT_FILENO, STDERR_FILENO})
+        {
+            if(isTheSameFile(fd, standardFd))
+            {
+                fds.push_back(standardFd);
+            }
+        }
+        return fds;
+    }
+
+    struct Archive
+    {
+        uint64_t sequence;
+        std::string path;
+        uint64_t bytes;
+    };
+
+    // 找出 path.<序号> 形式的归档段, 按序号从旧到新排列
+    std::vector<Archive> listArchives(const std::string& path)
+    {
+        const auto slash = path.rfind('/');
+        const std::string directory = (slash == 0U) ? "/" : path.substr(0, slash);
+        const std::string prefix = path.substr(slash + 1U) + ".";
+
+        std::vector<Archive> archives;
+        DIR* dir = ::opendir(directory.c_str());
+        if(dir == nullptr)
+        {
+            return archives;
+        }
+
+        while(const struct dirent* entry = ::readdir(dir))
+        {
+            const std::string name(entry->d_name);
+            uint64_t sequence(0U);
+            if((name.compare(0, prefix.size(), prefix) != 0) || !stringToInt(std::string_view(name).substr(prefix.size()), sequence))
+            {
+                continue;
+            }
+
+            const std::string archive = directory + "/" + name;
+            struct stat sb;
+            if(::stat(archive.c_str(), &sb) == 0)
+            {
+                archives.push_back({sequence, archive, static_cast<uint64_t>(sb.st_size)});
+            }
+        }
+        ::closedir(dir);
+
+        std::sort(archives.begin(), archives.end(), [](const Archive& a, const Archive& b) { return a.sequence < b.sequence; });
+        return archives;
+    }
+
+    // 下一个 interval 整数倍的墙上时间
+    std::chrono::system_clock::time_point nextBoundary(std::chrono::seconds interval)
+    {
+        const auto now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch());
+        return std::chrono::system_clock::time_point((now / interval + 1) * interval);
+    }
+}
+
+RotatingFileLogger::RotatingFileLogger(FileDescriptor& fd, const std::string& name, const WriterConfiguration& configuration):
+                    rotation(configuration.rotation),
+                    path(getPath(fd)),
+                    nextPath(path + ".next"),
+                    mode(getStat(fd).st_mode & 0777),
+                    standardFds(getStandardFds(fd)),
+                    current(nullptr),
+                    acquiring(0U),
+                    rotateRequested(false),
+                    sequence(0U),
+                    stopping(false)
+{
+    const auto archives = listArchives(path);
+    if(!archives.empty())
+    {
+        sequence = archives.back().sequence;
+    }
+
+    const uint64_t size = static_cast<uint64_t>(getStat(fd).st_size);
+    active = std::make_unique<Segment>(std::move(fd), size);
+    current.store(active.get());
+
+    rotator = std::thread(&RotatingFileLogger::run, this, name);
+
+    if(configuration.asyncQueueSize > 0U)
+    {
+        queue = std::make_unique<AsyncWriteQueue>(configuration.asyncQueueSize, name, configuration.batchBytes, configuration.batchLinger,
+            [this](const AsyncWriteQueue::Records& records) { writeRecords(records); },
+            [this](const std::string& message) { return formatNotice(message); });
+    }
+}
+
+RotatingFileLogger::~RotatingFileLogger()
+{
+    // 先停掉写线程, 它排空队列时还可能触发切分请求
+    queue.reset();
+
+    {
+        const std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wakeup.notify_one();
+    rotator.join();
+
+    if(next)
+    {
+        ::unlink(nextPath.c_str());
+    }
+}
+
+// 拿到当前段并登记为它的使用者; 登记之后再确认它仍是当前段, 切分线程才能安全地等待使用者离开.
+// 读到指针到登记 (或发现过期后撤销) 之间计入 acquiring, 切分线程据此判断什么时候可以释放旧段
+RotatingFileLogger::Segment* RotatingFileLogger::acquire()
+{
+    acquiring++;
+    while (true)
+    {
+        Segment* segment = current.load();
+        segment->users++;
+        if(segment == current.load())
+        {
+            acquiring--;
+            return segment;
+        }
+        segment->users--;
+    }
+}
+
+void RotatingFileLogger::release(Segment* segment)
+{
+    segment->users--;
+}
+
+void RotatingFileLogger::addBytes(Segment* segment, ssize_t ret, std::chrono::steady_clock::time_point start)
+{
+    // 参数的求值顺序不确定, 先保存 errno, 再读时钟
+    const int error = errno;
+    statistics.addWrite(ret, error, std::chrono::steady_clock::now() - start);
+    if(ret <= 0)
+    {
+        return;
+    }
+
+    const uint64_t bytes = segment->bytes.fetch_add(static_cast<uint64_t>(ret)) + static_cast<uint64_t>(ret);
+    if((rotation.maxBytes > 0U) && (bytes >= rotation.maxBytes) && !rotateRequested.load())
+    {
+        // 在 lock 下设置: 否则可能落在切分线程检查条件和开始等待之间, 通知丢失
+        bool requested;
+        {
+            const std::lock_guard<std::mutex> guard(lock);
+            requested = rotateRequested.exchange(true);
+        }
+        if(!requested)
+        {
+            wakeup.notify_one();
+        }
+    }
+}
+
+void RotatingFileLogger::write(const std::string& message)
+{
+    const struct iovec iov = {const_cast<char*>(message.data()), message.size()};
+    write(&iov, 1);
+}
+
+void RotatingFileLogger::writeAsync(const std::string& message)
+{
+    const struct iovec iov = {const_cast<char*>(message.data()), message.size()};
+    writeAsync(&iov, 1);
+}
+
+void RotatingFileLogger::write(const struct iovec* iov, int count)
+{
+    if(queue)
+    {
+        queue->write(iov, count);
+    }else
+    {
+        writeNow(iov, count);
+    }
+}
+
+void RotatingFileLogger::writeAsync(const struct iovec* iov, int count)
+{
+    if(queue)
+    {
+        if(!queue->push(iov, count))
+        {
+            statistics.add(Statistics::DROPPED);
+        }
+    }else
+    {
+        writeNow(iov, count);
+    }
+}
+
+// 异步模式下在写线程上调用: 整批记录用一次 writev 写到当前段
+void RotatingFileLogger::writeRecords(const AsyncWriteQueue::Records& records)
+{
+    batch.clear();
+    for(const auto& record : records)
+    {
+        batch.push_back({const_cast<char*>(record.data()), record.size()});
+    }
+
+    Segment* segment = acquire();
+    const auto start = std::chrono::steady_clock::now();
+    addBytes(segment, writeFully(segment->fd, batch.data(), static_cast<int>(batch.size()), &statistics), start);
+    release(segment);
+}
+
+// 写失败时不关闭 fd, 下一次切分会换成新的文件
+void RotatingFileLogger::writeNow(const struct iovec* iov, int count)
+{
+    Segment* segment = acquire();
+    const auto start = std::chrono::steady_clock::now();
+    const ssize_t ret = TEMP_FAILURE_RETRY(::writev(segment->fd, iov, count));
+    if((ret >= 0) && (static_cast<size_t>(ret) < getTotalLength(iov, count)))
+    {
+        statistics.add(Statistics::SHORT_WRITES);
+    }
+    addBytes(segment, ret, start);
+    release(segment);
+}
+
+void RotatingFileLogger::waitAllWriteAsyncsCompleted()
+{
+    if(queue)
+    {
+        queue->waitAllCompleted();
+    }
+
+    Segment* segment = acquire();
+    ::fsync(segment->fd);
+    release(segment);
+}
+
+const Statistics* RotatingFileLogger::getStatistics() const
+{
+    return &statistics;
+}
+
+void RotatingFileLogger::run(const std::string& name)
+{
+    const std::string threadName = (name + "-rotate").substr(0, 15);
+    pthread_setname_np(pthread_self(), threadName.c_str());
+
+    prepareNext();
+
+    auto deadline = (rotation.interval.count() > 0) ? nextBoundary(rotation.interval) : std::chrono::system_clock::time_point::max();
+
+    // 启动前已经超过大小的文件马上切分
+    if((rotation.maxBytes > 0U) && (current.load()->bytes.load() >= rotation.maxBytes))
+    {
+        rotateRequested.store(true);
+    }
+
+    std::unique_lock<std::mutex> guard(lock);
+    while(!stopping)
+    {
+        const auto wakeupTime = std::min(deadline, std::chrono::system_clock::now() + IDLE_WAIT);
+        wakeup.wait_until(guard, wakeupTime, [this]() { return stopping || rotateRequested.load(); });
+        if(stopping)
+        {
+            break;
+        }
+
+        guard.unlock();
+        if(!next)
+        {
+            prepareNext();
+        }
+        reclaimRetired();
+
+        const bool due = rotateRequested.load() || (std::chrono::system_clock::now() >= deadline);
+        if(due && next)
+        {
+            rotate();
+            rotateRequested.store(false);
+            if(rotation.interval.count() > 0)
+            {
+                deadline = nextBoundary(rotation.interval);
+            }
+        }
+        guard.lock();
+    }
+}
+
+// 提前打开并预分配下一个段, 切分时只需要 rename
+void RotatingFileLogger::prepareNext()
+{
+    FileDescriptor fd(::open(nextPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, mode), true);
+    if(fd < 0)
+    {
+        std::cerr << nextPath << ": " << strerror(errno) << std::endl;
+        return;
+    }
+
+    // KEEP_SIZE: 文件长度不变, 读者看不到预分配的 0; 不支持时忽略
+    if(rotation.maxBytes > 0U)
+    {
+        ::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(std::min(rotation.maxBytes, MAX_PREALLOCATION)));
+    }
+
+    next = std::make_unique<Segment>(std::move(fd), 0U);
+}
+
+void RotatingFileLogger::rotate()
+{
+    const std::string archive = path + "." + std::to_string(sequence + 1U);
+    if(::rename(path.c_str(), archive.c_str()) != 0)
+    {
+        std::cerr << "rename " << path << ": " << strerror(errno) << std::endl;
+        return;
+    }
+    sequence++;
+
+    // 失败时把归档改回 path, 继续写旧段, 不丢日志; 下一次切分从一致的状态重新开始
+    if(::rename(nextPath.c_str(), path.c_str()) != 0)
+    {
+        std::cerr << "rename " << nextPath << ": " << strerror(errno) << std::endl;
+        if(::rename(archive.c_str(), path.c_str()) == 0)
+        {
+            sequence--;
+        }else
+        {
+            std::cerr << "rename " << archive << ": " << strerror(errno) << std::endl;
+        }
+
+        // path.next 可能已经被删除, 重新创建
+        next.reset();
+        return;
+    }
+
+    Segment* old = current.exchange(next.get());
+    retired.push_back(std::move(active));
+    active = std::move(next);
+
+    while(old->users.load() != 0U)
+    {
+        std::this_thread::yield();
+    }
+
+    // 释放旧段上没有用到的预分配空间
+    struct stat sb;
+    if(::fstat(old->fd, &sb) == 0)
+    {
+        TEMP_FAILURE_RETRY(::ftruncate(old->fd, sb.st_size));
+    }
+    old->fd.close();
+
+    // 应用的 printf/std::cout 直接写 stdout/stderr, 让它们也写到新的段, 否则一直写已经归档的文件, 删除归档也不能释放空间.
+    // 旧段的 fd 可能就是 stdout, 所以在 ftruncate 和 close 之后再替换
+    for(const int standardFd : standardFds)
+    {
+        if(::dup2(current.load()->fd, standardFd) < 0)
+        {
+            std::cerr << "dup2 " << path << ": " << strerror(errno) << std::endl;
+        }
+    }
+
+    removeOldSegments();
+    prepareNext();
+    reclaimRetired();
+}
+
+// 退役的段已经没有使用者; acquiring 在切换之后回到过 0, 就没有线程还拿着它们的指针
+void RotatingFileLogger::reclaimRetired()
+{
+    if(retired.empty())
+    {
+        return;
+    }
+
+    for(int i = 0; i < RECLAIM_TRIES; i++)
+    {
+        if(acquiring.load() == 0U)
+        {
+            retired.clear();
+            return;
+        }
+        std::this_thread::yield();
+    }
+}
+
+void RotatingFileLogger::removeOldSegments()
+{
+    if((rotation.keepSegments == 0U) && (rotation.keepBytes == 0U))
+    {
+        return;
+    }
+
+    const auto archives = listArchives(path);
+    uint64_t total(0U);
+    for(const auto& archive : archives)
+    {
+        total += archive.bytes;
+    }
+
+    size_t remaining = archives.size();
+    for(const auto& archive : archives)
+    {
+        const bool tooMany = (rotation.keepSegments > 0U) && (remaining > rotation.keepSegments);
+        const bool tooLarge = (rotation.keepBytes > 0U) && (total > rotation.keepBytes);
+        if(!tooMany && !tooLarge)
+        {
+            break;
+        }
+
+        ::unlink(archive.path.c_str());
+        total -= archive.bytes;
+        remaining--;
+    }
+}
@@ -0,0 +1,20 @@
+#include "SignalRegistration.hpp"
+
+#include <plugin/SignalMonitorService.hpp>
+
+using namespace commonapistdoutlogger;
+
+SignalRegistration::SignalRegistration(const std::shared_ptr<commonApi::PluginServices>& services, int signal, std::function<void()> handler):
+                    services(services),
+                    signal(signal)
+{
+    services->getSignalMonitor().add(signal, std::move(handler));
+}
+
+SignalRegistration::~SignalRegistration()
+{
+    if(auto lockedServices = services.lock())
+    {
+        lockedServices->getSignalMonitor().del(signal);
+    }
+}
@@ -0,0 +1,227 @@
+#include "StagingLogger.hpp"
+
+#include <algorithm>
+#include <pthread.h>
+
+using namespace commonapistdoutlogger;
+
+namespace
+{
+    std::atomic<uint64_t> nextStagingLoggerId(1U);
+
+    size_t getSize(const struct iovec* iov, int count)
+    {
+        size_t size(0U);
+        for(int i = 0; i < count; i++)
+        {
+            size += iov[i].iov_len;
+        }
+        return size;
+    }
+}
+
+struct StagingLogger::Slot
+{
+    std::mutex lock;
+    std::string data;
+    std::atomic<bool> owned{true};      /* 所属线程退出后为 false, 由 flusher 写出后回收 */
+    std::atomic<bool> detached{false};  /* StagingLogger 析构后为 true, 线程下次查找时丢掉 */
+};
+
+// 每个线程在每个 StagingLogger 中的暂存区, 线程退出时交给 flusher 回收
+struct StagingLogger::ThreadSlots
+{
+    std::vector<std::pair<uint64_t, std::shared_ptr<Slot>>> slots;
+
+    ~ThreadSlots()
+    {
+        for(const auto& entry : slots)
+        {
+            entry.second->owned.store(false, std::memory_order_release);
+        }
+    }
+};
+
+StagingLogger::StagingLogger(std::unique_ptr<LogWriter> logger, const std::string& name, size_t capacity, std::chrono::milliseconds interval):
+                id(nextStagingLoggerId++),
+                capacity(capacity),
+                interval(interval),
+                logger(std::move(logger)),
+                pending(false),
+                flusherSleeping(false),
+                stopping(false)
+{
+    flusher = std::thread(&StagingLogger::run, this, name);
+}
+
+StagingLogger::~StagingLogger()
+{
+    {
+        const std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    flusherWakeup.notify_one();
+    flusher.join();
+
+    flushAll();
+
+    for(const auto& slot : slots)
+    {
+        slot->detached.store(true);
+    }
+}
+
+StagingLogger::Slot& StagingLogger::getSlot()
+{
+    static thread_local ThreadSlots threadSlots;
+
+    for(const auto& entry : threadSlots.slots)
+    {
+        if(entry.first == id)
+        {
+            return *entry.second;
+        }
+    }
+
+    // 本线程第一次写这个 logger: 顺便丢掉已经析构的 logger 留下的暂存区
+    auto& entries = threadSlots.slots;
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [](const auto& entry) { return entry.second->detached.load(); }), entries.end());
+
+    auto slot = std::make_shared<Slot>();
+    slot->data.reserve(capacity);
+    {
+        const std::lock_guard<std::mutex> guard(slotsLock);
+        slots.push_back(slot);
+    }
+    entries.emplace_back(id, slot);
+
+    return *slot;
+}
+
+// 调用者持有 slot.lock
+void StagingLogger::flush(Slot& slot)
+{
+    if(!slot.data.empty())
+    {
+        const struct iovec iov = {const_cast<char*>(slot.data.data()), slot.data.size()};
+        logger->writeAsync(&iov, 1);
+        slot.data.clear();
+    }
+}
+
+void StagingLogger::flushAll()
+{
+    const std::lock_guard<std::mutex> guard(slotsLock);
+    for(auto it = slots.begin(); it != slots.end();)
+    {
+        // 先读 owned: 线程退出前的最后一次写入一定在下面的 flush 中写出
+        const bool abandoned = !(*it)->owned.load(std::memory_order_acquire);
+        {
+            const std::lock_guard<std::mutex> slotGuard((*it)->lock);
+            flush(**it);
+        }
+        it = abandoned ? slots.erase(it) : (it + 1);
+    }
+}
+
+void StagingLogger::write(const std::string& message)
+{
+    const struct iovec iov = {const_cast<char*>(message.data()), message.size()};
+    write(&iov, 1);
+}
+
+void StagingLogger::writeAsync(const std::string& message)
+{
+    const struct iovec iov = {const_cast<char*>(message.data()), message.size()};
+    writeAsync(&iov, 1);
+}
+
+void StagingLogger::write(const struct iovec* iov, int count)
+{
+    Slot& slot = getSlot();
+    {
+        const std::lock_guard<std::mutex> guard(slot.lock);
+        flush(slot);
+    }
+    logger->write(iov, count);
+}
+
+void StagingLogger::writeAsync(const struct iovec* iov, int count)
+{
+    const size_t size = getSize(iov, count);
+    Slot& slot = getSlot();
+
+    std::unique_lock<std::mutex> guard(slot.lock);
+    if(slot.data.size() + size > capacity)
+    {
+        flush(slot);
+        if(size > capacity)
+        {
+            logger->writeAsync(iov, count);
+            return;
+        }
+    }
+
+    const bool wasEmpty = slot.data.empty();
+    for(int i = 0; i < count; i++)
+    {
+        slot.data.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    }
+    guard.unlock();
+
+    // 只有暂存区从空变为非空时才需要通知 flusher, 和 flusher 的 flusherSleeping/pending 检查配对, 不会丢失唤醒
+    if(wasEmpty && !pending.load(std::memory_order_relaxed))
+    {
+        pending.store(true);
+        if(flusherSleeping.load())
+        {
+            const std::lock_guard<std::mutex> flusherGuard(lock);
+            flusherWakeup.notify_one();
+        }
+    }
+}
+
+void StagingLogger::waitAllWriteAsyncsCompleted()
+{
+    flushAll();
+    logger->waitAllWriteAsyncsCompleted();
+}
+
+void StagingLogger::run(const std::string& name)
+{
+    const std::string threadName = (name + "-stage").substr(0, 15);
+    pthread_setname_np(pthread_self(), threadName.c_str());
+
+    std::unique_lock<std::mutex> guard(lock);
+    while(!stopping)
+    {
+        if(!pending.exchange(false))
+        {
+            // 没有新暂存的记录时一直睡到有线程写入, 空闲的进程没有周期性的唤醒
+            flusherSleeping.store(true);
+            flusherWakeup.wait(guard, [this]() { return stopping || pending.load(); });
+            flusherSleeping.store(false);
+            continue;
+        }
+
+        flusherWakeup.wait_for(guard, interval, [this]() { return stopping; });
+        guard.unlock();
+        flushAll();
+        guard.lock();
+    }
+}
+
+bool StagingLogger::isAccepted(int priority)
+{
+    return logger->isAccepted(priority);
+}
+
+const Statistics* StagingLogger::getStatistics() const
+{
+    return logger->getStatistics();
+}
+
+void StagingLogger::setNoticeFormatter(NoticeFormatter formatter)
+{
+    logger->setNoticeFormatter(std::move(formatter));
+}
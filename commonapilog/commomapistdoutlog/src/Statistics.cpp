@@ -0,0 +1,103 @@
+#include "Statistics.hpp"
+
+#include <cerrno>
+
+using namespace commonapistdoutlogger;
+
+namespace
+{
+    std::atomic<size_t> nextShard(0U);
+
+    size_t getLatencyBucket(std::chrono::steady_clock::duration latency) noexcept
+    {
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+        if(us <= 0)
+        {
+            return 0U;
+        }
+
+        const size_t bucket = 64U - static_cast<size_t>(__builtin_clzll(static_cast<unsigned long long>(us)));
+        return (bucket < Statistics::LATENCY_BUCKETS) ? bucket : (Statistics::LATENCY_BUCKETS - 1U);
+    }
+}
+
+// 线程第一次计数时按顺序分配分片, 线程数不超过 SHARDS 时每个线程独占一个
+size_t Statistics::getShardIndex() noexcept
+{
+    static thread_local const size_t index = nextShard.fetch_add(1U, std::memory_order_relaxed) % SHARDS;
+    return index;
+}
+
+void Statistics::addWrite(ssize_t ret, int error, std::chrono::steady_clock::duration latency) noexcept
+{
+    Shard& shard = getShard();
+    shard.counters[WRITES].fetch_add(1U, std::memory_order_relaxed);
+    shard.latency[getLatencyBucket(latency)].fetch_add(1U, std::memory_order_relaxed);
+
+    if(ret >= 0)
+    {
+        shard.counters[BYTES].fetch_add(static_cast<uint64_t>(ret), std::memory_order_relaxed);
+        return;
+    }
+
+    const Counter counter = (error == EAGAIN) ? EAGAIN_ERRORS : ((error == ENOSPC) ? ENOSPC_ERRORS : WRITE_ERRORS);
+    shard.counters[counter].fetch_add(1U, std::memory_order_relaxed);
+}
+
+Statistics::Snapshot Statistics::getSnapshot() const noexcept
+{
+    Snapshot snapshot;
+    for(const auto& shard : shards)
+    {
+        for(size_t i = 0; i < COUNTERS; i++)
+        {
+            snapshot.counters[i] += shard.counters[i].load(std::memory_order_relaxed);
+        }
+
+        for(size_t i = 0; i < LATENCY_BUCKETS; i++)
+        {
+            snapshot.latency[i] += shard.latency[i].load(std::memory_order_relaxed);
+        }
+    }
+    return snapshot;
+}
+
+Statistics::Snapshot& Statistics::Snapshot::operator+=(const Snapshot& other) noexcept
+{
+    for(size_t i = 0; i < COUNTERS; i++)
+    {
+        counters[i] += other.counters[i];
+    }
+
+    for(size_t i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        latency[i] += other.latency[i];
+    }
+    return *this;
+}
+
+std::chrono::microseconds Statistics::Snapshot::getLatencyPercentile(unsigned percent) const noexcept
+{
+    uint64_t total(0U);
+    for(const auto count : latency)
+    {
+        total += count;
+    }
+
+    if(total == 0U)
+    {
+        return std::chrono::microseconds(0);
+    }
+
+    const uint64_t target = (total * percent + 99U) / 100U;
+    uint64_t seen(0U);
+    for(size_t i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += latency[i];
+        if(seen >= target)
+        {
+            return std::chrono::microseconds(1LL << i);
+        }
+    }
+    return std::chrono::microseconds(1LL << (LATENCY_BUCKETS - 1U));
+}
@@ -0,0 +1,312 @@
+#include "UringLogger.hpp"
+#include "SignalPipeBlock.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace commonapistdoutlogger;
+
+namespace
+{
+    // 所有缓冲区各一个写, 再加一个 fsync
+    constexpr unsigned RING_ENTRIES(32U);
+
+    // user_data 小于 BUFFER_COUNT 时是缓冲区下标
+    constexpr uint64_t FSYNC_USER_DATA(UINT64_MAX);
+
+    bool isFatalError(int err)
+    {
+        return ((err != EAGAIN) && (err != ENOSPC) && (err != EIO) && (err != EMSGSIZE) &&
+                (err != ENOMEM) && (err != ENOBUFS));
+    }
+
+    mode_t getFileType(int fd)
+    {
+        struct stat sb;
+        return (::fstat(fd, &sb) == 0) ? (sb.st_mode & S_IFMT) : 0;
+    }
+}
+
+UringLogger::UringLogger(FileDescriptor& fd, const std::string& name, const WriterConfiguration& configuration):
+             fd(-1, false),
+             regularFile(getFileType(fd) == S_IFREG),
+             ring(RING_ENTRIES),
+             pool(new char[BUFFER_COUNT * BUFFER_SIZE]),
+             pending(0U),
+             lastSqe(nullptr),
+             fsyncRequested(false)
+{
+    const int files[] = {fd};
+    ring.registerFiles(files, 1U);
+
+    struct iovec buffers[BUFFER_COUNT];
+    for(unsigned i = 0; i < BUFFER_COUNT; i++)
+    {
+        buffers[i] = {buffer(i), BUFFER_SIZE};
+    }
+    ring.registerBuffers(buffers, BUFFER_COUNT);
+
+    // pipe 和 FifoLogger 一样, 一批不超过 PIPE_BUF, 读端不会看到被其它写者打断的记录
+    const mode_t type = getFileType(fd);
+    size_t batchBytes = configuration.batchBytes;
+    if((type == S_IFIFO) || (type == S_IFSOCK))
+    {
+        batchBytes = ((batchBytes > 0U) && (batchBytes < PIPE_BUF)) ? batchBytes : PIPE_BUF;
+    }
+
+    this->fd = std::move(fd);
+    queue = std::make_unique<AsyncWriteQueue>(configuration.asyncQueueSize, name, batchBytes, configuration.batchLinger,
+        [this](const AsyncWriteQueue::Records& records) { writeRecords(records); },
+        [this](const std::string& message) { return formatNotice(message); });
+}
+
+void UringLogger::write(const std::string& message)
+{
+    const struct iovec iov = {const_cast<char*>(message.data()), message.size()};
+    write(&iov, 1);
+}
+
+void UringLogger::writeAsync(const std::string& message)
+{
+    const struct iovec iov = {const_cast<char*>(message.data()), message.size()};
+    writeAsync(&iov, 1);
+}
+
+void UringLogger::write(const struct iovec* iov, int count)
+{
+    queue->write(iov, count);
+}
+
+void UringLogger::writeAsync(const struct iovec* iov, int count)
+{
+    if(!queue->push(iov, count))
+    {
+        statistics.add(Statistics::DROPPED);
+    }
+}
+
+// 在写线程上调用: 记录依次拷贝进固定缓冲区, 缓冲区用完时先提交一次
+void UringLogger::writeRecords(const AsyncWriteQueue::Records& records)
+{
+    if(fd < 0)
+    {
+        statistics.add(Statistics::DROPPED, records.size());
+        return;
+    }
+
+    size_t used(0U);
+    for(const auto& record : records)
+    {
+        const char* data = record.data();
+        size_t remaining = record.size();
+        while(remaining > 0U)
+        {
+            const size_t n = std::min(remaining, BUFFER_SIZE - used);
+            memcpy(buffer(pending) + used, data, n);
+            used += n;
+            data += n;
+            remaining -= n;
+
+            if(used == BUFFER_SIZE)
+            {
+                prepareWrite(used);
+                used = 0U;
+                if(pending == BUFFER_COUNT)
+                {
+                    completeWrites(false);
+                }
+            }
+        }
+    }
+
+    if(used > 0U)
+    {
+        prepareWrite(used);
+    }
+
+    const bool fsync = fsyncRequested.exchange(false) && regularFile;
+    if((pending > 0U) || fsync)
+    {
+        completeWrites(fsync);
+    }
+}
+
+void UringLogger::prepareWrite(size_t size)
+{
+    struct io_uring_sqe* sqe = ring.getSqe();
+    if(sqe == nullptr)
+    {
+        // 提交队列满 (RING_ENTRIES 大于缓冲区数, 正常不会发生): 先完成已经准备好的写, 再直接写出这个缓冲区
+        const unsigned index = pending;
+        completeWrites(false);
+        if(fd >= 0)
+        {
+            writeBuffer(buffer(index), size);
+        }
+        return;
+    }
+
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+    sqe->fd = 0;    /* 注册的文件下标 */
+    sqe->addr = reinterpret_cast<uintptr_t>(buffer(pending));
+    sqe->len = static_cast<uint32_t>(size);
+    sqe->off = static_cast<uint64_t>(-1);    /* 使用并推进文件的当前位置 (IORING_FEAT_RW_CUR_POS), pipe 忽略 */
+    sqe->buf_index = static_cast<uint16_t>(pending);
+    sqe->user_data = pending;
+
+    lengths[pending] = size;
+    results[pending] = -ECANCELED;
+    lastSqe = sqe;
+    pending++;
+}
+
+void UringLogger::completeWrites(bool fsync)
+{
+    // 链在所有写之后, 前面的写都完成后才执行; 提交队列满时在补写之后直接 fsync
+    struct io_uring_sqe* fsyncSqe = fsync ? ring.getSqe() : nullptr;
+    if(fsyncSqe != nullptr)
+    {
+        fsyncSqe->opcode = IORING_OP_FSYNC;
+        fsyncSqe->flags = IOSQE_FIXED_FILE;
+        fsyncSqe->fd = 0;
+        fsyncSqe->user_data = FSYNC_USER_DATA;
+    }else if(lastSqe != nullptr)
+    {
+        lastSqe->flags &= ~IOSQE_IO_LINK;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const unsigned expected = pending + ((fsyncSqe != nullptr) ? 1U : 0U);
+    unsigned reaped(0U);
+    while(reaped < expected)
+    {
+        if(ring.submitAndWait(expected - reaped) < 0)
+        {
+            if((errno == EAGAIN) || (errno == EBUSY))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            // sqe 还留在提交队列里, 不能再改用 write 补写, 放弃这个 fd
+            statistics.add(Statistics::RETIRED_FDS);
+            fd.close();
+            break;
+        }
+
+        reaped += ring.reap([this](uint64_t userData, int res)
+        {
+            if(userData < BUFFER_COUNT)
+            {
+                results[userData] = res;
+            }
+        });
+    }
+
+    if(fd >= 0)
+    {
+        repairWrites(std::chrono::steady_clock::now() - start);
+    }
+
+    if(fsync && (fsyncSqe == nullptr) && (fd >= 0))
+    {
+        ::fsync(fd);
+    }
+
+    pending = 0U;
+    lastSqe = nullptr;
+}
+
+// 记录每个完成的写 (latency 是整批提交到收割的时间); 短写会取消链中后面的写: 按顺序用 write 补写没有完成的部分
+void UringLogger::repairWrites(std::chrono::steady_clock::duration latency)
+{
+    for(unsigned i = 0; i < pending; i++)
+    {
+        const int res = results[i];
+        if(res != -ECANCELED)
+        {
+            statistics.addWrite((res >= 0) ? res : -1, (res >= 0) ? 0 : -res, latency);
+        }
+
+        if(res == static_cast<int>(lengths[i]))
+        {
+            continue;
+        }
+
+        if(res >= 0)
+        {
+            statistics.add(Statistics::SHORT_WRITES);
+        }else if((res != -ECANCELED) && (res != -EAGAIN) && (res != -EINTR))
+        {
+            if(res == -EPIPE)
+            {
+                discardPendingSigpipe();
+            }
+
+            if(isFatalError(-res))
+            {
+                statistics.add(Statistics::RETIRED_FDS);
+                fd.close();
+                return;
+            }
+            continue;
+        }
+
+        const size_t done = (res > 0) ? static_cast<size_t>(res) : 0U;
+        if(!writeBuffer(buffer(i) + done, lengths[i] - done))
+        {
+            return;
+        }
+    }
+}
+
+// 用 write 写出, 遇到致命错误时放弃这个 fd 并返回 false
+bool UringLogger::writeBuffer(const char* data, size_t size)
+{
+    struct iovec iov = {const_cast<char*>(data), size};
+    const auto start = std::chrono::steady_clock::now();
+    const ssize_t ret = writeFully(fd, &iov, 1, &statistics);
+    const int error = errno;
+    statistics.addWrite(ret, error, std::chrono::steady_clock::now() - start);
+
+    if(ret == -1)
+    {
+        if(error == EPIPE)
+        {
+            discardPendingSigpipe();
+        }
+
+        if(isFatalError(error))
+        {
+            statistics.add(Statistics::RETIRED_FDS);
+            fd.close();
+            return false;
+        }
+    }
+    return true;
+}
+
+const Statistics* UringLogger::getStatistics() const
+{
+    return &statistics;
+}
+
+void UringLogger::waitAllWriteAsyncsCompleted()
+{
+    if(!regularFile)
+    {
+        queue->waitAllCompleted();
+        return;
+    }
+
+    // 空记录让写线程处理 fsync 请求, 它和之前的写在同一条链上
+    fsyncRequested.store(true);
+    queue->write(nullptr, 0);
+}
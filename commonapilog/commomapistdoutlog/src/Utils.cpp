@@ -1,10 +1,12 @@
 #include <sstream>
+#include <cerrno>
 #include <cstdlib>
 #include <climits>
 #include <unistd.h>
 #include <string.h>
 
 #include "Utils.hpp"
+#include "Statistics.hpp"
 
 namespace commonapistdoutlogger
 {
@@ -43,7 +45,7 @@ std::string getLogFqd()
 
     ::getdomainname(domainNameBuffer, sizeof(domainNameBuffer) - 1);
 
-    if(domainNameBuffer[0] && strcmp(domainNameBuffer, "(node)"))
+    if(domainNameBuffer[0] && strcmp(domainNameBuffer, "(none)"))
     {
         os << '.' << domainNameBuffer;
     }
@@ -51,4 +53,73 @@ std::string getLogFqd()
     return os.str();
 }
 
+size_t getTotalLength(const struct iovec* iov, int count) noexcept
+{
+    size_t size(0U);
+    for(int i = 0; i < count; i++)
+    {
+        size += iov[i].iov_len;
+    }
+    return size;
+}
+
+ssize_t writeFully(int fd, struct iovec* iov, int count, Statistics* statistics)
+{
+    ssize_t total(0);
+
+    while(count > 0)
+    {
+        const ssize_t ret = ::writev(fd, iov, count);
+        if(ret == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        if(ret == 0)
+        {
+            break;
+        }
+
+        total += ret;
+
+        size_t written = static_cast<size_t>(ret);
+        while((count > 0) && (written >= iov->iov_len))
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if(count > 0)
+        {
+            if(statistics != nullptr)
+            {
+                statistics->add(Statistics::SHORT_WRITES);
+            }
+            iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return total;
+}
+
+#if defined(__x86_64__)
+bool useAvx2() noexcept
+{
+    const char* simd = ::getenv("COMMON_API_LOGGER_SIMD");
+    if((simd != nullptr) && (::strcmp(simd, "sse2") == 0))
+    {
+        return false;
+    }
+
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
 }
@@ -0,0 +1,219 @@
+/*
+ * findJsonEscape 和 appendJsonEscaped 的测试. 和逐字节的参考实现比较, 覆盖长度 0-96 的每个命中位置和每种命中:
+ * 需要转义的字节, 不需要转义的 DEL 和合法的多字节序列, 截断, 过长编码, 代理区和超过 U+10FFFF 的 UTF-8.
+ * 长度跨过 16/32 字节的块边界, 末尾的重叠读取和只差几个字节的短消息都在里面; 数据放在一页的末尾, 越界读取会 SIGSEGV.
+ * SSE2 和 AVX2 两条路径各运行一次.
+ */
+
+#include "JsonMessageFormat.hpp"
+#include "SimdTest.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace commonapistdoutlogger;
+
+namespace
+{
+    constexpr size_t MAX_LENGTH(96U);
+
+    // 打印前几个失败的用例, 之后只计数
+    constexpr int MAX_REPORTS(20);
+
+    int failures(0);
+
+    struct Pattern
+    {
+        const char* name;
+        std::string bytes;
+    };
+
+    const std::vector<Pattern> PATTERNS = {
+        {"quote", "\""},
+        {"backslash", "\\"},
+        {"nul", std::string(1, '\0')},
+        {"control", "\x01"},
+        {"unit separator", "\x1f"},
+        {"newline", "\n"},
+        {"crlf", "\r\n"},
+        {"tab", "\t"},
+        {"del", "\x7f"},
+        {"two bytes", "\xc3\xa9"},
+        {"three bytes", "\xe4\xb8\xad"},
+        {"four bytes", "\xf0\x9f\x98\x80"},
+        {"truncated", "\xe4\xb8"},
+        {"lone continuation", "\x80"},
+        {"overlong two bytes", "\xc0\xaf"},
+        {"overlong three bytes", "\xe0\x80\xaf"},
+        {"overlong four bytes", "\xf0\x80\x80\xaf"},
+        {"surrogate", "\xed\xa0\x80"},
+        {"above U+10FFFF", "\xf4\x90\x80\x80"},
+        {"invalid lead", "\xff"},
+    };
+
+    // 逐字节的参考实现
+    size_t referenceFind(const std::string& data)
+    {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data.data());
+        size_t i(0U);
+        while(i < data.size())
+        {
+            const unsigned char c = bytes[i];
+            if(c >= 0x80U)
+            {
+                const size_t length = simdtest::getUtf8Length(bytes + i, data.size() - i);
+                if(length == 0U)
+                {
+                    return i;
+                }
+                i += length;
+            }else if((c < 0x20U) || (c == '"') || (c == '\\'))
+            {
+                return i;
+            }else
+            {
+                i++;
+            }
+        }
+        return data.size();
+    }
+
+    std::string referenceEscape(const std::string& data)
+    {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data.data());
+        std::string out;
+        size_t i(0U);
+        while(i < data.size())
+        {
+            const unsigned char c = bytes[i];
+            if(c >= 0x80U)
+            {
+                const size_t length = simdtest::getUtf8Length(bytes + i, data.size() - i);
+                if(length == 0U)
+                {
+                    out += "\\ufffd";
+                    i++;
+                }else
+                {
+                    out.append(data, i, length);
+                    i += length;
+                }
+                continue;
+            }
+
+            i++;
+            switch(c)
+            {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            default:
+            {
+                if(c < 0x20U)
+                {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out += escaped;
+                }else
+                {
+                    out += static_cast<char>(c);
+                }
+                break;
+            }
+            }
+        }
+        return out;
+    }
+
+    void report(const std::string& data, const char* what, const char* pattern, size_t position)
+    {
+        if(failures < MAX_REPORTS)
+        {
+            std::fprintf(stderr, "FAILED: %s: pattern \"%s\" at %zu in a message of %zu bytes\n", what, pattern, position, data.size());
+        }
+        failures++;
+    }
+
+    void checkMessage(simdtest::GuardedBuffer& buffer, const std::string& data, const char* pattern, size_t position)
+    {
+        const char* p = buffer.place(data);
+
+        if(findJsonEscape(p, data.size()) != referenceFind(data))
+        {
+            report(data, "findJsonEscape", pattern, position);
+        }
+
+        std::string out("prefix");
+        appendJsonEscaped(out, p, data.size());
+        if(out != "prefix" + referenceEscape(data))
+        {
+            report(data, "appendJsonEscaped", pattern, position);
+        }
+    }
+
+    // 把 filler 重复到 length 字节; 多字节的 filler 在末尾被截断, 本身也是一种命中
+    std::string fill(const std::string& filler, size_t length)
+    {
+        std::string data;
+        while(data.size() < length)
+        {
+            data += filler;
+        }
+        data.resize(length);
+        return data;
+    }
+
+    int testAllPositions()
+    {
+        failures = 0;
+        simdtest::GuardedBuffer buffer;
+        const std::vector<std::string> fillers = {"a", "\xe4\xb8\xad"};
+
+        for(const auto& filler : fillers)
+        {
+            for(size_t length = 0U; length <= MAX_LENGTH; length++)
+            {
+                const std::string clean(fill(filler, length));
+                checkMessage(buffer, clean, "none", length);
+
+                for(const auto& pattern : PATTERNS)
+                {
+                    for(size_t position = 0U; position < length; position++)
+                    {
+                        // 模式超出消息末尾的部分被截掉
+                        std::string data(clean);
+                        data.replace(position, std::min(pattern.bytes.size(), length - position), pattern.bytes, 0U, length - position);
+                        checkMessage(buffer, data, pattern.name, position);
+
+                        // 后面还有一个命中时返回的是第一个
+                        if(position + pattern.bytes.size() < length)
+                        {
+                            data[length - 1U] = '"';
+                            checkMessage(buffer, data, pattern.name, position);
+                        }
+                    }
+                }
+            }
+        }
+        return failures;
+    }
+}
+
+int main()
+{
+    try
+    {
+        return (simdtest::runSimdPaths("JsonEscapeTest", testAllPositions) == 0) ? 0 : 1;
+    }
+    catch(const std::exception& e)
+    {
+        std::fprintf(stderr, "FAILED: %s\n", e.what());
+        return 1;
+    }
+}
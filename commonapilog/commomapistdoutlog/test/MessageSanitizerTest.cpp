@@ -0,0 +1,244 @@
+/*
+ * MessageSanitizer 的测试. needsSanitizing 和 sanitize 在每种模式组合下和逐字节的参考实现比较,
+ * 覆盖长度 0-96 的每个命中位置和每种命中: 控制字符, DEL, '\n', "\r\n", 单独的 '\r', 合法的多字节序列,
+ * 截断, 过长编码, 代理区和超过 U+10FFFF 的 UTF-8. 数据放在一页的末尾, 越界读取会 SIGSEGV.
+ * SSE2 和 AVX2 两条路径各运行一次.
+ */
+
+#include "MessageSanitizer.hpp"
+#include "SimdTest.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace commonapistdoutlogger;
+
+namespace
+{
+    constexpr size_t MAX_LENGTH(96U);
+
+    constexpr unsigned ALL_MODES(MessageSanitizer::ESCAPE_CONTROL | MessageSanitizer::REPLACE_INVALID_UTF8 | MessageSanitizer::SPLIT_LINES);
+
+    // 打印前几个失败的用例, 之后只计数
+    constexpr int MAX_REPORTS(20);
+
+    int failures(0);
+
+    struct Pattern
+    {
+        const char* name;
+        std::string bytes;
+    };
+
+    const std::vector<Pattern> PATTERNS = {
+        {"nul", std::string(1, '\0')},
+        {"control", "\x01"},
+        {"escape", "\x1b"},
+        {"tab", "\t"},
+        {"del", "\x7f"},
+        {"newline", "\n"},
+        {"empty line", "\n\n"},
+        {"crlf", "\r\n"},
+        {"carriage return", "\r"},
+        {"two bytes", "\xc3\xa9"},
+        {"three bytes", "\xe4\xb8\xad"},
+        {"four bytes", "\xf0\x9f\x98\x80"},
+        {"truncated", "\xe4\xb8"},
+        {"lone continuation", "\x80"},
+        {"overlong two bytes", "\xc0\xaf"},
+        {"overlong three bytes", "\xe0\x80\xaf"},
+        {"overlong four bytes", "\xf0\x80\x80\xaf"},
+        {"surrogate", "\xed\xa0\x80"},
+        {"above U+10FFFF", "\xf4\x90\x80\x80"},
+        {"invalid lead", "\xff"},
+    };
+
+    bool isControl(unsigned char c)
+    {
+        return ((c < 0x20U) && (c != '\t')) || (c == 0x7fU);
+    }
+
+    size_t stripTrailingNewLine(const std::string& data)
+    {
+        return (!data.empty() && (data.back() == '\n')) ? (data.size() - 1U) : data.size();
+    }
+
+    // 逐字节的参考实现
+    bool referenceNeedsSanitizing(const std::string& data, unsigned modes)
+    {
+        const size_t size = stripTrailingNewLine(data);
+        for(size_t i = 0U; i < size; i++)
+        {
+            const unsigned char c = static_cast<unsigned char>(data[i]);
+            if((modes & (MessageSanitizer::ESCAPE_CONTROL | MessageSanitizer::SPLIT_LINES)) && isControl(c))
+            {
+                return true;
+            }
+            if((modes & MessageSanitizer::REPLACE_INVALID_UTF8) && (c >= 0x80U))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    MessageSanitizer::Lines referenceSanitize(const std::string& data, unsigned modes)
+    {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data.data());
+        const size_t size = stripTrailingNewLine(data);
+        MessageSanitizer::Lines lines;
+        std::string line;
+        const auto endLine = [&lines, &line]()
+        {
+            if(!line.empty())
+            {
+                lines.spans.emplace_back(lines.text.size(), line.size());
+                lines.text += line;
+                line.clear();
+            }
+        };
+
+        size_t i(0U);
+        while(i < size)
+        {
+            const unsigned char c = bytes[i];
+            if((modes & MessageSanitizer::REPLACE_INVALID_UTF8) && (c >= 0x80U))
+            {
+                const size_t length = simdtest::getUtf8Length(bytes + i, size - i);
+                if(length == 0U)
+                {
+                    line += "\xEF\xBF\xBD";
+                    i++;
+                }else
+                {
+                    line.append(data, i, length);
+                    i += length;
+                }
+                continue;
+            }
+
+            if((modes & MessageSanitizer::SPLIT_LINES) && (c == '\n'))
+            {
+                endLine();
+            }else if((modes & MessageSanitizer::SPLIT_LINES) && (c == '\r') && (i + 1U < size) && (bytes[i + 1U] == '\n'))
+            {
+                // 和后面的 '\n' 一起结束一行
+            }else if((modes & MessageSanitizer::ESCAPE_CONTROL) && isControl(c))
+            {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "#%03o", c);
+                line += escaped;
+            }else
+            {
+                line += static_cast<char>(c);
+            }
+            i++;
+        }
+        endLine();
+        return lines;
+    }
+
+    void report(const std::string& data, const char* what, unsigned modes, const char* pattern, size_t position)
+    {
+        if(failures < MAX_REPORTS)
+        {
+            std::fprintf(stderr, "FAILED: %s: modes %u, pattern \"%s\" at %zu in a message of %zu bytes\n", what, modes, pattern, position, data.size());
+        }
+        failures++;
+    }
+
+    void checkMessage(simdtest::GuardedBuffer& buffer, const std::vector<std::unique_ptr<MessageSanitizer>>& sanitizers, MessageSanitizer::Lines& lines,
+                      const std::string& data, const char* pattern, size_t position)
+    {
+        const char* p = buffer.place(data);
+
+        for(unsigned modes = 1U; modes <= ALL_MODES; modes++)
+        {
+            const MessageSanitizer& sanitizer = *sanitizers[modes];
+
+            if(sanitizer.needsSanitizing(p, data.size()) != referenceNeedsSanitizing(data, modes))
+            {
+                report(data, "needsSanitizing", modes, pattern, position);
+            }
+
+            // lines 在用例之间复用, 和调用者一样
+            sanitizer.sanitize(p, data.size(), lines);
+            const MessageSanitizer::Lines expected(referenceSanitize(data, modes));
+            if((lines.text != expected.text) || (lines.spans != expected.spans))
+            {
+                report(data, "sanitize", modes, pattern, position);
+            }
+        }
+    }
+
+    // 把 filler 重复到 length 字节; 多字节的 filler 在末尾被截断, 本身也是一种命中
+    std::string fill(const std::string& filler, size_t length)
+    {
+        std::string data;
+        while(data.size() < length)
+        {
+            data += filler;
+        }
+        data.resize(length);
+        return data;
+    }
+
+    int testAllPositions()
+    {
+        failures = 0;
+        simdtest::GuardedBuffer buffer;
+        MessageSanitizer::Lines lines;
+        std::vector<std::unique_ptr<MessageSanitizer>> sanitizers(ALL_MODES + 1U);
+        for(unsigned modes = 1U; modes <= ALL_MODES; modes++)
+        {
+            sanitizers[modes] = std::make_unique<MessageSanitizer>(modes);
+        }
+
+        const std::vector<std::string> fillers = {"a", "\xe4\xb8\xad"};
+        for(const auto& filler : fillers)
+        {
+            for(size_t length = 0U; length <= MAX_LENGTH; length++)
+            {
+                const std::string clean(fill(filler, length));
+                checkMessage(buffer, sanitizers, lines, clean, "none", length);
+
+                for(const auto& pattern : PATTERNS)
+                {
+                    for(size_t position = 0U; position < length; position++)
+                    {
+                        // 模式超出消息末尾的部分被截掉
+                        std::string data(clean);
+                        data.replace(position, std::min(pattern.bytes.size(), length - position), pattern.bytes, 0U, length - position);
+                        checkMessage(buffer, sanitizers, lines, data, pattern.name, position);
+
+                        // 后面还有一个命中, 末尾的换行不算
+                        if(position + pattern.bytes.size() + 1U < length)
+                        {
+                            data[length - 2U] = '\x01';
+                            data[length - 1U] = '\n';
+                            checkMessage(buffer, sanitizers, lines, data, pattern.name, position);
+                        }
+                    }
+                }
+            }
+        }
+        return failures;
+    }
+}
+
+int main()
+{
+    try
+    {
+        return (simdtest::runSimdPaths("MessageSanitizerTest", testAllPositions) == 0) ? 0 : 1;
+    }
+    catch(const std::exception& e)
+    {
+        std::fprintf(stderr, "FAILED: %s\n", e.what());
+        return 1;
+    }
+}
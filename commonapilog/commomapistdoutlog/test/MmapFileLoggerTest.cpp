@@ -0,0 +1,247 @@
+/*
+ * MmapFileLogger 的回退路径测试. 一条记录中映射不到的 chunk 改用 pwrite, 映射到的 chunk 预留的字节必须 release,
+ * 否则这个窗口永远写不满, 映射到同一个窗口的后续 chunk 会一直等待.
+ *   degraded: 用 RLIMIT_FSIZE 让第二次 fallocate 失败 (EFBIG), 跨 chunk 边界的记录后一半改用 pwrite
+ *   slide:    写者在拷贝第一个 chunk 时停在 SIGSEGV 处理函数里 (源数据所在的页是 PROT_NONE),
+ *             另一个写者映射了 8 个 chunk 之后的位置, 写者恢复后中间的 chunk 窗口已经滑过, 而最后一个 chunk 已经映射
+ */
+
+#include "MmapFileLogger.hpp"
+
+#include <csignal>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+
+using namespace commonapistdoutlogger;
+
+namespace
+{
+    // 和 MmapFileLogger.cpp 中的 CHUNK_SIZE/EXTENT_SIZE 一致
+    constexpr size_t CHUNK_SIZE(4U * 1024U * 1024U);
+    constexpr size_t EXTENT_SIZE(64U * 1024U * 1024U);
+    constexpr size_t WINDOW_COUNT(8U);
+
+    constexpr size_t BLOCK_SIZE(1024U * 1024U);
+    constexpr size_t TAIL_SIZE(100U);
+
+    int failures(0);
+
+    void check(bool condition, const char* what)
+    {
+        if(!condition)
+        {
+            std::fprintf(stderr, "FAILED: %s\n", what);
+            failures++;
+        }
+    }
+
+    // 当前进程里 path 的映射个数
+    int countMappings(const std::string& path)
+    {
+        std::ifstream maps("/proc/self/maps");
+        std::string line;
+        int count(0);
+        while(std::getline(maps, line))
+        {
+            if(line.find(path) != std::string::npos)
+            {
+                count++;
+            }
+        }
+        return count;
+    }
+
+    std::string readAt(int fd, off_t offset, size_t size)
+    {
+        std::string data(size, '\0');
+        const ssize_t ret = ::pread(fd, &data[0], size, offset);
+        data.resize((ret > 0) ? static_cast<size_t>(ret) : 0U);
+        return data;
+    }
+
+    int createFile(std::string& path)
+    {
+        const int fd = ::mkstemp(&path[0]);
+        if(fd < 0)
+        {
+            throw std::runtime_error(path + ": " + strerror(errno));
+        }
+        return fd;
+    }
+
+    void testDegradedFallback(const std::string& directory)
+    {
+        std::string path = directory + "/mmaptest.XXXXXX";
+        const int fd = createFile(path);
+
+        // 第一个 EXTENT 可以预分配, 第二个超过限制; 限制以内的 pwrite 仍然成功
+        struct rlimit limit;
+        ::getrlimit(RLIMIT_FSIZE, &limit);
+        const struct rlimit saved = limit;
+        limit.rlim_cur = EXTENT_SIZE + BLOCK_SIZE;
+        ::setrlimit(RLIMIT_FSIZE, &limit);
+
+        const std::vector<char> block(BLOCK_SIZE, 'a');
+        const std::string crossing(2U * TAIL_SIZE, 'b');
+        const std::string after(TAIL_SIZE, 'c');
+        {
+            MmapFileLogger logger(FileDescriptor(fd, false));
+
+            // 写到 EXTENT 结束前 TAIL_SIZE 字节, 只剩最后一个 chunk 还在映射
+            const size_t blocks = EXTENT_SIZE / BLOCK_SIZE;
+            for(size_t i = 0; i < blocks; i++)
+            {
+                const size_t size = (i + 1U < blocks) ? BLOCK_SIZE : (BLOCK_SIZE - TAIL_SIZE);
+                const struct iovec iov = {const_cast<char*>(block.data()), size};
+                logger.write(&iov, 1);
+            }
+            check(countMappings(path) == 1, "last chunk of the first extent is mapped");
+
+            // 前 TAIL_SIZE 字节拷贝到映射里并写满这个 chunk, 后 TAIL_SIZE 字节的 chunk 预分配失败, 用 pwrite
+            logger.write(crossing);
+            check(countMappings(path) == 0, "chunk filled by a record that fell back to pwrite is unmapped");
+
+            logger.write(after);
+        }
+
+        ::setrlimit(RLIMIT_FSIZE, &saved);
+
+        check(::lseek(fd, 0, SEEK_END) == static_cast<off_t>(EXTENT_SIZE - TAIL_SIZE + crossing.size() + after.size()), "file is truncated to the written length");
+        check(readAt(fd, EXTENT_SIZE - TAIL_SIZE, crossing.size()) == crossing, "record crossing the chunk boundary is complete");
+        check(readAt(fd, EXTENT_SIZE + TAIL_SIZE, after.size()) == after, "record after the fallback is written with pwrite");
+        check(readAt(fd, EXTENT_SIZE - TAIL_SIZE - 1, 1) == "a", "mapped data before the fallback is kept");
+
+        ::close(fd);
+        ::unlink(path.c_str());
+    }
+
+    // slide 测试中被暂停的写者: 第一次访问 protectedPage 时等待 resumed, 然后恢复访问权限重新执行
+    sem_t faulted;
+    sem_t resumed;
+    void* protectedPage(nullptr);
+    size_t pageSize(0U);
+
+    void pauseOnFault(int)
+    {
+        sem_post(&faulted);
+        while(sem_wait(&resumed) != 0)
+        {
+        }
+        ::mprotect(protectedPage, pageSize, PROT_READ | PROT_WRITE);
+    }
+
+    void testSlideFallback(const std::string& directory)
+    {
+        std::string path = directory + "/mmaptest.XXXXXX";
+        const int fd = createFile(path);
+
+        // chunk 0 的最后 TAIL_SIZE 字节, chunk 1 到 WINDOW_COUNT 的全部, chunk WINDOW_COUNT + 1 的前 TAIL_SIZE 字节
+        const size_t size = TAIL_SIZE + WINDOW_COUNT * CHUNK_SIZE + TAIL_SIZE;
+        pageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        void* source = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(source == MAP_FAILED)
+        {
+            throw std::runtime_error(std::string("mmap: ") + strerror(errno));
+        }
+        ::memset(source, 'r', size);
+        protectedPage = source;
+        ::mprotect(protectedPage, pageSize, PROT_NONE);
+
+        sem_init(&faulted, 0, 0U);
+        sem_init(&resumed, 0, 0U);
+        struct sigaction action = {};
+        struct sigaction saved = {};
+        action.sa_handler = pauseOnFault;
+        ::sigaction(SIGSEGV, &action, &saved);
+
+        const std::vector<char> block(CHUNK_SIZE, 'a');
+        {
+            MmapFileLogger logger(FileDescriptor(fd, false));
+
+            const struct iovec head = {const_cast<char*>(block.data()), CHUNK_SIZE - TAIL_SIZE};
+            logger.write(&head, 1);
+
+            // 写者预留整条记录之后停在 chunk 0 的拷贝中, chunk 0 的窗口一直占用
+            std::thread writer([&logger, source, size]()
+            {
+                const struct iovec iov = {source, size};
+                logger.write(&iov, 1);
+            });
+            while(sem_wait(&faulted) != 0)
+            {
+            }
+
+            // chunk WINDOW_COUNT + 1 使用 chunk 1 的窗口, chunk 1 还没有被映射过就已经滑过
+            const struct iovec rest = {const_cast<char*>(block.data()), CHUNK_SIZE - TAIL_SIZE};
+            logger.write(&rest, 1);
+            check(countMappings(path) == 2, "chunk 0 and the chunk after the paused record are mapped");
+
+            sem_post(&resumed);
+            writer.join();
+            check(countMappings(path) == 0, "chunk mapped by another writer is released by the record that fell back to pwrite");
+
+            // 没有 release 时这里等待 chunk WINDOW_COUNT + 1 的窗口, 由 alarm 终止
+            ::alarm(60U);
+            for(size_t i = 0; i < WINDOW_COUNT; i++)
+            {
+                const struct iovec iov = {const_cast<char*>(block.data()), CHUNK_SIZE};
+                logger.write(&iov, 1);
+            }
+            ::alarm(0U);
+        }
+
+        ::sigaction(SIGSEGV, &saved, nullptr);
+        ::munmap(source, size);
+
+        const std::string expected(TAIL_SIZE, 'r');
+        check(readAt(fd, CHUNK_SIZE - TAIL_SIZE, TAIL_SIZE) == expected, "part of the record in chunk 0 is copied");
+        check(readAt(fd, 2 * CHUNK_SIZE - TAIL_SIZE, TAIL_SIZE) == expected, "part of the record in the slid chunk is written with pwrite");
+        check(readAt(fd, (WINDOW_COUNT + 1U) * CHUNK_SIZE, TAIL_SIZE) == expected, "part of the record in the mapped chunk is copied");
+        check(readAt(fd, (WINDOW_COUNT + 1U) * CHUNK_SIZE + TAIL_SIZE, 1) == "a", "record of the other writer is kept");
+
+        ::close(fd);
+        ::unlink(path.c_str());
+    }
+}
+
+int main()
+{
+    static_assert(EXTENT_SIZE % CHUNK_SIZE == 0U, "extent is a multiple of chunk");
+
+    // 超过 RLIMIT_FSIZE 时返回 EFBIG, 不终止进程
+    std::signal(SIGXFSZ, SIG_IGN);
+
+    const char* directory = std::getenv("TMPDIR");
+    try
+    {
+        const std::string path((directory != nullptr) ? directory : "/tmp");
+        testDegradedFallback(path);
+        testSlideFallback(path);
+    }
+    catch(const std::exception& e)
+    {
+        std::fprintf(stderr, "FAILED: %s\n", e.what());
+        return 1;
+    }
+
+    if(failures != 0)
+    {
+        return 1;
+    }
+
+    std::printf("MmapFileLoggerTest: OK\n");
+    return 0;
+}
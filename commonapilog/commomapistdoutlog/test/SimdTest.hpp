@@ -0,0 +1,171 @@
+/*
+ * SIMD 扫描测试共用的工具:
+ *   GuardedBuffer:   把被扫描的数据放在一页的末尾, 下一页是 PROT_NONE, 越过 size 的读取直接 SIGSEGV
+ *   getUtf8Length:   按码点解码的参考实现 (RFC 3629), 和被测代码按首字节查范围的写法独立
+ *   runSimdPaths:    先用 CPU 默认的路径运行, 支持 AVX2 时再设置 COMMON_API_LOGGER_SIMD=sse2 重新执行自己,
+ *                    扫描函数在静态初始化时选定, 只能换一个进程覆盖另一条路径
+ */
+
+#ifndef COMMON_API_SIMD_TEST_HPP_
+#define COMMON_API_SIMD_TEST_HPP_
+
+#include "Utils.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+namespace simdtest
+{
+    class GuardedBuffer
+    {
+    public:
+        GuardedBuffer():pageSize(static_cast<size_t>(::sysconf(_SC_PAGESIZE)))
+        {
+            void* p = ::mmap(nullptr, 2U * pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(p == MAP_FAILED)
+            {
+                throw std::runtime_error(std::string("mmap failed: ") + std::strerror(errno));
+            }
+            memory = static_cast<char*>(p);
+            if(::mprotect(memory + pageSize, pageSize, PROT_NONE) != 0)
+            {
+                ::munmap(memory, 2U * pageSize);
+                throw std::runtime_error(std::string("mprotect failed: ") + std::strerror(errno));
+            }
+        }
+
+        ~GuardedBuffer()
+        {
+            ::munmap(memory, 2U * pageSize);
+        }
+
+        // 返回的指针后面紧跟着不可读的页
+        const char* place(const std::string& data)
+        {
+            char* p = memory + pageSize - data.size();
+            std::memcpy(p, data.data(), data.size());
+            return p;
+        }
+
+        GuardedBuffer(const GuardedBuffer&) = delete;
+        GuardedBuffer& operator=(const GuardedBuffer&) = delete;
+    private:
+        const size_t pageSize;
+        char* memory;
+    };
+
+    // p 开头的合法 UTF-8 多字节序列的长度, 不合法 (截断, 过长编码, 代理区, 超过 U+10FFFF) 时返回 0
+    inline size_t getUtf8Length(const unsigned char* p, size_t size)
+    {
+        size_t length;
+        unsigned codePoint;
+        unsigned minimum;
+        if((p[0] & 0xe0U) == 0xc0U)
+        {
+            length = 2U;
+            codePoint = p[0] & 0x1fU;
+            minimum = 0x80U;
+        }else if((p[0] & 0xf0U) == 0xe0U)
+        {
+            length = 3U;
+            codePoint = p[0] & 0x0fU;
+            minimum = 0x800U;
+        }else if((p[0] & 0xf8U) == 0xf0U)
+        {
+            length = 4U;
+            codePoint = p[0] & 0x07U;
+            minimum = 0x10000U;
+        }else
+        {
+            return 0U;
+        }
+
+        if(size < length)
+        {
+            return 0U;
+        }
+
+        for(size_t i = 1U; i < length; i++)
+        {
+            if((p[i] & 0xc0U) != 0x80U)
+            {
+                return 0U;
+            }
+            codePoint = (codePoint << 6) | (p[i] & 0x3fU);
+        }
+
+        if((codePoint < minimum) || ((codePoint >= 0xd800U) && (codePoint <= 0xdfffU)) || (codePoint > 0x10ffffU))
+        {
+            return 0U;
+        }
+        return length;
+    }
+
+    // 当前进程使用的扫描路径
+    inline const char* getSimdPath()
+    {
+#if defined(__x86_64__)
+        return commonapistdoutlogger::useAvx2() ? "avx2" : "sse2";
+#else
+        return "scalar";
+#endif
+    }
+
+    // 在当前进程运行 test, 然后在 SSE2 子进程里再运行一次; 返回失败的个数
+    template<typename Test>
+    int runSimdPaths(const char* name, Test test)
+    {
+        const int failures = test();
+        if(failures == 0)
+        {
+            std::printf("%s (%s): OK\n", name, getSimdPath());
+        }
+
+#if defined(__x86_64__)
+        if(!commonapistdoutlogger::useAvx2())
+        {
+            return failures;
+        }
+
+        std::fflush(stdout);
+        const pid_t pid = ::fork();
+        if(pid < 0)
+        {
+            std::fprintf(stderr, "FAILED: fork: %s\n", std::strerror(errno));
+            return failures + 1;
+        }
+        if(pid == 0)
+        {
+            ::setenv("COMMON_API_LOGGER_SIMD", "sse2", 1);
+            char* const argv[] = {const_cast<char*>(name), nullptr};
+            ::execv("/proc/self/exe", argv);
+            std::fprintf(stderr, "FAILED: exec: %s\n", std::strerror(errno));
+            ::_exit(127);
+        }
+
+        int status(0);
+        while(::waitpid(pid, &status, 0) < 0)
+        {
+            if(errno != EINTR)
+            {
+                std::fprintf(stderr, "FAILED: waitpid: %s\n", std::strerror(errno));
+                return failures + 1;
+            }
+        }
+        if(!WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+        {
+            return failures + 1;
+        }
+#endif
+        return failures;
+    }
+}
+
+#endif
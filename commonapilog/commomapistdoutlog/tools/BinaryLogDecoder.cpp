@@ -0,0 +1,296 @@
+/*
+ * commonapilogdecode: 把 messageFormat=binary 输出的记录渲染成文本.
+ *
+ *   commonapilogdecode [-f prefixFormat] [file...]
+ *
+ * 没有给出文件时从标准输入读取. 默认使用记录里 CONTEXT 给出的前缀格式, -f 可以换成任意 $/strftime 格式;
+ * 时间按本地时区渲染, 可以用 TZ 环境变量指定.
+ * 其它线程的记录可能排在本秒的 CONTEXT 之前 (例如文件或切分段的开头): 这些记录和之后的记录按顺序暂存,
+ * 等到它们的 CONTEXT 再输出; 直到输入结束都没有等到时用默认格式输出.
+ */
+
+#include "BinaryRecord.hpp"
+#include "MessageFormat.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace commonapistdoutlogger;
+
+namespace
+{
+    constexpr const char* DEFAULT_PREFIX("<$r>1 %Y-%m-%dT%H:%M:%S.$6$z $H $i $p - - ");
+
+    constexpr uint64_t NANOSECONDS_PER_SECOND(1000000000U);
+
+    // 等待 CONTEXT 时最多暂存的消息体字节数, 超过时最早的记录用默认格式输出
+    constexpr size_t MAX_HELD_BYTES(64U << 20);
+
+    // length 来自文件, 先检查上限再分配 body
+    bool isValidHeader(const BinaryRecordHeader& header) noexcept
+    {
+        return (header.magic == BINARY_RECORD_MAGIC) && (header.length <= BINARY_RECORD_MAX_LENGTH);
+    }
+
+    struct Context
+    {
+        std::string ident;
+        std::string hostname;
+        std::string fqdn;
+        std::unique_ptr<MessageFormatter> formatter;
+    };
+
+    class Decoder
+    {
+    public:
+        explicit Decoder(const char* prefixOverride):prefixOverride(prefixOverride), unknown{"-", "-", "-", createFormatter(DEFAULT_PREFIX)}
+        {
+        }
+
+        void decode(FILE* input, const char* name);
+
+        // 输入全部结束后调用, 输出还在等待 CONTEXT 的记录
+        void finish();
+    private:
+        struct HeldRecord
+        {
+            BinaryRecordHeader header;
+            std::string body;
+        };
+
+        const char* const prefixOverride;
+        Context unknown;    /* 直到输入结束都没有读到 CONTEXT 的记录 */
+        std::map<std::pair<uint32_t, uint64_t>, Context> contexts;
+        std::map<uint64_t, const Context*> latest;    /* 同一个 formatter 也会替被重定向的子进程输出 */
+        std::deque<HeldRecord> held;    /* 第一条还没有 CONTEXT 的记录和它之后的所有记录, 保持原来的顺序 */
+        size_t heldBytes = 0U;
+        std::string body;
+        std::string out;
+
+        std::unique_ptr<MessageFormatter> createFormatter(const std::string& prefixFormat) const;
+        bool resync(FILE* input, BinaryRecordHeader& header, const char* name);
+        void addContext(const BinaryRecordHeader& header);
+        const Context* findContext(const BinaryRecordHeader& header) const;
+        void addMessage(const BinaryRecordHeader& header);
+        void releaseHeld(bool force);
+        void printMessage(const BinaryRecordHeader& header, const std::string& message, const Context& context);
+    };
+
+    std::unique_ptr<MessageFormatter> Decoder::createFormatter(const std::string& prefixFormat) const
+    {
+        try
+        {
+            return std::make_unique<MessageFormatter>((prefixOverride != nullptr) ? prefixOverride : prefixFormat);
+        }
+        catch(const std::runtime_error& e)
+        {
+            fprintf(stderr, "%s, use RFC 5424 as default\n", e.what());
+            return std::make_unique<MessageFormatter>(DEFAULT_PREFIX);
+        }
+    }
+
+    // 头部损坏 (例如文件被截断后又继续写) 时逐字节向后查找下一个 magic 和 length 都合法的头
+    bool Decoder::resync(FILE* input, BinaryRecordHeader& header, const char* name)
+    {
+        size_t skipped(0U);
+        char* const bytes = reinterpret_cast<char*>(&header);
+        while(!isValidHeader(header))
+        {
+            memmove(bytes, bytes + 1, sizeof(header) - 1U);
+            const int c = fgetc(input);
+            if(c == EOF)
+            {
+                return false;
+            }
+            bytes[sizeof(header) - 1U] = static_cast<char>(c);
+            skipped++;
+        }
+
+        fprintf(stderr, "%s: skipped %zu bytes of garbage\n", name, skipped);
+        return true;
+    }
+
+    void Decoder::addContext(const BinaryRecordHeader& header)
+    {
+        std::string fields[4];
+        size_t field(0U);
+        for(size_t i = 0; (i < body.size()) && (field < 4U); i++)
+        {
+            if(body[i] == '\0')
+            {
+                field++;
+            }else
+            {
+                fields[field] += body[i];
+            }
+        }
+
+        Context& context = contexts[{header.pid, header.identId}];
+        if(!context.formatter || (context.formatter->getPrefixFormat() != fields[3]))
+        {
+            context.formatter = createFormatter(fields[3]);
+        }
+        context.ident = fields[0];
+        context.hostname = fields[1];
+        context.fqdn = fields[2];
+        latest[header.identId] = &context;
+    }
+
+    const Context* Decoder::findContext(const BinaryRecordHeader& header) const
+    {
+        const auto it = contexts.find({header.pid, header.identId});
+        if(it != contexts.end())
+        {
+            return &it->second;
+        }
+
+        const auto last = latest.find(header.identId);
+        return (last != latest.end()) ? last->second : nullptr;
+    }
+
+    void Decoder::addMessage(const BinaryRecordHeader& header)
+    {
+        if(held.empty())
+        {
+            if(const Context* context = findContext(header))
+            {
+                printMessage(header, body, *context);
+                return;
+            }
+        }
+
+        heldBytes += body.size();
+        held.push_back({header, body});
+        while(heldBytes > MAX_HELD_BYTES)
+        {
+            releaseHeld(true);
+        }
+    }
+
+    // 按顺序输出暂存的记录, 停在下一条还没有 CONTEXT 的记录; force 时这一条用默认格式输出
+    void Decoder::releaseHeld(bool force)
+    {
+        while(!held.empty())
+        {
+            const HeldRecord& record = held.front();
+            const Context* context = findContext(record.header);
+            if(context == nullptr)
+            {
+                if(!force)
+                {
+                    return;
+                }
+                context = &unknown;
+                force = false;
+            }
+
+            printMessage(record.header, record.body, *context);
+            heldBytes -= record.body.size();
+            held.pop_front();
+        }
+    }
+
+    void Decoder::finish()
+    {
+        while(!held.empty())
+        {
+            releaseHeld(true);
+        }
+    }
+
+    void Decoder::printMessage(const BinaryRecordHeader& header, const std::string& message, const Context& context)
+    {
+        struct timespec t;
+        t.tv_sec = static_cast<time_t>(header.realtime / NANOSECONDS_PER_SECOND);
+        t.tv_nsec = static_cast<long>(header.realtime % NANOSECONDS_PER_SECOND);
+
+        out.clear();
+        context.formatter->renderPrefix(out, header.priority, context.ident, static_cast<pid_t>(header.pid), t, context.hostname, context.fqdn);
+        out += message;
+        if(message.empty() || (message.back() != '\n'))
+        {
+            out += '\n';
+        }
+        fwrite(out.data(), 1U, out.size(), stdout);
+    }
+
+    void Decoder::decode(FILE* input, const char* name)
+    {
+        BinaryRecordHeader header;
+        while(fread(&header, sizeof(header), 1U, input) == 1U)
+        {
+            if(!isValidHeader(header) && !resync(input, header, name))
+            {
+                break;
+            }
+
+            body.resize(header.length);
+            if((header.length > 0U) && (fread(&body[0], header.length, 1U, input) != 1U))
+            {
+                fprintf(stderr, "%s: truncated record\n", name);
+                break;
+            }
+
+            if(header.type == BINARY_RECORD_CONTEXT)
+            {
+                addContext(header);
+                releaseHeld(false);
+            }else if(header.type == BINARY_RECORD_MESSAGE)
+            {
+                addMessage(header);
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const char* prefixOverride(nullptr);
+    int opt;
+    while((opt = getopt(argc, argv, "f:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+            prefixOverride = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-f prefixFormat] [file...]\n", argv[0]);
+            return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    Decoder decoder(prefixOverride);
+
+    if(optind == argc)
+    {
+        decoder.decode(stdin, "stdin");
+        decoder.finish();
+        return 0;
+    }
+
+    int ret(0);
+    for(int i = optind; i < argc; i++)
+    {
+        FILE* input = fopen(argv[i], "rb");
+        if(input == nullptr)
+        {
+            fprintf(stderr, "%s: %s\n", argv[i], strerror(errno));
+            ret = 1;
+            continue;
+        }
+        decoder.decode(input, argv[i]);
+        fclose(input);
+    }
+    decoder.finish();
+
+    return ret;
+}
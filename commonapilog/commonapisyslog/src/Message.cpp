@@ -3,10 +3,49 @@
 #include <array>
 #include <string>
 #include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
 #include <syslog.h>
+#include <time.h>
 
 #include "Message.hpp"
 
+namespace
+{
+    // 和 stdout 插件共用 COMMON_API_LOGGER_CLOCK; 这里的时间戳只到秒, tsc 和 coarse 一样读 CLOCK_REALTIME_COARSE
+    bool useCoarseClock()
+    {
+        const char* value = ::getenv("COMMON_API_LOGGER_CLOCK");
+        if((value == nullptr) || (strcmp(value, "realtime") == 0))
+        {
+            return false;
+        }
+
+        if((strcmp(value, "coarse") == 0) || (strcmp(value, "tsc") == 0))
+        {
+            return true;
+        }
+
+        std::cerr << "COMMON_API_LOGGER_CLOCK: unknown clock \"" << value << "\", use realtime" << std::endl;
+        return false;
+    }
+
+    // 默认仍然用 time(): vDSO 直接读秒数, clocksource 不是 tsc 的虚拟机上也不进入内核
+    time_t getTime()
+    {
+        static const bool coarse = useCoarseClock();
+        if(!coarse)
+        {
+            return ::time(nullptr);
+        }
+
+        struct timespec ts;
+        ::clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+        return ts.tv_sec;
+    }
+}
+
 int commapisyslog::toFacility(int facility)
 {
     const auto ret = facility & LOG_FACMASK;
@@ -24,7 +63,7 @@ std::string commapisyslog::createMessage( const std::string& ident, pid_t pid, i
                             size_t size )
 {
     //获取当前时间戳
-    const time_t t = ::time(nullptr);
+    const time_t t = getTime();
 
     //转换成本地时间
     struct tm tm = *::localtime(&t);